@@ -0,0 +1,95 @@
+#!/usr/bin/env python3
+
+import argparse
+import logging
+import math
+import struct
+import time
+import radiance
+
+# This device measures how fast Radiance can sample and send frames
+# to a large installation.
+#
+# Point a LightOutputNode at it and put something in front of it.
+# Once a second it prints the number of frames received,
+# the bytes of pixel data in each frame
+# and the time per frame.
+# With --period 0 (the default) frames are requested one at a time,
+# so the time per frame is the full round trip:
+# render, sample, read back, send.
+# With --delta, the bytes per frame count frame deltas as they arrive.
+
+class Benchmark(radiance.LightOutputNode):
+    BYTES_PER_PIXEL = {"rgba8": 4, "rgb8": 3, "rgb565": 2, "rgb16": 6}
+
+    def __init__(self, pixels, period, fmt="rgba8", delta=False, *args, **kwargs):
+        super().__init__(*args, **kwargs)
+
+        self.description = {
+            "name": "Benchmark ({} pixels)".format(pixels),
+            "size": [1024, 1024],
+            "format": fmt,
+            "delta": delta
+        }
+        self.bytes_per_pixel = self.BYTES_PER_PIXEL[fmt]
+
+        # Spread the pixels evenly over the canvas
+        side = math.ceil(math.sqrt(pixels))
+        self.lookup_2d = [((i % side + 0.5) / side, (i // side + 0.5) / side) for i in range(pixels)]
+        self.pixels = pixels
+        self.period = period
+
+    def send_packet(self, d):
+        # The base class prints every packet, which is far too slow here
+        length_bytes = struct.pack("<I", len(d))
+        self.clientsocket.sendall(length_bytes + d)
+
+    def on_connect(self):
+        super().on_connect()
+        self.reset()
+        self.requested = time.monotonic()
+
+    def reset(self):
+        self.window_start = time.monotonic()
+        self.frames = 0
+        self.frame_bytes = 0
+        self.round_trip = 0.
+
+    def handle_packet(self, packet):
+        # Don't bother unpacking the colors
+        if packet[4] not in (2, 10):
+            return
+        now = time.monotonic()
+        self.frames += 1
+        self.frame_bytes += len(packet) - 5
+        self.round_trip += now - self.requested
+
+        if self.frames and now - self.window_start >= 1.:
+            elapsed = now - self.window_start
+            expected = self.bytes_per_pixel * self.pixels
+            print("{:6.1f} fps  {:8.0f} bytes/frame ({:+.0f} vs. {} pixels)  {:6.2f} ms/frame  {:6.2f} ms round trip".format(
+                self.frames / elapsed,
+                self.frame_bytes / self.frames,
+                self.frame_bytes / self.frames - expected,
+                self.pixels,
+                1000. * elapsed / self.frames,
+                1000. * self.round_trip / self.frames))
+            self.reset()
+
+        if self.period == 0:
+            self.requested = time.monotonic()
+            self.send_get_frame(0)
+        else:
+            self.requested = now
+
+parser = argparse.ArgumentParser(description="Measure LightOutputNode throughput")
+parser.add_argument("--pixels", type=int, default=50000, help="number of pixels to sample")
+parser.add_argument("--period", type=int, default=0, help="frame period in ms, or 0 to request frames one at a time")
+parser.add_argument("--port", type=int, default=11647)
+parser.add_argument("--udp", action="store_true", help="receive frames over UDP (point Radiance at udp://host:port)")
+parser.add_argument("--format", default="rgba8", choices=sorted(Benchmark.BYTES_PER_PIXEL), help="pixel format to ask for")
+parser.add_argument("--delta", action="store_true", help="accept frame deltas")
+args = parser.parse_args()
+
+logging.basicConfig(level=logging.INFO)
+Benchmark(args.pixels, args.period, args.format, args.delta, port=args.port, udp=args.udp).serve_forever()
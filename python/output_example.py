@@ -20,6 +20,13 @@ class Example(radiance.LightOutputNode):
             "size": [100, 100]
         }
 
+        # Radiance can correct the colors for your LEDs before sending them,
+        # so there is no need to do it here. For example:
+        #self.description["gamma"] = 2.2
+        #self.description["color_matrix"] = [[1, 0, 0], [0, 0.8, 0], [0, 0, 0.7]]
+        #self.description["max_brightness"] = 0.5
+        #self.description["dither"] = True
+
         # This would request 5 pixels at the corners and center.
         #self.lookup_2d([(0, 0), (0, 1), (1, 0), (1, 1), (0.5, 0.5)])
 
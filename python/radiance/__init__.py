@@ -1 +1,2 @@
 from radiance.light_output_node import *
+from radiance.shared_memory import *
@@ -1,4 +1,5 @@
 import socket
+import select
 import json
 import struct
 import time
@@ -7,26 +8,50 @@ import logging
 __all__ = ["LightOutputNode"]
 
 class LightOutputNode:
-    def __init__(self, port=11647, host=""):
+    # With udp=True, frames are received as datagrams on the same port.
+    # Point Radiance at udp://host:port to use this.
+    def __init__(self, port=11647, host="", udp=False):
         self.host = host
         self.port = port
+        self.udp = udp
         self.description = None
         self.lookup_2d = None
+        # (t, u, v) for each light, instead of lookup_2d
+        self.lookup_3d = None
         self.physical_2d = None
         self.geometry_2d = None
         self.period = None
+        # When frames are requested one at a time over UDP,
+        # a lost frame would stall everything,
+        # so another is requested after this many seconds
+        self.udp_timeout = 0.1
+        # Seconds between UDP statistics in the log
+        self.udp_stats_interval = 5
 
     def listen(self):
         self.serversocket = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
         self.serversocket.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
         self.serversocket.bind((self.host, self.port))
         self.serversocket.listen(1)
+        if self.udp:
+            self.udpsocket = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+            self.udpsocket.bind((self.host, self.port))
 
     def accept(self):
         (clientsocket, address) = self.serversocket.accept()
         self.clientsocket = clientsocket
         self.address = address
         self.buffer = b""
+        self.last_frame = None
+        self.reset_udp()
+
+    def reset_udp(self):
+        # Radiance numbers frames from 1 on every connection
+        self.udp_last = 0 # Last complete frame
+        self.udp_sequence = None # Frame being assembled
+        self.udp_fragments = {}
+        self.udp_stats = {"frames": 0, "lost": 0, "late": 0}
+        self.udp_stats_time = time.monotonic()
 
     def send_packet(self, d):
         print(d)
@@ -37,12 +62,17 @@ class LightOutputNode:
         self.send_packet(bytes((0,)) + bytes(json.dumps(description), encoding="utf8"))
 
     def send_get_frame(self, frame_period_ms):
+        self.frame_requested = time.monotonic()
         self.send_packet(bytes((1,)) + struct.pack("<I", frame_period_ms))
 
     def send_lookup_2d(self, locations):
         locations_flat = [item for sublist in locations for item in sublist]
         self.send_packet(bytes((3,)) + struct.pack("<{}f".format(len(locations_flat)), *locations_flat))
 
+    def send_lookup_3d(self, locations):
+        locations_flat = [item for sublist in locations for item in sublist]
+        self.send_packet(bytes((6,)) + struct.pack("<{}f".format(len(locations_flat)), *locations_flat))
+
     def send_physical_2d(self, locations):
         locations_flat = [item for sublist in locations for item in sublist]
         self.send_packet(bytes((4,)) + struct.pack("<{}f".format(len(locations_flat)), *locations_flat))
@@ -63,10 +93,84 @@ class LightOutputNode:
                 self.buffer = self.buffer[packet_length + 4:]
                 return packet
 
+    def recv_datagram(self):
+        # Returns a "frame" packet once every fragment of a frame is in.
+        # The newest frame always wins:
+        # a fragment of a newer frame abandons the one being assembled,
+        # and fragments of older frames are thrown away.
+        datagram = self.udpsocket.recv(65536)
+        if len(datagram) < 12:
+            return
+        (sequence, index, count, offset) = struct.unpack("<IHHI", datagram[0:12])
+
+        def newer(a, b):
+            return a != b and ((a - b) & 0xFFFFFFFF) < 0x80000000
+
+        newest = self.udp_sequence if self.udp_sequence is not None else self.udp_last
+        if sequence != self.udp_sequence and not newer(sequence, newest):
+            self.udp_stats["late"] += 1
+            return
+        if sequence != self.udp_sequence:
+            self.udp_sequence = sequence
+            self.udp_fragments = {}
+        self.udp_fragments[index] = (offset, datagram[12:])
+        if len(self.udp_fragments) < count:
+            return
+
+        # Frames in between were lost or never completed
+        self.udp_stats["lost"] += ((sequence - self.udp_last) & 0xFFFFFFFF) - 1
+        self.udp_stats["frames"] += 1
+        self.udp_last = sequence
+        self.udp_sequence = None
+        data = b"".join(fragment for (_, fragment) in sorted(self.udp_fragments.values()))
+        self.udp_fragments = {}
+        return struct.pack("<IB", len(data) + 1, 2) + data
+
+    def log_udp_stats(self):
+        now = time.monotonic()
+        if now - self.udp_stats_time < self.udp_stats_interval:
+            return
+        logger = logging.getLogger(__name__)
+        logger.info("UDP: {frames} frames, {lost} lost, {late} late datagrams".format(**self.udp_stats))
+        self.udp_stats = {"frames": 0, "lost": 0, "late": 0}
+        self.udp_stats_time = now
+
+    def frame_format(self):
+        if self.description is None:
+            return "rgba8"
+        return self.description.get("format", "rgba8")
+
     def parse_frame(self, packet):
-        if packet[4] != 2:
+        # Returns a list of colors in the format from the description:
+        # (r, g, b, a) for rgba8, (r, g, b) for the others.
+        # rgb565 is widened to 8 bits per channel
+        # and rgb16 stays 16 bits per channel.
+        if packet[4] == 2:
+            self.last_frame = bytes(packet[5:])
+        elif packet[4] == 10 and self.last_frame is not None:
+            # Runs of changed bytes to patch into the previous frame
+            frame = bytearray(self.last_frame)
+            i = 5
+            while i + 8 <= len(packet):
+                (offset, length) = struct.unpack("<II", packet[i:i+8])
+                frame[offset:offset+length] = packet[i+8:i+8+length]
+                i += 8 + length
+            self.last_frame = bytes(frame)
+        else:
             return
-        return [(packet[i], packet[i+1], packet[i+2], packet[i+3]) for i in range(5, len(packet), 4)]
+
+        data = self.last_frame
+        fmt = self.frame_format()
+        if fmt == "rgb8":
+            return [tuple(data[i:i+3]) for i in range(0, len(data) - 2, 3)]
+        if fmt == "rgb565":
+            def widen(v, bits):
+                return (v << (8 - bits)) | (v >> (2 * bits - 8))
+            return [(widen(v >> 11, 5), widen((v >> 5) & 0x3F, 6), widen(v & 0x1F, 5))
+                    for (v,) in struct.iter_unpack("<H", data[:len(data) // 2 * 2])]
+        if fmt == "rgb16":
+            return list(struct.iter_unpack("<3H", data[:len(data) // 6 * 6]))
+        return [tuple(data[i:i+4]) for i in range(0, len(data) - 3, 4)]
 
     def send_defaults(self):
         if self.description is not None:
@@ -75,6 +179,9 @@ class LightOutputNode:
         if self.lookup_2d is not None:
             self.send_lookup_2d(self.lookup_2d)
 
+        if self.lookup_3d is not None:
+            self.send_lookup_3d(self.lookup_3d)
+
         if self.physical_2d is not None:
             self.send_physical_2d(self.physical_2d)
 
@@ -102,6 +209,17 @@ class LightOutputNode:
                     self.send_get_frame(self.period)
 
                 while True:
+                    if self.udp:
+                        (readable, _, _) = select.select([self.clientsocket, self.udpsocket], [], [], self.udp_timeout)
+                        if self.udpsocket in readable:
+                            packet = self.recv_datagram()
+                            if packet is not None:
+                                self.handle_packet(packet)
+                        self.log_udp_stats()
+                        if self.clientsocket not in readable:
+                            if self.period == 0 and time.monotonic() - self.frame_requested > self.udp_timeout:
+                                self.send_get_frame(self.period)
+                            continue
                     packet = self.recv_packet()
                     if not packet:
                         break
@@ -0,0 +1,157 @@
+import ctypes
+import ctypes.util
+import mmap
+import os
+import platform
+import struct
+import time
+
+try:
+    # What multiprocessing.shared_memory opens segments with
+    from _posixshmem import shm_open
+except ImportError:
+    shm_open = None
+
+__all__ = ["SharedMemoryReader"]
+
+# See src/radiance_shm.h for the layout
+MAGIC = 0x6d687352
+VERSION = 1
+FORMAT_RGBA8 = 0
+
+HEADER = struct.Struct("=IIIIIIQI12x")
+SLOT = struct.Struct("=QQIIII32x")
+LATEST_OFFSET = 24
+NOTIFY_OFFSET = 32
+
+FUTEX_WAIT = 0
+SYS_FUTEX = {"x86_64": 202, "aarch64": 98, "armv7l": 240, "i686": 240}.get(platform.machine())
+
+class Timespec(ctypes.Structure):
+    _fields_ = [("tv_sec", ctypes.c_long), ("tv_nsec", ctypes.c_long)]
+
+def _open_readonly(name):
+    # shm_open() knows where the system keeps shared memory objects;
+    # only on Linux are they files in /dev/shm
+    if shm_open is not None:
+        return shm_open(name, os.O_RDONLY, mode=0)
+    return os.open("/dev/shm" + name, os.O_RDONLY)
+
+class SharedMemoryReader:
+    # Reads the frames that a SharedMemoryOutputNode publishes.
+    # name is the node's name, e.g. "/radiance".
+    #
+    # On Linux, wait() sleeps on the futex that Radiance wakes after every frame.
+    # Elsewhere, it polls.
+    def __init__(self, name="/radiance"):
+        if not name.startswith("/"):
+            name = "/" + name
+        self.name = name
+        self.buffer = None
+        self.last_sequence = 0
+        self.libc = None
+        self.address = None
+        if SYS_FUTEX is not None and platform.system() == "Linux":
+            self.libc = ctypes.CDLL(ctypes.util.find_library("c"), use_errno=True)
+            self.libc.mmap.restype = ctypes.c_void_p
+            self.libc.mmap.argtypes = [ctypes.c_void_p, ctypes.c_size_t, ctypes.c_int, ctypes.c_int, ctypes.c_int, ctypes.c_long]
+            self.libc.munmap.argtypes = [ctypes.c_void_p, ctypes.c_size_t]
+
+    def open(self):
+        # Returns True once the shared memory exists and is ready
+        self.close()
+        try:
+            fd = _open_readonly(self.name)
+        except FileNotFoundError:
+            return False
+        try:
+            size = os.fstat(fd).st_size
+            if size < HEADER.size:
+                return False
+            if self.libc is not None:
+                # Mapped through libc so that we know its address for the futex
+                address = self.libc.mmap(None, size, mmap.PROT_READ, mmap.MAP_SHARED, fd, 0)
+                if address in (None, ctypes.c_void_p(-1).value):
+                    return False
+                self.address = address
+                self.size = size
+                self.buffer = (ctypes.c_char * size).from_address(address)
+            else:
+                self.buffer = mmap.mmap(fd, size, prot=mmap.PROT_READ)
+        finally:
+            os.close(fd)
+        (magic, version, self.slots_offset, self.slot_size, self.slot_count,
+            _, _, _) = HEADER.unpack_from(self.buffer)
+        if magic != MAGIC or version != VERSION:
+            self.close()
+            return False
+        self.last_sequence = 0
+        return True
+
+    def close(self):
+        if self.buffer is None:
+            return
+        if self.address is not None:
+            self.buffer = None
+            self.libc.munmap(self.address, self.size)
+            self.address = None
+        else:
+            self.buffer.close()
+            self.buffer = None
+
+    def _ready(self):
+        if self.buffer is not None and struct.unpack_from("=I", self.buffer)[0] == MAGIC:
+            return True
+        # Radiance stopped publishing to this object, or hasn't started
+        return self.open()
+
+    def read(self):
+        # Returns (sequence, timestamp_ns, width, height, pixels)
+        # for the newest frame, or None if there isn't one.
+        # pixels are RGBA, a row at a time from the bottom row up.
+        while self._ready():
+            latest = struct.unpack_from("=Q", self.buffer, LATEST_OFFSET)[0]
+            if latest == 0:
+                return None
+            offset = self.slots_offset + (latest % self.slot_count) * self.slot_size
+            (sequence, timestamp_ns, width, height, fmt, size) = SLOT.unpack_from(self.buffer, offset)
+            if sequence != latest:
+                continue
+            start = offset + SLOT.size
+            pixels = self.buffer[start:start + size]
+            if struct.unpack_from("=Q", self.buffer, offset)[0] != sequence:
+                # Overwritten while we were copying it
+                continue
+            self.last_sequence = sequence
+            return (sequence, timestamp_ns, width, height, pixels)
+        return None
+
+    def wait(self, timeout=None):
+        # Waits for a frame newer than the last one read,
+        # or for timeout seconds, then returns it like read() does
+        deadline = None if timeout is None else time.monotonic() + timeout
+        while True:
+            remaining = None if deadline is None else deadline - time.monotonic()
+            if remaining is not None and remaining <= 0:
+                return None
+            if not self._ready():
+                time.sleep(0.01 if remaining is None else min(0.01, remaining))
+                continue
+            notify = struct.unpack_from("=I", self.buffer, NOTIFY_OFFSET)[0]
+            latest = struct.unpack_from("=Q", self.buffer, LATEST_OFFSET)[0]
+            if latest > self.last_sequence:
+                frame = self.read()
+                if frame is not None:
+                    return frame
+            self._wait_notify(notify, remaining)
+
+    def _wait_notify(self, notify, timeout):
+        if self.address is None:
+            time.sleep(0.001 if timeout is None else min(0.001, timeout))
+            return
+        ts = None
+        if timeout is not None:
+            ts = Timespec(int(timeout), int((timeout % 1) * 1e9))
+        # Returns at once if notify already changed
+        self.libc.syscall(SYS_FUTEX, ctypes.c_void_p(self.address + NOTIFY_OFFSET), FUTEX_WAIT,
+                          ctypes.c_uint32(notify), ctypes.byref(ts) if ts is not None else None, None, 0)
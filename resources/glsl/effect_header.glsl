@@ -6,6 +6,12 @@ varying highp vec2 uv;
 #define fragColor gl_FragColor
 #define _FLEXARRAY 8
 #define texture texture2D
+#elif defined(COMPUTE_SHADER)
+// Compute passes (#computeshader) have no uv or fragColor.
+// They write their output with imageStore(iOutput, ...)
+// and can read it back in later passes through iChannel.
+writeonly uniform image2D iOutput;
+#define _FLEXARRAY
 #else
 in vec4 gl_FragCoord;
 in vec2 uv;
@@ -49,6 +55,100 @@ uniform sampler2D iNoise;
 // Previous outputs of the other channels (e.g. foo.1.glsl)
 uniform sampler2D iChannel[_FLEXARRAY];
 
+#if !defined(GL_ES) && !defined(COMPUTE_SHADER)
+// The part of the canvas being rendered, (x, y, width, height)
+// as a fraction of iResolution.
+// uv always covers the whole canvas,
+// so this is only (0, 0, 1, 1) unless the output is tiled.
+uniform vec4 iTileRect;
+
+// Canvas coordinates, such as uv, to coordinates in
+// the textures that the chain renders, which only cover the tile
+vec2 tileLocal(vec2 p) {
+    return (p - iTileRect.xy) / iTileRect.zw;
+}
+#else
+// Compute passes work in coordinates of the tile already
+vec2 tileLocal(vec2 p) {
+    return p;
+}
+#endif
+
+// texture() and textureLod() at canvas coordinates,
+// for iInputs, iChannel and iHistory.
+// Sampling those with plain texture() at uv
+// gives the wrong part of the picture when the output is tiled,
+// so lookups written directly on them are turned into these
+// when the effect is compiled.
+// Call these yourself when passing one of them as a sampler2D argument.
+// iNoise is just noise, so plain texture() does for it.
+vec4 canvasTexture(sampler2D s, vec2 p) {
+    return texture(s, tileLocal(p));
+}
+#if !defined(GL_ES) && !defined(COMPUTE_SHADER)
+vec4 canvasTexture(sampler2D s, vec2 p, float bias) {
+    return texture(s, tileLocal(p), bias);
+}
+#endif
+#ifndef GL_ES
+vec4 canvasTexture(sampler2DArray s, vec3 p) {
+    return texture(s, vec3(tileLocal(p.xy), p.z));
+}
+vec4 canvasTextureLod(sampler2D s, vec2 p, float lod) {
+    return textureLod(s, tileLocal(p), lod);
+}
+vec4 canvasTextureLod(sampler2DArray s, vec3 p, float lod) {
+    return textureLod(s, vec3(tileLocal(p.xy), p.z), lod);
+}
+#endif
+
+#ifndef GL_ES
+// Previous frames, newest at layer iHistoryHead.
+// Only filled in if the effect asks for them,
+// e.g. with "#property historyDepth 8".
+// They are this effect's own previous outputs,
+// or its iInput with "#property historySource input".
+uniform sampler2DArray iHistory;
+uniform int iHistoryHead;
+uniform int iHistoryDepth;
+
+// The k-th newest history frame, 0 <= k < iHistoryDepth.
+// k = 0 is last frame's output, or this frame's iInput.
+vec4 history(int k, vec2 p) {
+    int depth = max(iHistoryDepth, 1);
+    int layer = (iHistoryHead - clamp(k, 0, depth - 1) + depth) % depth;
+    return canvasTexture(iHistory, vec3(p, float(layer)));
+}
+
+// Statistics of iInput, if the effect asks for them
+// with "#property inputStatistics true"
+uniform sampler2D iStats;
+// Mean color (premultiplied) and mean luminance
+#define iInputMean texelFetch(iStats, ivec2(0, 0), 0)
+// Brightest value of each channel and of luminance
+#define iInputMax texelFetch(iStats, ivec2(1, 0), 0)
+// Dominant hue as a fully saturated color, and as a hue in [0, 1)
+#define iInputHue texelFetch(iStats, ivec2(2, 0), 0)
+// Fraction of pixels in histogram bin i (0 <= i < 16) of r, g, b and luminance
+vec4 iInputHistogram(int i) {
+    return texelFetch(iStats, ivec2(i, 1), 0);
+}
+
+// Blur of a mipmapped sampler, with a radius in pixels.
+// iInputs are mipmapped if the effect asks for it
+// with "#property inputPyramid true"
+vec4 pyramidBlur(sampler2D s, vec2 p, float radius) {
+    float lod = max(log2(radius), 0.);
+    // Four taps straddling the texels of the chosen level
+    // hide the blockiness of the box-filtered mipmaps
+    vec2 d = 0.5 * exp2(lod) / iResolution;
+    return 0.25 * (canvasTextureLod(s, p + vec2( d.x,  d.y), lod)
+                 + canvasTextureLod(s, p + vec2(-d.x,  d.y), lod)
+                 + canvasTextureLod(s, p + vec2( d.x, -d.y), lod)
+                 + canvasTextureLod(s, p + vec2(-d.x, -d.y), lod));
+}
+#endif
+
 #define M_PI 3.1415926535897932384626433832795
 
 float lin_step(float v) {
@@ -0,0 +1,35 @@
+#property description Even out the brightness using the average luminance
+
+void main(void) {
+    vec4 c = texture(iInput, uv);
+    float mean = texelFetch(iChannel[1], ivec2(0, 0), 0).r;
+    float gain = clamp(0.5 / max(mean, 0.01), 0.25, 4.);
+    fragColor = clamp(vec4(c.rgb * mix(1., gain, iIntensity), c.a), 0., 1.);
+    fragColor.rgb = min(fragColor.rgb, fragColor.a);
+}
+
+#computeshader 1 1
+// Average luminance of a 64x64 grid over the input,
+// reduced in shared memory by a single work group
+layout(local_size_x = 16, local_size_y = 16) in;
+shared float partial[256];
+
+void main(void) {
+    uint i = gl_LocalInvocationIndex;
+    float sum = 0.;
+    for (uint y = gl_LocalInvocationID.y; y < 64u; y += 16u) {
+        for (uint x = gl_LocalInvocationID.x; x < 64u; x += 16u) {
+            vec4 c = textureLod(iInput, (vec2(x, y) + 0.5) / 64., 0.);
+            sum += dot(c.rgb, vec3(0.2126, 0.7152, 0.0722));
+        }
+    }
+    partial[i] = sum;
+    barrier();
+    for (uint s = 128u; s > 0u; s >>= 1u) {
+        if (i < s) partial[i] += partial[i + s];
+        barrier();
+    }
+    if (i == 0u) {
+        imageStore(iOutput, ivec2(0, 0), vec4(partial[0] / 4096.));
+    }
+}
@@ -0,0 +1,11 @@
+#property description Wash the image in its own dominant color
+#property inputStatistics true
+
+void main(void) {
+    vec4 c = texture(iInput, uv);
+    vec3 weights = vec3(0.2126, 0.7152, 0.0722);
+    vec3 hue = iInputHue.rgb;
+    // Keep the luminance of each pixel
+    vec3 tint = hue * dot(c.rgb, weights) / max(dot(hue, weights), 0.001);
+    fragColor = vec4(mix(c.rgb, min(tint, c.a), iIntensity), c.a);
+}
@@ -21,13 +21,13 @@ vec3 ToGamma( in vec3 col )
 
 vec4 Noise( in ivec2 x )
 {
-	return 2. * texture(iNoise, (vec2(x)+0.5)/256.0, -100.);
+	return 2. * texture(iNoise, (vec2(x)+0.5)/256.0);
 }
 
 void main()
 {
 	vec3 ray;
-	ray.xy = 2.0*(gl_FragCoord.xy-iResolution.xy*.5)/iResolution.x;
+	ray.xy = 2.0*(uv*iResolution.xy-iResolution.xy*.5)/iResolution.x;
 	ray.z = 1.0;
 
 	//float offset = iTime*.5;
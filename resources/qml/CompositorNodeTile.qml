@@ -0,0 +1,63 @@
+import QtQuick 2.7
+import QtQuick.Layouts 1.2
+import QtQuick.Controls 2.2
+import radiance 1.0
+import "."
+
+VideoNodeTile {
+    id: tile;
+
+    property var blendModeNames: ["normal", "add", "multiply", "screen", "lighten", "darken", "difference"]
+    property int layerCount: videoNode ? videoNode.inputCount : 0
+
+    normalHeight: 210 + 30 * layerCount;
+
+    ColumnLayout {
+        anchors.fill: parent;
+        anchors.leftMargin: 10
+        anchors.rightMargin: 10
+        anchors.bottomMargin: 5
+        anchors.topMargin: 5
+
+        RadianceTileTitle {
+            Layout.fillWidth: true
+            text: "Compositor"
+        }
+
+        CheckerboardPreview {
+            videoNode: tile.videoNode
+        }
+
+        // Top layer first, to match the order of the inputs
+        Repeater {
+            model: tile.layerCount
+            RowLayout {
+                property int layer: tile.layerCount - 1 - index
+                Layout.fillWidth: true
+                Slider {
+                    Layout.fillWidth: true
+                    value: tile.videoNode ? tile.videoNode.opacity(layer) : 1
+                    onMoved: tile.videoNode.setOpacity(layer, value)
+                }
+                ComboBox {
+                    model: tile.blendModeNames
+                    currentIndex: tile.videoNode ? Math.max(0, tile.blendModeNames.indexOf(tile.videoNode.blendMode(layer))) : 0
+                    onActivated: tile.videoNode.setBlendMode(layer, tile.blendModeNames[index])
+                }
+            }
+        }
+
+        RowLayout {
+            Layout.fillWidth: true
+            Button {
+                text: "-"
+                enabled: tile.layerCount > 1
+                onClicked: tile.videoNode.inputCount = tile.layerCount - 1
+            }
+            Button {
+                text: "+"
+                onClicked: tile.videoNode.inputCount = tile.layerCount + 1
+            }
+        }
+    }
+}
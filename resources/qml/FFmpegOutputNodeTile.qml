@@ -7,7 +7,7 @@ import "."
 VideoNodeTile {
     id: tile;
 
-    normalHeight: 200;
+    normalHeight: 220;
     normalWidth: 160;
 
     onVideoNodeChanged: {
@@ -55,9 +55,26 @@ VideoNodeTile {
             wrapMode: Text.Wrap
         }
             
-        CheckBox {
-            id: recordingCheck
-            text: "Rec"
+        Label {
+            Layout.fillWidth: true
+            font.pixelSize: 12
+            text: "Queued " + tile.videoNode.framesQueued
+                + " · Dropped " + tile.videoNode.framesDropped
+                + " · " + tile.videoNode.encoderFrameRate.toFixed(1) + " fps"
+            color: RadianceStyle.tileTextColor;
+            elide: Text.ElideRight;
+        }
+
+        RowLayout {
+            CheckBox {
+                id: recordingCheck
+                text: "Rec"
+            }
+            CheckBox {
+                text: "YUV"
+                checked: tile.videoNode.pixelFormat == "yuv420p"
+                onToggled: tile.videoNode.pixelFormat = checked ? "yuv420p" : "rgb24"
+            }
         }
     }
 }
@@ -57,6 +57,8 @@ Item {
                     "FFmpegOutputNode": "FFmpegOutputNodeTile",
                     "PlaceholderNode": "PlaceholderNodeTile",
                     "LightOutputNode": "LightOutputNodeTile",
+                    "CompositorNode": "CompositorNodeTile",
+                    "SubgraphNode": "SubgraphNodeTile",
                     "": "VideoNodeTile"
                 }
                 x: (parent.width - width) / 2
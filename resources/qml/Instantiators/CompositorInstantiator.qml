@@ -0,0 +1,15 @@
+import QtQuick 2.3
+
+QtObject {
+    Component.onCompleted: {
+        var vn = registry.deserialize(context, JSON.stringify({
+            type: "CompositorNode",
+            inputCount: 4
+        }));
+        if (vn) {
+            graph.insertVideoNode(vn);
+        } else {
+            console.log("Could not instantiate CompositorNode");
+        }
+    }
+}
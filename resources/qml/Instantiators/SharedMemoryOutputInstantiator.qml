@@ -0,0 +1,39 @@
+import QtQuick 2.3
+import QtQuick.Controls 1.2
+import QtQuick.Dialogs 1.2
+import QtQuick.Layouts 1.3
+
+Dialog {
+    visible: true
+    title: "Publish frames to shared memory"
+    standardButtons: StandardButton.Ok | StandardButton.Cancel
+
+    onAccepted: {
+        var vn = registry.deserialize(context, JSON.stringify({
+            type: "SharedMemoryOutputNode",
+            name: textbox.text,
+        }));
+        if (vn) {
+            graph.insertVideoNode(vn);
+        } else {
+            console.log("Could not instantiate SharedMemoryOutputNode");
+        }
+    }
+
+    ColumnLayout {
+        anchors.fill: parent
+
+        Label {
+            text: "Enter shared memory name:"
+        }
+        TextField {
+            id: textbox
+            Layout.fillWidth: true
+            text: "/radiance"
+
+            Component.onCompleted: {
+                textbox.forceActiveFocus();
+            }
+        }
+    }
+}
@@ -7,7 +7,7 @@ import "."
 VideoNodeTile {
     id: tile;
 
-    normalHeight: 300;
+    normalHeight: 330;
     normalWidth: 220;
 
     ColumnLayout {
@@ -38,6 +38,24 @@ VideoNodeTile {
                 videoNode: vnr.videoNode
             }
         }
+
+        RowLayout {
+            Layout.fillWidth: true
+            Label {
+                text: "Hub"
+                color: RadianceStyle.tileTextColor
+            }
+            TextField {
+                // Light outputs with the same hub name
+                // are rendered and sampled together
+                placeholderText: "(own)"
+                text: tile.videoNode ? tile.videoNode.hub : ""
+                onEditingFinished: {
+                    if (tile.videoNode) tile.videoNode.hub = text;
+                }
+                Layout.fillWidth: true;
+            }
+        }
     }
     Keys.onPressed: {
         if (event.modifiers == Qt.NoModifier) {
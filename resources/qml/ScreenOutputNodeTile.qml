@@ -7,7 +7,7 @@ import "."
 VideoNodeTile {
     id: tile;
 
-    normalHeight: 300;
+    normalHeight: 460;
     normalWidth: 220;
     property bool updatingResolutionSelector: false;
     property bool updatingScreenSelector: false;
@@ -137,6 +137,96 @@ VideoNodeTile {
             Layout.fillWidth: true;
         }
 
+        RowLayout {
+            Layout.fillWidth: true
+            CheckBox {
+                id: dynamicResolutionCheck
+                text: "Dynamic res"
+                checked: videoNode ? videoNode.dynamicResolution : false
+                onCheckedChanged: {
+                    if (videoNode) videoNode.dynamicResolution = checked;
+                }
+                colorDark: RadianceStyle.tileBackgroundColor
+                colorText: RadianceStyle.tileTextColor
+            }
+            Label {
+                text: videoNode ? Math.round(videoNode.renderScale * 100) + "%" : ""
+                visible: dynamicResolutionCheck.checked
+                color: RadianceStyle.tileTextColor
+            }
+        }
+
+        ComboBox {
+            id: renderFormatSelector
+            model: ["rgba8", "rgb10a2", "rgba16f"]
+            currentIndex: videoNode ? Math.max(0, model.indexOf(videoNode.renderFormat)) : 0
+            onActivated: {
+                if (videoNode) videoNode.renderFormat = model[index];
+            }
+            Layout.fillWidth: true;
+        }
+
+        RowLayout {
+            Layout.fillWidth: true
+            Label {
+                text: "Threads"
+                color: RadianceStyle.tileTextColor
+            }
+            SpinBox {
+                id: renderThreadsSelector
+                from: 1
+                to: 8
+                value: videoNode ? videoNode.renderThreads : 1
+                onValueModified: {
+                    if (videoNode) videoNode.renderThreads = value;
+                }
+                Layout.fillWidth: true;
+            }
+            Label {
+                text: videoNode ? videoNode.renderSubmissionOverlap.toFixed(1) + "x" : ""
+                visible: renderThreadsSelector.value > 1
+                color: RadianceStyle.tileTextColor
+            }
+        }
+
+        RowLayout {
+            Layout.fillWidth: true
+            Label {
+                text: "Max tile"
+                color: RadianceStyle.tileTextColor
+            }
+            SpinBox {
+                // 0 renders the whole canvas at once
+                from: 0
+                to: 16384
+                stepSize: 1024
+                editable: true
+                value: videoNode ? videoNode.maxTileSize : 0
+                onValueModified: {
+                    if (videoNode) videoNode.maxTileSize = value;
+                }
+                Layout.fillWidth: true;
+            }
+        }
+
+        RowLayout {
+            Layout.fillWidth: true
+            Label {
+                text: "Canvas"
+                color: RadianceStyle.tileTextColor
+            }
+            TextField {
+                // Outputs with the same canvas name
+                // render the model once and each show a region of it
+                placeholderText: "(own)"
+                text: videoNode ? videoNode.canvas : ""
+                onEditingFinished: {
+                    if (videoNode) videoNode.canvas = text;
+                }
+                Layout.fillWidth: true;
+            }
+        }
+
         RowLayout {
             Layout.fillWidth: true
             CheckBox {
@@ -1,28 +1,50 @@
 #include "Chain.h"
-#include <memory>
 #include <array>
-#include <algorithm>
-#include "xoroshiro128plus.hpp"
+#include <tuple>
 #include <QDebug>
 #include <QThread>
+#include <QWeakPointer>
+#include <QOpenGLContext>
+#include <QOpenGLExtraFunctions>
 #include "OpenGLWorkerContext.h"
 
-using namespace Xoroshiro;
+// Noise textures currently in use, by size, format and seed.
+// All rendering contexts share with each other
+// so any of them can use a texture made by another.
+typedef std::tuple<int, int, int, quint32> NoiseKey;
+static QMutex s_noiseLock;
+static QMap<NoiseKey, QWeakPointer<QOpenGLTexture>> s_noiseTextures;
+
+constexpr int Chain::STATISTICS_BINS;
 
 Chain::Chain(QSize size)
-    : m_noiseTexture(QOpenGLTexture::Target2D)
-    , m_blankTexture(QOpenGLTexture::Target2D)
-    , m_vao(new QOpenGLVertexArrayObject())
+    : m_blankTexture(QOpenGLTexture::Target2D)
     , m_size(size)
+    , m_tileRect(QPoint(0, 0), size)
+    , m_canvasSize(size)
+    , m_texturePool(new TexturePool())
 {
 }
 
 Chain::Chain(const Chain *other, QSize size)
     : Chain(size)
 {
+    m_noiseSeed = other->m_noiseSeed;
+    m_noiseFormat = other->m_noiseFormat;
+    m_renderFormat = other->m_renderFormat;
     moveToThread(other->thread());
 }
 
+Chain::~Chain() {
+    // Framebuffers are not shared between contexts,
+    // so they can only be cleaned up from the rendering context.
+    // Without a context, whoever owns the chain
+    // should have called releaseContextResources() already.
+    if (QOpenGLContext::currentContext() != nullptr) {
+        releaseContextResources();
+    }
+}
+
 Chain::operator QString() const {
     return QString("Chain(%1x%2, %3)").arg(m_size.width()).arg(m_size.height()).arg(thread()->objectName());
 }
@@ -35,28 +57,159 @@ QSize Chain::size() const {
     return m_size;
 }
 
+void Chain::setTile(QRect rect, QSize canvasSize) {
+    Q_ASSERT(rect.size() == m_size);
+    m_tileRect = rect;
+    m_canvasSize = canvasSize;
+}
+
+bool Chain::tiled() const {
+    return m_canvasSize != m_size;
+}
+
+QRect Chain::tileRect() const {
+    return m_tileRect;
+}
+
+QSize Chain::canvasSize() const {
+    return m_canvasSize;
+}
+
+QVector4D Chain::normalizedTileRect() const {
+    if (m_canvasSize.isEmpty()) return QVector4D(0, 0, 1, 1);
+    return QVector4D((float)m_tileRect.x() / m_canvasSize.width(),
+                     (float)m_tileRect.y() / m_canvasSize.height(),
+                     (float)m_tileRect.width() / m_canvasSize.width(),
+                     (float)m_tileRect.height() / m_canvasSize.height());
+}
+
+void Chain::setNoiseSeed(quint32 seed) {
+    Q_ASSERT(m_noiseTexture.isNull());
+    m_noiseSeed = seed;
+}
+
+quint32 Chain::noiseSeed() const {
+    return m_noiseSeed;
+}
+
+void Chain::setNoiseFormat(QOpenGLTexture::TextureFormat format) {
+    Q_ASSERT(m_noiseTexture.isNull());
+    Q_ASSERT(format == QOpenGLTexture::RGBA32F || format == QOpenGLTexture::RGBA16F);
+    m_noiseFormat = format;
+}
+
+QOpenGLTexture::TextureFormat Chain::noiseFormat() const {
+    return m_noiseFormat;
+}
+
+void Chain::setRenderFormat(GLenum format) {
+    Q_ASSERT(format == GL_RGBA8 || format == GL_RGB10_A2 || format == GL_RGBA16F);
+    m_renderFormat = format;
+}
+
+GLenum Chain::renderFormat() const {
+    return m_renderFormat;
+}
+
 GLuint Chain::noiseTexture() {
-    if (!m_noiseTexture.isCreated()) {
-        m_noiseTexture.setSize(m_size.width(), m_size.height());
-        m_noiseTexture.setFormat(QOpenGLTexture::RGBA32F);
-        m_noiseTexture.allocateStorage(QOpenGLTexture::RGBA, QOpenGLTexture::Float32);
-        m_noiseTexture.setMinMagFilters(QOpenGLTexture::Linear, QOpenGLTexture::Linear);
-        m_noiseTexture.setWrapMode(QOpenGLTexture::Repeat);
+    if (m_noiseTexture.isNull()) {
+        auto key = NoiseKey(m_size.width(), m_size.height(), m_noiseFormat, m_noiseSeed);
+
+        // Hold the lock while generating
+        // so that no other chain picks up the texture
+        // before it is finished
+        QMutexLocker locker(&s_noiseLock);
+        m_noiseTexture = s_noiseTextures.value(key).toStrongRef();
+        if (m_noiseTexture.isNull()) {
+            // The core profile can't draw without a VAO bound
+            vao()->bind();
+            m_noiseTexture = generateNoise(m_size, m_noiseFormat, m_noiseSeed);
+            s_noiseTextures.insert(key, m_noiseTexture);
+        }
+
+        // Forget any textures that no chain is using
+        for (auto it = s_noiseTextures.begin(); it != s_noiseTextures.end();) {
+            if (it.value().isNull()) {
+                it = s_noiseTextures.erase(it);
+            } else {
+                it++;
+            }
+        }
+    }
+
+    return m_noiseTexture->textureId();
+}
 
-        auto compCount = m_size.width() * m_size.height() * 4;
-        auto data = std::make_unique<float[]>(compCount);
+QSharedPointer<QOpenGLTexture> Chain::generateNoise(QSize size, QOpenGLTexture::TextureFormat format, quint32 seed) {
+    auto gl = QOpenGLContext::currentContext()->extraFunctions();
 
-        auto xsr = xoroshiro128plus_engine(reinterpret_cast<uint64_t>(this));
+    auto texture = QSharedPointer<QOpenGLTexture>::create(QOpenGLTexture::Target2D);
+    texture->setSize(size.width(), size.height());
+    texture->setFormat(format);
+    texture->allocateStorage(QOpenGLTexture::RGBA, QOpenGLTexture::Float32);
+    texture->setMinMagFilters(QOpenGLTexture::Linear, QOpenGLTexture::Linear);
+    texture->setWrapMode(QOpenGLTexture::Repeat);
 
-        auto xsrd = [&xsr, div = (1./(UINT64_C(1)<<53))](){
-            return (xsr() >> 11) * div;
-        };
-        std::generate(&data[0],&data[compCount],xsrd);
-        m_noiseTexture.setData(QOpenGLTexture::RGBA, QOpenGLTexture::Float32, (const void*)&data[0]);
-        glFlush();
+    // Each pixel is hashed from its coordinate and the seed
+    // so the result doesn't depend on the GPU or on draw order.
+    // 24 bits of each hash are kept, which is all a float can hold.
+    QOpenGLShaderProgram program;
+    auto ok = program.addShaderFromSourceCode(QOpenGLShader::Vertex,
+        "#version 150\n"
+        "const vec2 varray[4] = vec2[](vec2(1., 1.),vec2(1., -1.),vec2(-1., 1.),vec2(-1., -1.));\n"
+        "void main() {\n"
+        "    gl_Position = vec4(varray[gl_VertexID], 0., 1.);\n"
+        "}\n");
+    ok = ok && program.addShaderFromSourceCode(QOpenGLShader::Fragment,
+        "#version 150\n"
+        "uniform uint iSeed;\n"
+        "out vec4 fragColor;\n"
+        "uint hash(uint x) {\n"
+        "    x ^= x >> 16u;\n"
+        "    x *= 0x7feb352du;\n"
+        "    x ^= x >> 15u;\n"
+        "    x *= 0x846ca68bu;\n"
+        "    x ^= x >> 16u;\n"
+        "    return x;\n"
+        "}\n"
+        "void main() {\n"
+        "    uvec2 p = uvec2(gl_FragCoord.xy);\n"
+        "    uint h = hash(p.x ^ hash(p.y ^ hash(iSeed)));\n"
+        "    uvec4 c = uvec4(hash(h), hash(h + 1u), hash(h + 2u), hash(h + 3u));\n"
+        "    fragColor = vec4(c >> 8u) * (1. / 16777216.);\n"
+        "}\n");
+    ok = ok && program.link();
+    if (!ok) {
+        qWarning() << "Could not compile noise shader:" << program.log();
+        return texture;
     }
 
-    return m_noiseTexture.textureId();
+    GLint previousFramebuffer = 0;
+    GLint previousViewport[4]{};
+    gl->glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previousFramebuffer);
+    gl->glGetIntegerv(GL_VIEWPORT, previousViewport);
+
+    GLuint framebuffer = 0;
+    gl->glGenFramebuffers(1, &framebuffer);
+    gl->glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer);
+    gl->glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture->textureId(), 0);
+    gl->glViewport(0, 0, size.width(), size.height());
+    gl->glDisable(GL_BLEND);
+
+    program.bind();
+    gl->glUniform1ui(program.uniformLocation("iSeed"), seed);
+    gl->glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    program.release();
+
+    gl->glBindFramebuffer(GL_DRAW_FRAMEBUFFER, previousFramebuffer);
+    gl->glViewport(previousViewport[0], previousViewport[1], previousViewport[2], previousViewport[3]);
+    gl->glDeleteFramebuffers(1, &framebuffer);
+
+    // Other chains may pick this texture up from other contexts,
+    // which only see the finished result once this one is done
+    gl->glFinish();
+
+    return texture;
 }
 
 GLuint Chain::blankTexture() {
@@ -74,9 +227,372 @@ GLuint Chain::blankTexture() {
     return m_blankTexture.textureId();
 }
 
+Chain::ContextResources &Chain::contextResources() {
+    QMutexLocker locker(&m_contextResourcesLock);
+    // QMap nodes don't move, so the reference stays valid
+    return m_contextResources[QOpenGLContext::currentContext()];
+}
+
+void Chain::deleteFramebuffers(ContextResources &resources) {
+    auto gl = QOpenGLContext::currentContext()->functions();
+    if (resources.copyFramebuffers[0] != 0) {
+        gl->glDeleteFramebuffers(2, resources.copyFramebuffers);
+        resources.copyFramebuffers[0] = resources.copyFramebuffers[1] = 0;
+    }
+    if (resources.statisticsFramebuffer != 0) {
+        gl->glDeleteFramebuffers(1, &resources.statisticsFramebuffer);
+        resources.statisticsFramebuffer = 0;
+    }
+}
+
 QOpenGLVertexArrayObject *Chain::vao() {
-    if (!m_vao.isCreated()) {
-        m_vao.create();
+    auto &resources = contextResources();
+    if (resources.vao.isNull()) {
+        resources.vao = QSharedPointer<QOpenGLVertexArrayObject>::create();
+        resources.vao->create();
+    }
+    return resources.vao.data();
+}
+
+void Chain::releaseContextResources() {
+    auto context = QOpenGLContext::currentContext();
+    {
+        ContextResources resources;
+        {
+            QMutexLocker locker(&m_contextResourcesLock);
+            resources = m_contextResources.take(context);
+        }
+        deleteFramebuffers(resources);
+        // The VAO and statistics program are freed
+        // and cached textures go back to the pool
+        // as resources goes out of scope, while the context is current
+    }
+
+    // Textures are shared between contexts,
+    // so any context that rendered the chain can free these
+    m_texturePool->clear();
+    QMutexLocker locker(&m_contextResourcesLock);
+    if (m_blankTexture.isCreated()) {
+        m_blankTexture.destroy();
     }
-    return &m_vao;
+}
+
+qint64 Chain::frame() const {
+    return m_frame;
+}
+
+void Chain::beginFrame() {
+    m_frame++;
+
+    // Pyramids, statistics and tiles that weren't used last frame
+    // go back to the pool
+    QMutexLocker locker(&m_contextResourcesLock);
+    for (auto &resources : m_contextResources) {
+        for (auto cache : {&resources.pyramids, &resources.statistics, &resources.tiles}) {
+            for (auto it = cache->begin(); it != cache->end();) {
+                if (it->frame < m_frame - 1) {
+                    it = cache->erase(it);
+                } else {
+                    it++;
+                }
+            }
+        }
+    }
+
+    m_texturePool->collect();
+}
+
+QSharedPointer<TexturePool> Chain::texturePool() {
+    return m_texturePool;
+}
+
+void Chain::copyTexture(GLuint source, QOpenGLTexture *destination, int layer) {
+    copyTextureRegion(source, QRectF(0, 0, 1, 1), destination, layer);
+}
+
+void Chain::copyTextureRegion(GLuint source, QRectF region, QOpenGLTexture *destination, int layer) {
+    auto gl = QOpenGLContext::currentContext()->extraFunctions();
+    auto &resources = contextResources();
+    if (resources.copyFramebuffers[0] == 0) {
+        gl->glGenFramebuffers(2, resources.copyFramebuffers);
+    }
+
+    GLint previousDraw = 0;
+    GLint previousRead = 0;
+    gl->glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previousDraw);
+    gl->glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &previousRead);
+
+    // Inputs are not necessarily the size of the chain
+    // (e.g. images) so ask the texture
+    GLint width = 0;
+    GLint height = 0;
+    glBindTexture(GL_TEXTURE_2D, source);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    gl->glBindFramebuffer(GL_READ_FRAMEBUFFER, resources.copyFramebuffers[0]);
+    gl->glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, source, 0);
+    gl->glBindFramebuffer(GL_DRAW_FRAMEBUFFER, resources.copyFramebuffers[1]);
+    if (destination->target() == QOpenGLTexture::Target2DArray) {
+        gl->glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, destination->textureId(), 0, layer);
+    } else {
+        gl->glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, destination->textureId(), 0);
+    }
+
+    gl->glBlitFramebuffer(qRound(region.left() * width), qRound(region.top() * height),
+                          qRound(region.right() * width), qRound(region.bottom() * height),
+                          0, 0, destination->width(), destination->height(),
+                          GL_COLOR_BUFFER_BIT, GL_LINEAR);
+
+    // Don't hold on to the attachments
+    gl->glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
+    gl->glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
+
+    gl->glBindFramebuffer(GL_DRAW_FRAMEBUFFER, previousDraw);
+    gl->glBindFramebuffer(GL_READ_FRAMEBUFFER, previousRead);
+}
+
+GLuint Chain::pyramid(GLuint source) {
+    auto &pyramids = contextResources().pyramids;
+    auto it = pyramids.find(source);
+    if (it != pyramids.end() && it->frame == m_frame) {
+        return it->texture->textureId();
+    }
+    if (it == pyramids.end()) {
+        int levels = 1;
+        for (int d = qMax(m_size.width(), m_size.height()); d > 1; d >>= 1) levels++;
+        auto texture = m_texturePool->acquire(QOpenGLTexture::Target2D, m_size, 1,
+                                              QOpenGLTexture::TextureFormat(m_renderFormat), levels);
+        it = pyramids.insert(source, {texture, 0});
+    }
+
+    auto texture = it->texture;
+    copyTexture(source, texture.data());
+    glBindTexture(GL_TEXTURE_2D, texture->textureId());
+    QOpenGLContext::currentContext()->functions()->glGenerateMipmap(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    it->frame = m_frame;
+
+    return texture->textureId();
+}
+
+GLuint Chain::statistics(GLuint source) {
+    auto &resources = contextResources();
+    auto it = resources.statistics.find(source);
+    if (it != resources.statistics.end() && it->frame == m_frame) {
+        return it->texture->textureId();
+    }
+
+    auto gl = QOpenGLContext::currentContext()->extraFunctions();
+    if (resources.statisticsProgram.isNull()) {
+        // The maximum and histogram are gathered from every pixel
+        // by drawing a point per pixel into a scratch texture:
+        // row 0 blends them together with GL_MAX at x=0,
+        // and row 1 counts them into bins with GL_FUNC_ADD,
+        // one point per channel.
+        auto scatter = QSharedPointer<QOpenGLShaderProgram>::create();
+        auto ok = scatter->addShaderFromSourceCode(QOpenGLShader::Vertex, QString(
+            "#version 150\n"
+            "uniform sampler2D iSource;\n"
+            "uniform bool iHistogram;\n"
+            "out vec4 value;\n"
+            "const int BINS = %1;\n"
+            "void main() {\n"
+            "    ivec2 size = textureSize(iSource, 0);\n"
+            "    int pixel = iHistogram ? gl_VertexID / 4 : gl_VertexID;\n"
+            "    vec3 c = texelFetch(iSource, ivec2(pixel % size.x, pixel / size.x), 0).rgb;\n"
+            "    vec4 v = vec4(c, dot(c, vec3(0.2126, 0.7152, 0.0722)));\n"
+            "    vec2 texel = vec2(0.);\n"
+            "    if (iHistogram) {\n"
+            "        int channel = gl_VertexID % 4;\n"
+            "        value = vec4(0.);\n"
+            "        value[channel] = 1.;\n"
+            "        texel = vec2(clamp(floor(v[channel] * float(BINS)), 0., float(BINS - 1)), 1.);\n"
+            "    } else {\n"
+            "        value = v;\n"
+            "    }\n"
+            "    gl_Position = vec4((texel + 0.5) / vec2(BINS, 2) * 2. - 1., 0., 1.);\n"
+            "}\n").arg(STATISTICS_BINS));
+        ok = ok && scatter->addShaderFromSourceCode(QOpenGLShader::Fragment,
+            "#version 150\n"
+            "in vec4 value;\n"
+            "out vec4 fragColor;\n"
+            "void main() {\n"
+            "    fragColor = value;\n"
+            "}\n");
+        ok = ok && scatter->link();
+        if (!ok) {
+            qWarning() << "Could not compile statistics shader:" << scatter->log();
+            return 0;
+        }
+
+        // The mean is read straight off the 1x1 top of the pyramid.
+        // The dominant hue loops over a level of at most 32x32,
+        // which is plenty to tell which hue there is most of.
+        auto program = QSharedPointer<QOpenGLShaderProgram>::create();
+        ok = program->addShaderFromSourceCode(QOpenGLShader::Vertex,
+            "#version 150\n"
+            "const vec2 varray[4] = vec2[](vec2(1., 1.),vec2(1., -1.),vec2(-1., 1.),vec2(-1., -1.));\n"
+            "void main() {\n"
+            "    gl_Position = vec4(varray[gl_VertexID], 0., 1.);\n"
+            "}\n");
+        ok = ok && program->addShaderFromSourceCode(QOpenGLShader::Fragment, QString(
+            "#version 150\n"
+            "uniform sampler2D iSource;\n"
+            "uniform sampler2D iScratch;\n"
+            "uniform int iTopLevel;\n"
+            "uniform int iSampleLevel;\n"
+            "out vec4 fragColor;\n"
+            "const int BINS = %1;\n"
+            "const int HUE_BINS = 12;\n"
+            "float luma(vec3 c) {\n"
+            "    return dot(c, vec3(0.2126, 0.7152, 0.0722));\n"
+            "}\n"
+            "vec3 rgb2hsv(vec3 c) {\n"
+            "    vec4 K = vec4(0.0, -1.0 / 3.0, 2.0 / 3.0, -1.0);\n"
+            "    vec4 p = mix(vec4(c.bg, K.wz), vec4(c.gb, K.xy), step(c.b, c.g));\n"
+            "    vec4 q = mix(vec4(p.xyw, c.r), vec4(c.r, p.yzx), step(p.x, c.r));\n"
+            "    float d = q.x - min(q.w, q.y);\n"
+            "    float e = 1.0e-10;\n"
+            "    return vec3(abs(q.z + (q.w - q.y) / (6.0 * d + e)), d / (q.x + e), q.x);\n"
+            "}\n"
+            "vec3 hue2rgb(float h) {\n"
+            "    return clamp(abs(fract(h + vec3(1., 2. / 3., 1. / 3.)) * 6. - 3.) - 1., 0., 1.);\n"
+            "}\n"
+            "void main() {\n"
+            "    ivec2 pos = ivec2(gl_FragCoord.xy);\n"
+            "    if (pos == ivec2(0, 0)) {\n"
+            "        vec3 mean = texelFetch(iSource, ivec2(0, 0), iTopLevel).rgb;\n"
+            "        fragColor = vec4(mean, luma(mean));\n"
+            "        return;\n"
+            "    }\n"
+            "    if (pos == ivec2(1, 0)) {\n"
+            "        fragColor = texelFetch(iScratch, ivec2(0, 0), 0);\n"
+            "        return;\n"
+            "    }\n"
+            "    if (pos.y == 1) {\n"
+            "        ivec2 size = textureSize(iSource, 0);\n"
+            "        fragColor = texelFetch(iScratch, pos, 0) / float(size.x * size.y);\n"
+            "        return;\n"
+            "    }\n"
+            "    if (pos.x > 2) {\n"
+            "        fragColor = vec4(0.);\n"
+            "        return;\n"
+            "    }\n"
+            "    ivec2 size = textureSize(iSource, iSampleLevel);\n"
+            "    float hues[HUE_BINS];\n"
+            "    for (int i = 0; i < HUE_BINS; i++) hues[i] = 0.;\n"
+            "    for (int y = 0; y < size.y; y++) {\n"
+            "        for (int x = 0; x < size.x; x++) {\n"
+            "            vec3 hsv = rgb2hsv(texelFetch(iSource, ivec2(x, y), iSampleLevel).rgb);\n"
+            "            hues[int(hsv.x * float(HUE_BINS)) % HUE_BINS] += hsv.y * hsv.z;\n"
+            "        }\n"
+            "    }\n"
+            "    int best = 0;\n"
+            "    for (int i = 1; i < HUE_BINS; i++) {\n"
+            "        if (hues[i] > hues[best]) best = i;\n"
+            "    }\n"
+            "    float hue = (float(best) + 0.5) / float(HUE_BINS);\n"
+            "    fragColor = vec4(hue2rgb(hue), hue);\n"
+            "}\n").arg(STATISTICS_BINS));
+        ok = ok && program->link();
+        if (!ok) {
+            qWarning() << "Could not compile statistics shader:" << program->log();
+            return 0;
+        }
+        resources.statisticsScatterProgram = scatter;
+        resources.statisticsProgram = program;
+    }
+    if (resources.statisticsFramebuffer == 0) {
+        gl->glGenFramebuffers(1, &resources.statisticsFramebuffer);
+    }
+
+    auto sourcePyramid = pyramid(source);
+    int topLevel = 0;
+    for (int d = qMax(m_size.width(), m_size.height()); d > 1; d >>= 1) topLevel++;
+    int sampleLevel = 0;
+    for (int d = qMax(m_size.width(), m_size.height()); d > 32; d >>= 1) sampleLevel++;
+    auto pixelCount = m_size.width() * m_size.height();
+
+    if (it == resources.statistics.end()) {
+        auto texture = m_texturePool->acquire(QOpenGLTexture::Target2D, QSize(STATISTICS_BINS, 2), 1, QOpenGLTexture::RGBA32F);
+        texture->setMinMagFilters(QOpenGLTexture::Nearest, QOpenGLTexture::Nearest);
+        it = resources.statistics.insert(source, {texture, 0});
+    }
+    auto texture = it->texture;
+    // Counts stay exact in 32-bit floats up to 2^24 pixels
+    auto scratch = m_texturePool->acquire(QOpenGLTexture::Target2D, QSize(STATISTICS_BINS, 2), 1, QOpenGLTexture::RGBA32F);
+    scratch->setMinMagFilters(QOpenGLTexture::Nearest, QOpenGLTexture::Nearest);
+
+    GLint previousFramebuffer = 0;
+    GLint previousViewport[4]{};
+    gl->glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previousFramebuffer);
+    gl->glGetIntegerv(GL_VIEWPORT, previousViewport);
+
+    gl->glBindFramebuffer(GL_DRAW_FRAMEBUFFER, resources.statisticsFramebuffer);
+    gl->glViewport(0, 0, STATISTICS_BINS, 2);
+    vao()->bind();
+    gl->glActiveTexture(GL_TEXTURE0);
+    gl->glBindTexture(GL_TEXTURE_2D, sourcePyramid);
+
+    // Scatter every pixel of level 0 into the scratch texture
+    gl->glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, scratch->textureId(), 0);
+    gl->glClearColor(0, 0, 0, 0);
+    gl->glClear(GL_COLOR_BUFFER_BIT);
+    gl->glEnable(GL_BLEND);
+    gl->glBlendFunc(GL_ONE, GL_ONE);
+    resources.statisticsScatterProgram->bind();
+    resources.statisticsScatterProgram->setUniformValue("iSource", 0);
+    resources.statisticsScatterProgram->setUniformValue("iHistogram", false);
+    gl->glBlendEquation(GL_MAX);
+    gl->glDrawArrays(GL_POINTS, 0, pixelCount);
+    resources.statisticsScatterProgram->setUniformValue("iHistogram", true);
+    gl->glBlendEquation(GL_FUNC_ADD);
+    gl->glDrawArrays(GL_POINTS, 0, 4 * pixelCount);
+    resources.statisticsScatterProgram->release();
+    gl->glDisable(GL_BLEND);
+
+    // Then put it all together
+    gl->glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture->textureId(), 0);
+    resources.statisticsProgram->bind();
+    gl->glActiveTexture(GL_TEXTURE1);
+    gl->glBindTexture(GL_TEXTURE_2D, scratch->textureId());
+    resources.statisticsProgram->setUniformValue("iSource", 0);
+    resources.statisticsProgram->setUniformValue("iScratch", 1);
+    resources.statisticsProgram->setUniformValue("iTopLevel", topLevel);
+    resources.statisticsProgram->setUniformValue("iSampleLevel", sampleLevel);
+    gl->glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    gl->glBindTexture(GL_TEXTURE_2D, 0);
+    gl->glActiveTexture(GL_TEXTURE0);
+    gl->glBindTexture(GL_TEXTURE_2D, 0);
+    resources.statisticsProgram->release();
+
+    gl->glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
+    gl->glBindFramebuffer(GL_DRAW_FRAMEBUFFER, previousFramebuffer);
+    gl->glViewport(previousViewport[0], previousViewport[1], previousViewport[2], previousViewport[3]);
+    it->frame = m_frame;
+
+    return texture->textureId();
+}
+
+GLuint Chain::tileOf(GLuint source) {
+    if (!tiled()) return source;
+
+    auto &tiles = contextResources().tiles;
+    auto it = tiles.find(source);
+    if (it != tiles.end() && it->frame == m_frame) {
+        return it->texture->textureId();
+    }
+    if (it == tiles.end()) {
+        auto texture = m_texturePool->acquire(QOpenGLTexture::Target2D, m_size, 1,
+                                              QOpenGLTexture::TextureFormat(m_renderFormat));
+        it = tiles.insert(source, {texture, 0});
+    }
+
+    auto rect = normalizedTileRect();
+    copyTextureRegion(source, QRectF(rect.x(), rect.y(), rect.z(), rect.w()), it->texture.data());
+    it->frame = m_frame;
+
+    return it->texture->textureId();
 }
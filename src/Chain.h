@@ -2,11 +2,17 @@
 
 #include "OpenGLWorker.h"
 #include "QmlSharedPointer.h"
+#include "TexturePool.h"
+#include <QOpenGLContext>
 #include <QOpenGLTexture>
 #include <QOpenGLVertexArrayObject>
+#include <QOpenGLShaderProgram>
 #include <QSharedPointer>
 #include <QVector>
+#include <QMap>
 #include <QMutex>
+#include <QRect>
+#include <QVector4D>
 
 /*
     Chains are instances of the
@@ -21,10 +27,33 @@
     at which the render is to be done.
     A Chain also stores state that does not belong to any particular VideoNode
     for the render, i.e. a blank texture and noise texture
-    which is available to all.
+    which is available to all,
+    and a pool of textures that nodes can borrow.
+    It also builds mip pyramids and statistics of node outputs on request,
+    at most once per frame per texture,
+    so that several effects looking at the same input share the work.
+
+    A chain may be rendered on several contexts that share with each other
+    (see RenderScheduler.)
+    Objects that can't be shared between contexts,
+    like the VAO, are kept per context,
+    and so are the pyramid and statistics caches
+    so that contexts never wait on each other for them.
+
+    A chain may also be one tile of a larger canvas
+    (see setTile.) Nodes then render only that part of the canvas,
+    which lets outputs draw canvases
+    bigger than the largest texture the GPU can hold.
 
     Chains are immutable once created,
     that is, you cannot change the size.
+    (The noise and render format settings may be changed,
+    but only before the chain is first rendered.)
+
+    The noise texture is generated on the GPU
+    from a seed, so it is the same from run to run,
+    and it is shared between all chains
+    with the same size and noise settings.
 
     Chains are created by Outputs or Output-like things
     (such as the preview adapter.)
@@ -46,6 +75,42 @@ public:
     // (currently all this does
     // is move it to the other's thread)
     Chain(const Chain *other, QSize size);
+   ~Chain() override;
+
+    // Noise is a pure function of the seed and pixel coordinate.
+    // The default seed is 0.
+    void setNoiseSeed(quint32 seed);
+    quint32 noiseSeed() const;
+
+    // Storage format of the noise texture,
+    // either RGBA32F (the default) or RGBA16F
+    // which uses half the memory and bandwidth
+    void setNoiseFormat(QOpenGLTexture::TextureFormat format);
+    QOpenGLTexture::TextureFormat noiseFormat() const;
+
+    // Internal format of the framebuffers that nodes render into:
+    // GL_RGBA8 (the default), GL_RGB10_A2 or GL_RGBA16F.
+    // Higher precision avoids banding in feedback effects
+    // at the cost of memory bandwidth.
+    void setRenderFormat(GLenum format);
+    GLenum renderFormat() const;
+
+    // Makes this chain render the given rectangle of a larger canvas,
+    // in canvas pixels from the bottom left.
+    // The rectangle must be the size of the chain.
+    // Like the other settings, this may only be changed
+    // before the chain is first rendered.
+    void setTile(QRect rect, QSize canvasSize);
+    bool tiled() const;
+    // The whole chain if it is not tiled
+    QRect tileRect() const;
+    // The size of the whole canvas, which is
+    // what effects see as iResolution.
+    // The same as size() if the chain is not tiled.
+    QSize canvasSize() const;
+    // tileRect() as a fraction of the canvas:
+    // (x, y, width, height)
+    QVector4D normalizedTileRect() const;
 
     operator QString() const;
 
@@ -54,11 +119,111 @@ public slots:
     QSize size() const;
     GLuint noiseTexture();
     GLuint blankTexture();
+    // Returns the VAO for the current context
     QOpenGLVertexArrayObject *vao();
 
+    // Frees the objects that belong to the current context,
+    // along with the chain's pooled textures.
+    // Call this from every context other than the chain's own
+    // that rendered it, before the chain is deleted.
+    // The chain's own context does it when the chain is deleted;
+    // if that happens with no context current,
+    // call it from the chain's context beforehand.
+    void releaseContextResources();
+
+    // Called at the start of every render of this chain.
+    // No other context may be rendering the chain at the time.
+    void beginFrame();
+
+    // Counts calls to beginFrame,
+    // so that work can be shared within a frame
+    qint64 frame() const;
+
+    // Textures borrowed from here
+    // go back to the pool when they are released
+    QSharedPointer<TexturePool> texturePool();
+
+    // Copies (and scales) a 2D texture into the given texture,
+    // or into one layer of it if it is a texture array.
+    // Framebuffer bindings are preserved.
+    void copyTexture(GLuint source, QOpenGLTexture *destination, int layer=0);
+
+    // Returns a chain-sized copy of the given texture
+    // with a full set of mipmaps,
+    // suitable for cheap blurs with textureLod.
+    // The pyramid is only built the first time
+    // a texture is asked for in a frame,
+    // and is only valid until the end of that frame.
+    GLuint pyramid(GLuint source);
+
+    // Returns a STATISTICS_BINS x 2 RGBA32F texture
+    // describing the given texture.
+    // Row 0 holds the mean (rgb, luminance) at x=0,
+    // the maximum (rgb, luminance) at x=1
+    // and the dominant hue (rgb at full saturation, hue) at x=2.
+    // Row 1 is a histogram (r, g, b, luminance)
+    // with each bin holding the fraction of pixels in it.
+    // The maximum and histogram are over every pixel;
+    // the dominant hue is judged from a copy of at most 32x32.
+    // Like pyramids, statistics are computed at most once per frame
+    // and are only valid until the end of that frame.
+    GLuint statistics(GLuint source);
+
+    // Returns the part of a texture covering the whole canvas
+    // (e.g. an image) that lies under this chain's tile,
+    // as a chain-sized texture.
+    // Returns the source itself if the chain is not tiled.
+    // Like pyramids, tiles are made at most once per frame
+    // and are only valid until the end of that frame.
+    GLuint tileOf(GLuint source);
+
+    static constexpr int STATISTICS_BINS = 16;
+
 protected:
-    QOpenGLTexture m_noiseTexture;
+    // Copies (and scales) the given region of a 2D texture,
+    // as a fraction of its size, into the given texture
+    void copyTextureRegion(GLuint source, QRectF region, QOpenGLTexture *destination, int layer=0);
+
+    // Renders the noise for the given settings into a new texture
+    static QSharedPointer<QOpenGLTexture> generateNoise(QSize size, QOpenGLTexture::TextureFormat format, quint32 seed);
+
+    QSharedPointer<QOpenGLTexture> m_noiseTexture;
+    quint32 m_noiseSeed{};
+    QOpenGLTexture::TextureFormat m_noiseFormat{QOpenGLTexture::RGBA32F};
+    GLenum m_renderFormat{GL_RGBA8};
     QOpenGLTexture m_blankTexture;
-    QOpenGLVertexArrayObject m_vao{};
     QSize m_size{};
+    QRect m_tileRect{};
+    QSize m_canvasSize{};
+    QSharedPointer<TexturePool> m_texturePool;
+    qint64 m_frame{};
+
+    // A texture derived from a source texture
+    // in the given frame
+    struct CachedTexture {
+        QSharedPointer<QOpenGLTexture> texture;
+        qint64 frame;
+    };
+
+    // Everything that is kept separately for each context
+    struct ContextResources {
+        QSharedPointer<QOpenGLVertexArrayObject> vao;
+        GLuint copyFramebuffers[2]{};
+        QMap<GLuint, CachedTexture> pyramids;
+        QMap<GLuint, CachedTexture> statistics;
+        QMap<GLuint, CachedTexture> tiles;
+        QSharedPointer<QOpenGLShaderProgram> statisticsProgram;
+        QSharedPointer<QOpenGLShaderProgram> statisticsScatterProgram;
+        GLuint statisticsFramebuffer{};
+    };
+
+    // Returns the resources of the current context,
+    // creating them if necessary
+    ContextResources &contextResources();
+    void deleteFramebuffers(ContextResources &resources);
+
+    // Only held while looking up or changing m_contextResources,
+    // since each context only touches its own entry
+    QMutex m_contextResourcesLock;
+    QMap<QOpenGLContext *, ContextResources> m_contextResources;
 };
@@ -0,0 +1,296 @@
+#include "CompositorNode.h"
+#include <QDebug>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QOpenGLFramebufferObjectFormat>
+#include <numeric>
+#include <utility>
+
+CompositorNode::CompositorNode(Context *context)
+    : VideoNode(context)
+{
+    setInputCount(2);
+}
+
+QJsonObject CompositorNode::serialize() {
+    QJsonObject o = VideoNode::serialize();
+    o.insert("inputCount", inputCount());
+    o.insert("opacities", QJsonArray::fromVariantList(opacities()));
+    o.insert("blendModes", QJsonArray::fromVariantList(blendModes()));
+    return o;
+}
+
+QStringList CompositorNode::blendModeNames() {
+    // The order matches the mode numbers in the shader
+    return QStringList{"normal", "add", "multiply", "screen", "lighten", "darken", "difference"};
+}
+
+QVariantList CompositorNode::opacities() {
+    QMutexLocker locker(&m_stateLock);
+    return m_opacities;
+}
+
+void CompositorNode::setOpacities(QVariantList opacities) {
+    {
+        QMutexLocker locker(&m_stateLock);
+        if (opacities == m_opacities) return;
+        m_opacities = opacities;
+    }
+    emit opacitiesChanged(opacities);
+}
+
+qreal CompositorNode::opacity(int input) {
+    QMutexLocker locker(&m_stateLock);
+    return input < m_opacities.count() ? m_opacities.at(input).toReal() : 1;
+}
+
+void CompositorNode::setOpacity(int input, qreal opacity) {
+    if (input < 0) return;
+    opacity = qBound((qreal)0, opacity, (qreal)1);
+    QVariantList opacities;
+    {
+        QMutexLocker locker(&m_stateLock);
+        while (m_opacities.count() <= input) m_opacities.append(1.);
+        if (m_opacities.at(input).toReal() == opacity) return;
+        m_opacities[input] = opacity;
+        opacities = m_opacities;
+    }
+    emit opacitiesChanged(opacities);
+}
+
+QVariantList CompositorNode::blendModes() {
+    QMutexLocker locker(&m_stateLock);
+    return m_blendModes;
+}
+
+void CompositorNode::setBlendModes(QVariantList blendModes) {
+    {
+        QMutexLocker locker(&m_stateLock);
+        if (blendModes == m_blendModes) return;
+        m_blendModes = blendModes;
+    }
+    emit blendModesChanged(blendModes);
+}
+
+QString CompositorNode::blendMode(int input) {
+    QMutexLocker locker(&m_stateLock);
+    return input < m_blendModes.count() ? m_blendModes.at(input).toString() : "normal";
+}
+
+void CompositorNode::setBlendMode(int input, QString blendMode) {
+    if (input < 0) return;
+    if (!blendModeNames().contains(blendMode)) {
+        qWarning() << "Unknown blend mode" << blendMode;
+        return;
+    }
+    QVariantList blendModes;
+    {
+        QMutexLocker locker(&m_stateLock);
+        while (m_blendModes.count() <= input) m_blendModes.append("normal");
+        if (m_blendModes.at(input).toString() == blendMode) return;
+        m_blendModes[input] = blendMode;
+        blendModes = m_blendModes;
+    }
+    emit blendModesChanged(blendModes);
+}
+
+void CompositorNode::chainsEdited(QList<QSharedPointer<Chain>> added, QList<QSharedPointer<Chain>> removed) {
+    Q_UNUSED(added);
+    QMutexLocker locker(&m_stateLock);
+    for (auto chain : removed) {
+        m_renderStates.remove(chain);
+    }
+}
+
+QSharedPointer<QOpenGLShaderProgram> CompositorNode::program(QSharedPointer<CompositorNodeRenderState> renderState, int layers) {
+    auto program = renderState->m_programs.value(layers);
+    if (!program.isNull()) return program;
+
+    // Samplers can't be indexed by a loop variable in GLSL 1.50
+    // so the layers are unrolled
+    auto layerCode = QString{};
+    for (int i = 0; i < layers; i++) {
+        layerCode += QString("    c = blend(c, texture(iLayers[%1], uv) * iOpacity[%1], iMode[%1]);\n").arg(i);
+    }
+
+    program = QSharedPointer<QOpenGLShaderProgram>::create();
+    auto ok = program->addShaderFromSourceCode(QOpenGLShader::Vertex,
+        "#version 150\n"
+        "const vec2 varray[4] = vec2[](vec2(1., 1.),vec2(1., -1.),vec2(-1., 1.),vec2(-1., -1.));\n"
+        "out vec2 uv;\n"
+        "void main() {\n"
+        "    vec2 vertex = varray[gl_VertexID];\n"
+        "    gl_Position = vec4(vertex,0.,1.);\n"
+        "    uv = 0.5 * (vertex + 1.);\n"
+        "}\n");
+    ok = ok && program->addShaderFromSourceCode(QOpenGLShader::Fragment, QString(
+        "#version 150\n"
+        "uniform sampler2D iLayers[%1];\n"
+        "uniform float iOpacity[%1];\n"
+        "uniform int iMode[%1];\n"
+        "in vec2 uv;\n"
+        "out vec4 fragColor;\n"
+        "\n"
+        "// Separable blend modes on demultiplied color\n"
+        "vec3 blendColor(vec3 cb, vec3 cs, int mode) {\n"
+        "    if (mode == 2) return cb * cs;\n"
+        "    if (mode == 3) return cb + cs - cb * cs;\n"
+        "    if (mode == 4) return max(cb, cs);\n"
+        "    if (mode == 5) return min(cb, cs);\n"
+        "    if (mode == 6) return abs(cb - cs);\n"
+        "    return cs;\n"
+        "}\n"
+        "\n"
+        "// Everything is premultiplied\n"
+        "vec4 blend(vec4 under, vec4 over, int mode) {\n"
+        "    if (mode == 1) return clamp(under + over, 0., 1.);\n"
+        "    vec3 cb = under.rgb / max(under.a, 1e-6);\n"
+        "    vec3 cs = over.rgb / max(over.a, 1e-6);\n"
+        "    vec3 rgb = (1. - over.a) * under.rgb + (1. - under.a) * over.rgb + over.a * under.a * blendColor(cb, cs, mode);\n"
+        "    return clamp(vec4(rgb, over.a + under.a - over.a * under.a), 0., 1.);\n"
+        "}\n"
+        "\n"
+        "void main() {\n"
+        "    vec4 c = vec4(0.);\n"
+        "%2"
+        "    fragColor = c;\n"
+        "}\n").arg(layers).arg(layerCode));
+    ok = ok && program->link();
+    if (!ok) {
+        qWarning() << "Could not compile compositor shader:" << program->log();
+        return QSharedPointer<QOpenGLShaderProgram>();
+    }
+    renderState->m_programs.insert(layers, program);
+    return program;
+}
+
+GLuint CompositorNode::paint(QSharedPointer<Chain> chain, QVector<GLuint> inputTextures) {
+    QSharedPointer<CompositorNodeRenderState> renderState;
+    QVariantList opacities;
+    QVariantList blendModes;
+    {
+        TimedMutexLocker locker(&m_stateLock, &m_renderLockStatistics);
+        renderState = m_renderStates.value(chain);
+        if (renderState.isNull()) {
+            if (!m_chains.contains(chain)) return 0;
+            renderState = QSharedPointer<CompositorNodeRenderState>::create();
+            m_renderStates.insert(chain, renderState);
+        }
+        opacities = m_opacities;
+        blendModes = m_blendModes;
+    }
+
+    auto layerCount = inputTextures.count();
+    if (layerCount == 0) return chain->blankTexture();
+
+    auto modeNames = blendModeNames();
+    QVector<GLfloat> layerOpacities(layerCount, 1);
+    QVector<GLint> layerModes(layerCount, 0);
+    for (int i = 0; i < layerCount; i++) {
+        if (i < opacities.count()) layerOpacities[i] = opacities.at(i).toFloat();
+        if (i < blendModes.count()) layerModes[i] = qMax(0, modeNames.indexOf(blendModes.at(i).toString()));
+    }
+
+    if (renderState->m_maxLayers == 0) {
+        GLint units = 0;
+        glGetIntegerv(GL_MAX_TEXTURE_IMAGE_UNITS, &units);
+        renderState->m_maxLayers = qMax(2, (int)units);
+    }
+
+    // FBO creation must happen here, and not in initialize,
+    // because FBOs are not shared among contexts.
+    auto fmt = QOpenGLFramebufferObjectFormat{};
+    fmt.setInternalTextureFormat(chain->renderFormat());
+    for (auto & fbo : renderState->m_fbos) {
+        if (!fbo || fbo->size() != chain->size()) {
+            fbo = QSharedPointer<QOpenGLFramebufferObject>::create(chain->size(), fmt);
+        }
+    }
+
+    glClearColor(0, 0, 0, 0);
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_BLEND);
+    glViewport(0, 0, chain->size().width(), chain->size().height());
+
+    auto target = (renderState->m_lastOutput + 1) % 3;
+    auto spare = (renderState->m_lastOutput + 2) % 3;
+    GLuint outTexture = 0;
+    int next = 0;
+    while (next < layerCount) {
+        // After the first chunk, the result so far
+        // is the bottom layer of the next one
+        QVector<GLuint> textures;
+        QVector<GLfloat> chunkOpacities;
+        QVector<GLint> chunkModes;
+        if (outTexture != 0) {
+            textures.append(outTexture);
+            chunkOpacities.append(1);
+            chunkModes.append(0);
+        }
+        auto count = qMin(layerCount - next, renderState->m_maxLayers - textures.count());
+        textures += inputTextures.mid(next, count);
+        chunkOpacities += layerOpacities.mid(next, count);
+        chunkModes += layerModes.mid(next, count);
+        next += count;
+
+        auto p = program(renderState, textures.count());
+        if (p.isNull()) return inputTextures.at(0);
+
+        QVector<GLint> units(textures.count());
+        std::iota(units.begin(), units.end(), 0);
+        for (int i = 0; i < textures.count(); i++) {
+            glActiveTexture(GL_TEXTURE0 + i);
+            glBindTexture(GL_TEXTURE_2D, textures.at(i));
+        }
+
+        auto fbo = renderState->m_fbos[target];
+        fbo->bind();
+        p->bind();
+        p->setUniformValueArray("iLayers", units.constData(), units.count());
+        p->setUniformValueArray("iOpacity", chunkOpacities.constData(), chunkOpacities.count(), 1);
+        p->setUniformValueArray("iMode", chunkModes.constData(), chunkModes.count());
+        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+        p->release();
+        fbo->release();
+        outTexture = fbo->texture();
+
+        if (next < layerCount) {
+            std::swap(target, spare);
+        }
+    }
+    glActiveTexture(GL_TEXTURE0); // Very important to reset OpenGL state for scene graph rendering
+
+    renderState->m_lastOutput = target;
+    return outTexture;
+}
+
+QString CompositorNode::typeName() {
+    return "CompositorNode";
+}
+
+VideoNodeSP *CompositorNode::deserialize(Context *context, QJsonObject obj) {
+    auto node = new CompositorNodeSP(new CompositorNode(context));
+    if (obj.contains("inputCount")) {
+        (*node)->setInputCount(qMax(1, obj.value("inputCount").toInt()));
+    }
+    (*node)->setOpacities(obj.value("opacities").toArray().toVariantList());
+    (*node)->setBlendModes(obj.value("blendModes").toArray().toVariantList());
+    return node;
+}
+
+bool CompositorNode::canCreateFromFile(QString filename) {
+    Q_UNUSED(filename);
+    return false;
+}
+
+VideoNodeSP *CompositorNode::fromFile(Context *context, QString filename) {
+    Q_UNUSED(context);
+    Q_UNUSED(filename);
+    return nullptr;
+}
+
+QMap<QString, QString> CompositorNode::customInstantiators() {
+    auto m = QMap<QString, QString>();
+    m.insert("Compositor", "CompositorInstantiator.qml");
+    return m;
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include "VideoNode.h"
+#include <QOpenGLFramebufferObject>
+#include <QOpenGLShaderProgram>
+#include <QVariantList>
+#include <QStringList>
+#include <QMutex>
+
+// This class extends VideoNode to mix any number of inputs
+// in a single draw, with an opacity and blend mode per input.
+// Input 0 is the bottom layer.
+//
+// Layers are sampled by a generated shader
+// that reads every input at once.
+// If there are more inputs than texture units,
+// they are composited in chunks
+// with each chunk drawn over the result of the last.
+
+class CompositorNodeRenderState {
+public:
+    // Three so that the output of the last frame
+    // can stay untouched while two others ping-pong
+    // between chunks
+    QSharedPointer<QOpenGLFramebufferObject> m_fbos[3];
+    int m_lastOutput{};
+
+    // Generated programs, by number of layers
+    QMap<int, QSharedPointer<QOpenGLShaderProgram>> m_programs;
+    int m_maxLayers{};
+};
+
+class CompositorNode
+    : public VideoNode {
+    Q_OBJECT
+    Q_PROPERTY(QVariantList opacities READ opacities WRITE setOpacities NOTIFY opacitiesChanged)
+    Q_PROPERTY(QVariantList blendModes READ blendModes WRITE setBlendModes NOTIFY blendModesChanged)
+
+public:
+    CompositorNode(Context *context);
+
+    QJsonObject serialize() override;
+
+    GLuint paint(QSharedPointer<Chain> chain, QVector<GLuint> inputTextures) override;
+
+    // These static methods are required for VideoNode creation
+    // through the registry
+
+    // A string representation of this VideoNode type
+    static QString typeName();
+
+    // Create a VideoNode from a JSON description of one
+    // Returns nullptr if the description is invalid
+    static VideoNodeSP *deserialize(Context *context, QJsonObject obj);
+
+    // Return true if a VideoNode could be created from
+    // the given filename
+    // This check should be very quick.
+    static bool canCreateFromFile(QString filename);
+
+    // Create a VideoNode from a filename
+    // Returns nullptr if a VideoNode cannot be create from the given filename
+    static VideoNodeSP *fromFile(Context *context, QString filename);
+
+    // Returns QML filenames that can be loaded
+    // to instantiate custom instances of this VideoNode
+    static QMap<QString, QString> customInstantiators();
+
+    // Names of the supported blend modes
+    static QStringList blendModeNames();
+
+public slots:
+    // Opacity of each input, [0, 1].
+    // Inputs without an entry are fully opaque.
+    QVariantList opacities();
+    void setOpacities(QVariantList opacities);
+    qreal opacity(int input);
+    void setOpacity(int input, qreal opacity);
+
+    // Blend mode of each input, one of blendModeNames().
+    // Inputs without an entry use "normal".
+    QVariantList blendModes();
+    void setBlendModes(QVariantList blendModes);
+    QString blendMode(int input);
+    void setBlendMode(int input, QString blendMode);
+
+protected slots:
+    void chainsEdited(QList<QSharedPointer<Chain>> added, QList<QSharedPointer<Chain>> removed) override;
+
+signals:
+    void opacitiesChanged(QVariantList opacities);
+    void blendModesChanged(QVariantList blendModes);
+
+protected:
+    // Returns a program that composites the given number of layers
+    QSharedPointer<QOpenGLShaderProgram> program(QSharedPointer<CompositorNodeRenderState> renderState, int layers);
+
+    QVariantList m_opacities;
+    QVariantList m_blendModes;
+    QMap<QSharedPointer<Chain>, QSharedPointer<CompositorNodeRenderState>> m_renderStates;
+};
+
+typedef QmlSharedPointer<CompositorNode, VideoNodeSP> CompositorNodeSP;
+Q_DECLARE_METATYPE(CompositorNodeSP*)
@@ -21,6 +21,7 @@ QString ConsoleOutputNode::typeName() {
 VideoNodeSP *ConsoleOutputNode::deserialize(Context *context, QJsonObject obj) {
     auto node = new ConsoleOutputNodeSP(new ConsoleOutputNode(context, QSize(4, 4)));
     (*node)->init();
+    (*node)->deserializeSettings(obj);
     return node;
 }
 
@@ -9,6 +9,7 @@ Context::Context(bool threaded)
     : m_audio(nullptr)
     , m_timebase(nullptr)
     , m_openGLWorkerContext(nullptr)
+    , m_registry(nullptr)
 {
     m_threaded = threaded;
     m_openGLWorkerContext = new OpenGLWorkerContext(threaded);
@@ -33,7 +34,16 @@ OpenGLWorkerContext *Context::openGLWorkerContext() {
     return m_openGLWorkerContext;
 }
 
+Registry *Context::registry() {
+    QMutexLocker locker(&m_registryLock);
+    if (m_registry == nullptr) {
+        m_registry = new Registry();
+    }
+    return m_registry;
+}
+
 Context::~Context() {
+    delete m_registry;
     delete m_audio;
     delete m_timebase;
 }
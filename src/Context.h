@@ -7,11 +7,13 @@
 #include "VideoNode.h"
 
 #include <QObject>
+#include <QMutex>
 
 class QSettings;
 class Audio;
 class Timebase;
 class OpenGLWorkerContext;
+class Registry;
 
 class Context : public QObject {
     Q_OBJECT
@@ -25,9 +27,17 @@ public:
     Timebase *timebase();
     OpenGLWorkerContext *openGLWorkerContext();
 
+    // A registry for nodes that load other nodes from files
+    // (such as subgraphs.)
+    // It is built the first time it is asked for,
+    // and may be used from any thread.
+    Registry *registry();
+
 protected:
     bool m_threaded;
     Audio *m_audio;
     Timebase *m_timebase;
     OpenGLWorkerContext *m_openGLWorkerContext;
+    QMutex m_registryLock;
+    Registry *m_registry;
 };
@@ -8,16 +8,51 @@
 #include <QOpenGLFramebufferObjectFormat>
 #include <QRegularExpression>
 #include <QOpenGLVertexArrayObject>
+#include <QOpenGLContext>
+#include <QOpenGLExtraFunctions>
 #include <QtQml>
+#include <QtMath>
 #include <memory>
 #include <utility>
 #include <functional>
 #include <algorithm>
+#include <cstring>
+#include <type_traits>
 #include "Paths.h"
 
+static_assert(std::is_trivially_copyable<EffectNodeParameters>::value,
+              "EffectNodeParameters are copied in and out of a seqlock");
+
+// Successive EffectNodes get successive phases
+// so that decimated nodes don't all render on the same frame
+static QAtomicInt s_nextUpdatePhase;
+
+// The chain's textures only cover the tile being rendered,
+// so lookups in them at uv (which covers the whole canvas)
+// go through canvasTexture() and canvasTextureLod() (see effect_header.glsl.)
+// This rewrites the lookups of iInputs, iChannel and iHistory
+// so that effects don't have to.
+// Sets *unmapped if any other lookup is left,
+// e.g. through a sampler2D parameter, which may seam when tiled.
+static QString mapToCanvas(QString code, bool *unmapped) {
+    static const QString samplers = "(?=(?:iInputs?|iChannel|iHistory)\\b)";
+    static const QRegularExpression texture_reg("\\b(?:texture|texture2D)\\s*\\(\\s*" + samplers);
+    static const QRegularExpression textureLod_reg("\\btextureLod\\s*\\(\\s*" + samplers);
+    static const QRegularExpression comment_reg("//[^\\n]*|/\\*.*?\\*/", QRegularExpression::DotMatchesEverythingOption);
+    static const QRegularExpression other_reg("\\btexture(?:2D|Lod|Grad|Offset|Proj)?\\s*\\(\\s*(?!iNoise\\b)");
+
+    code.replace(texture_reg, "canvasTexture(");
+    code.replace(textureLod_reg, "canvasTextureLod(");
+    if (QString(code).remove(comment_reg).contains(other_reg)) *unmapped = true;
+    return code;
+}
+
 EffectNode::EffectNode(Context *context)
     : VideoNode(context)
+    , m_updatePhase(s_nextUpdatePhase.fetchAndAddRelaxed(1))
 {
+    QMutexLocker locker(&m_parametersLock);
+    storeParameters(EffectNodeParameters());
 }
 
 void EffectNode::init(QString file)
@@ -25,12 +60,12 @@ void EffectNode::init(QString file)
     m_openGLWorker = QSharedPointer<EffectNodeOpenGLWorker>(new EffectNodeOpenGLWorker(qSharedPointerCast<EffectNode>(sharedFromThis())), &QObject::deleteLater);
     setInputCount(1);
     setFrequency(0);
-    m_periodic.setInterval(10);
-    m_periodic.start();
-    connect(&m_periodic, &QTimer::timeout, this, &EffectNode::onPeriodic);
 
-    m_beatLast = m_context->timebase()->beat();
-    m_realTimeLast = m_context->timebase()->wallTime();
+    auto beat = m_context->timebase()->beat();
+    editParameters([beat](EffectNodeParameters &p) {
+        p.integralBeat = beat;
+        return true;
+    });
     if (!file.isEmpty()) setFile(file);
 }
 
@@ -39,6 +74,8 @@ QJsonObject EffectNode::serialize() {
     o.insert("file", file());
     o.insert("intensity", intensity());
     o.insert("frequency", frequency());
+    o.insert("updateDivisor", updateDivisor());
+    o.insert("maxUpdateRate", maxUpdateRate());
     return o;
 }
 
@@ -63,10 +100,9 @@ GLuint EffectNode::paint(QSharedPointer<Chain> chain, QVector<GLuint> inputTextu
     auto time = context()->timebase()->beat();
     auto wallTime = context()->timebase()->wallTime();
     qreal step;
-    qreal intensityIntegral;
-    qreal frequency;
+    QString unmappedWarning;
     {
-        QMutexLocker locker(&m_stateLock);
+        TimedMutexLocker locker(&m_stateLock, &m_renderLockStatistics);
         if (!m_ready) {
             //qDebug() << this << "is not ready";
             return inputTextures.at(0); // Pass-through
@@ -77,13 +113,51 @@ GLuint EffectNode::paint(QSharedPointer<Chain> chain, QVector<GLuint> inputTextu
             return inputTextures.at(0);
         }
         renderState = m_renderStates[chain];
-        inputCount = m_inputCount;
-        m_realTimeLast = m_realTime;
-        m_realTime = wallTime;
-        step = m_realTime - m_realTimeLast;
-        intensityIntegral = m_intensityIntegral;
-        frequency = m_frequency;
+        if (m_unmappedLookups && !m_warnedUnmapped && chain->tiled()) {
+            m_warnedUnmapped = true;
+            unmappedWarning = QString("%1 samples a texture that can't be mapped onto the tile, so it may show seams on tiled outputs").arg(fileToName(m_file));
+        }
+    }
+    if (!unmappedWarning.isEmpty()) emit warning(unmappedWarning);
+    // The model copy already fixed the number of inputs for this frame
+    inputCount = inputTextures.count();
+
+    // Read the parameters exactly once
+    auto params = parameters();
+    auto intensityIntegral = params.integralAt(time);
+    if (params.beatsSince(time) > INTEGRAL_REFRESH_BEATS) {
+        // Move the integral's reference point forward
+        // so the beat counter can never wrap all the way around
+        // between edits.
+        // If a setter is busy or got there first,
+        // try again next frame.
+        auto version = params.version;
+        tryEditParameters([version, intensityIntegral, time](EffectNodeParameters &p) {
+            if (p.version != version) return false;
+            p.intensityIntegral = intensityIntegral;
+            p.integralBeat = time;
+            return true;
+        });
+    }
+
+    // Decide whether to render this frame or hold the previous output.
+    // The first frame on a chain is always rendered.
+    auto frame = renderState->m_frameCount++;
+    if (renderState->m_lastOutput != 0) {
+        if ((frame + m_updatePhase) % params.updateDivisor != 0) {
+            return renderState->m_lastOutput;
+        }
+        // Allow half a frame of slack so that e.g. a 30Hz limit
+        // on a 60Hz output doesn't drop to 20Hz due to jitter
+        if (params.maxUpdateRate > 0
+         && wallTime - renderState->m_lastRenderTime < 1. / params.maxUpdateRate - 0.5 / FPS) {
+            return renderState->m_lastOutput;
+        }
+        step = wallTime - renderState->m_lastRenderTime;
+    } else {
+        step = 0;
     }
+    renderState->m_lastRenderTime = wallTime;
 
     // FBO creation must happen here, and not in initialize,
     // because FBOs are not shared among contexts.
@@ -92,7 +166,7 @@ GLuint EffectNode::paint(QSharedPointer<Chain> chain, QVector<GLuint> inputTextu
     // and leave lightweight FBO creation here
     {
         auto fmt = QOpenGLFramebufferObjectFormat{};
-        fmt.setInternalTextureFormat(GL_RGBA);
+        fmt.setInternalTextureFormat(chain->renderFormat());
         for(auto & pass : renderState->m_passes) {
             if(!pass.m_output) {
                 pass.m_output = QSharedPointer<QOpenGLFramebufferObject>::create(chain->size(),fmt);
@@ -103,6 +177,60 @@ GLuint EffectNode::paint(QSharedPointer<Chain> chain, QVector<GLuint> inputTextu
         }
     }
 
+    // Make room for the history, and push the first input onto it
+    // if that is what it holds. Outputs are pushed after rendering.
+    if (params.historyDepth > 0 && inputCount > 0) {
+        auto historyFormat = QOpenGLTexture::TextureFormat(params.historyFormat != 0 ? params.historyFormat : chain->renderFormat());
+        // Deep histories of big chains add up quickly,
+        // so scale them down further to fit in MAX_HISTORY_BYTES
+        auto historyScale = params.historyScale;
+        qreal bytes = chain->size().width() * chain->size().height()
+                    * historyScale * historyScale * params.historyDepth
+                    * (historyFormat == QOpenGLTexture::RGBA16F ? 8 : 4);
+        if (bytes > MAX_HISTORY_BYTES) {
+            historyScale *= qSqrt(MAX_HISTORY_BYTES / bytes);
+        }
+        auto historySize = QSize(qMax(1, (int)(chain->size().width() * historyScale)),
+                                 qMax(1, (int)(chain->size().height() * historyScale)));
+        auto & history = renderState->m_history;
+        if (history.isNull()
+         || history->layers() != params.historyDepth
+         || history->width() != historySize.width()
+         || history->height() != historySize.height()
+         || history->format() != historyFormat) {
+            history = chain->texturePool()->acquire(QOpenGLTexture::Target2DArray, historySize, params.historyDepth, historyFormat);
+            // Start out with every layer holding the current input
+            // rather than whatever was in the texture before
+            for (int layer = 0; layer < params.historyDepth; layer++) {
+                chain->copyTexture(inputTextures.at(0), history.data(), layer);
+            }
+            renderState->m_historyHead = 0;
+        } else if (params.historyOfInput) {
+            renderState->m_historyHead = (renderState->m_historyHead + 1) % params.historyDepth;
+            chain->copyTexture(inputTextures.at(0), history.data(), renderState->m_historyHead);
+        }
+    } else {
+        // Give the texture back to the pool
+        renderState->m_history.reset();
+    }
+
+    // This must look at the inputs before they are swapped for pyramids
+    GLuint statisticsTexture = 0;
+    if (params.inputStatistics && inputCount > 0) {
+        statisticsTexture = chain->statistics(inputTextures.at(0));
+        if (statisticsTexture != 0) {
+            readBackStatistics(renderState, statisticsTexture);
+        }
+    }
+
+    GLint inputFilter = GL_LINEAR;
+    if (params.inputPyramid) {
+        for (int k = 0; k < inputCount; k++) {
+            inputTextures[k] = chain->pyramid(inputTextures.at(k));
+        }
+        inputFilter = GL_LINEAR_MIPMAP_LINEAR;
+    }
+
     glClearColor(0, 0, 0, 0);
     glDisable(GL_DEPTH_TEST);
     glDisable(GL_BLEND);
@@ -120,12 +248,16 @@ GLuint EffectNode::paint(QSharedPointer<Chain> chain, QVector<GLuint> inputTextu
         context()->audio()->levels(&audioHi, &audioMid, &audioLow, &audioLevel);
 
         auto size = chain->size();
+        auto canvasSize = chain->canvasSize();
+        auto tileRect = chain->normalizedTileRect();
         glViewport(0, 0, size.width(), size.height());
 
         for(auto & pass : renderState->m_passes) {
             //qDebug() << "Rendering shader" << j << "onto" << (renderState->m_textureIndex + j + 1) % (m_programs.count() + 1);
             auto && p = pass.m_shader;
-            renderState->m_extra->bind();
+            if (!pass.m_compute) {
+                renderState->m_extra->bind();
+            }
             p->bind();
 
             auto texCount = GL_TEXTURE0;
@@ -133,7 +265,7 @@ GLuint EffectNode::paint(QSharedPointer<Chain> chain, QVector<GLuint> inputTextu
                 glActiveTexture(texCount++);
                 glBindTexture(GL_TEXTURE_2D, inputTextures.at(k));
                 glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_LINEAR);
-                glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_LINEAR);
+                glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,inputFilter);
 
             }
 
@@ -145,21 +277,53 @@ GLuint EffectNode::paint(QSharedPointer<Chain> chain, QVector<GLuint> inputTextu
                 glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_LINEAR);
                 glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_LINEAR);
             }
-            auto intense = qreal(intensity());
-            p->setUniformValue("iIntensity", GLfloat(intense));
+            // Always give iHistory its own unit, even if it is empty,
+            // since samplers of different types can't share a unit
+            auto historyUnit = texCount - GL_TEXTURE0;
+            glActiveTexture(texCount++);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, renderState->m_history.isNull() ? 0 : renderState->m_history->textureId());
+            auto statisticsUnit = texCount - GL_TEXTURE0;
+            glActiveTexture(texCount++);
+            glBindTexture(GL_TEXTURE_2D, statisticsTexture);
+            p->setUniformValue("iIntensity", GLfloat(params.intensity));
             p->setUniformValue("iIntensityIntegral", GLfloat(intensityIntegral));
             p->setUniformValue("iStep", GLfloat(step));
             p->setUniformValue("iTime", GLfloat(time));
-            p->setUniformValue("iFrequency", GLfloat(frequency));
+            p->setUniformValue("iFrequency", GLfloat(params.frequency));
             p->setUniformValue("iFPS",  GLfloat(FPS));
             p->setUniformValue("iAudio", QVector4D(GLfloat(audioLow),GLfloat(audioMid),GLfloat(audioHi),GLfloat(audioLevel)));
             p->setUniformValueArray("iInputs", &inputTex[0], inputCount);
             p->setUniformValue("iNoise", inputCount);
-            p->setUniformValue("iResolution", GLfloat(size.width()), GLfloat(size.height()));
+            if (pass.m_compute) {
+                // Compute passes work in pixels of the tile
+                p->setUniformValue("iResolution", GLfloat(size.width()), GLfloat(size.height()));
+            } else {
+                p->setUniformValue("iResolution", GLfloat(canvasSize.width()), GLfloat(canvasSize.height()));
+                p->setUniformValue("iTileRect", tileRect);
+            }
             p->setUniformValueArray("iChannel", &chanTex[0], renderState->m_passes.size());
-
-            glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-            renderState->m_extra->release();
+            p->setUniformValue("iHistory", historyUnit);
+            p->setUniformValue("iHistoryHead", renderState->m_historyHead);
+            p->setUniformValue("iHistoryDepth", renderState->m_history.isNull() ? 0 : params.historyDepth);
+            p->setUniformValue("iStats", statisticsUnit);
+
+            if (pass.m_compute) {
+                auto gl = QOpenGLContext::currentContext()->extraFunctions();
+                auto groups = pass.m_groups;
+                if (groups.isEmpty()) {
+                    groups = QSize((size.width() + pass.m_localSize.width() - 1) / pass.m_localSize.width(),
+                                   (size.height() + pass.m_localSize.height() - 1) / pass.m_localSize.height());
+                }
+                gl->glBindImageTexture(0, renderState->m_extra->texture(), 0, GL_FALSE, 0, GL_WRITE_ONLY, chain->renderFormat());
+                p->setUniformValue("iOutput", 0);
+                gl->glDispatchCompute(groups.width(), groups.height(), 1);
+                // Later passes and nodes sample or blit the result
+                gl->glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_FRAMEBUFFER_BARRIER_BIT);
+                gl->glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, chain->renderFormat());
+            } else {
+                glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+                renderState->m_extra->release();
+            }
             outTexture = renderState->m_extra->texture();
             using std::swap;
             swap(renderState->m_extra, pass.m_output);
@@ -170,34 +334,98 @@ GLuint EffectNode::paint(QSharedPointer<Chain> chain, QVector<GLuint> inputTextu
         //qDebug() << this << "Output texture ID is" << outTexture << renderState;
         //qDebug() << "Output is" << ((renderState->m_textureIndex + 1) % (m_programs.count() + 1));
     }
+
+    if (!params.historyOfInput && !renderState->m_history.isNull() && outTexture != 0) {
+        renderState->m_historyHead = (renderState->m_historyHead + 1) % params.historyDepth;
+        chain->copyTexture(outTexture, renderState->m_history.data(), renderState->m_historyHead);
+    }
+
+    renderState->m_lastOutput = outTexture;
     return outTexture;
 }
 
-void EffectNode::onPeriodic() {
-    QMutexLocker locker(&m_stateLock);
-    qreal beatNow = context()->timebase()->beat();
-    qreal beatDiff = beatNow - m_beatLast;
-    if (beatDiff < 0)
+qreal EffectNodeParameters::beatsSince(qreal beatNow) const {
+    qreal beatDiff = beatNow - integralBeat;
+    if (beatDiff < -Timebase::MAX_BEAT / 2) {
+        // The beat counter wrapped around
         beatDiff += Timebase::MAX_BEAT;
-    m_intensityIntegral = fmod(m_intensityIntegral + m_intensity * beatDiff, MAX_INTEGRAL);
-    m_beatLast = beatNow;
+    } else if (beatDiff < 0) {
+        // The timebase corrected itself slightly backwards
+        beatDiff = 0;
+    }
+    return beatDiff;
+}
+
+qreal EffectNodeParameters::integralAt(qreal beatNow) const {
+    return fmod(intensityIntegral + intensity * beatsSince(beatNow), EffectNode::MAX_INTEGRAL);
+}
+
+EffectNodeParameters EffectNode::parameters() const {
+    quint32 words[PARAMETER_WORDS];
+    for (;;) {
+        auto before = m_parametersSequence.load(std::memory_order_acquire);
+        if (before & 1) continue; // A setter is halfway through
+        for (int i = 0; i < PARAMETER_WORDS; i++) {
+            words[i] = m_parametersWords[i].load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (m_parametersSequence.load(std::memory_order_relaxed) == before) break;
+    }
+    EffectNodeParameters parameters;
+    memcpy(&parameters, words, sizeof(parameters));
+    return parameters;
+}
+
+void EffectNode::storeParameters(const EffectNodeParameters &parameters) {
+    quint32 words[PARAMETER_WORDS]{};
+    memcpy(words, &parameters, sizeof(parameters));
+    auto sequence = m_parametersSequence.load(std::memory_order_relaxed);
+    m_parametersSequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (int i = 0; i < PARAMETER_WORDS; i++) {
+        m_parametersWords[i].store(words[i], std::memory_order_relaxed);
+    }
+    m_parametersSequence.store(sequence + 2, std::memory_order_release);
+}
+
+bool EffectNode::editParameters(std::function<bool(EffectNodeParameters &)> edit) {
+    QMutexLocker locker(&m_parametersLock);
+    auto next = parameters();
+    if (!edit(next)) return false;
+    next.version++;
+    storeParameters(next);
+    return true;
+}
+
+bool EffectNode::tryEditParameters(std::function<bool(EffectNodeParameters &)> edit) {
+    if (!m_parametersLock.tryLock()) return false;
+    auto next = parameters();
+    auto changed = edit(next);
+    if (changed) {
+        next.version++;
+        storeParameters(next);
+    }
+    m_parametersLock.unlock();
+    return changed;
 }
 
 qreal EffectNode::intensity() {
-    QMutexLocker locker(&m_stateLock);
-    return m_intensity;
+    return parameters().intensity;
 }
 
 void EffectNode::setIntensity(qreal value) {
-    {
-        QMutexLocker locker(&m_stateLock);
-        if(value > 1) value = 1;
-        if(value < 0) value = 0;
-        if(m_intensity == value)
-            return;
-        m_intensity = value;
-    }
-    emit intensityChanged(value);
+    if(value > 1) value = 1;
+    if(value < 0) value = 0;
+    auto beatNow = context()->timebase()->beat();
+    auto changed = editParameters([value, beatNow](EffectNodeParameters &p) {
+        if (p.intensity == value) return false;
+        // Close out the integral at the old intensity
+        p.intensityIntegral = p.integralAt(beatNow);
+        p.integralBeat = beatNow;
+        p.intensity = value;
+        return true;
+    });
+    if (changed) emit intensityChanged(value);
 }
 
 QString EffectNode::file() {
@@ -215,17 +443,223 @@ QString EffectNode::name() {
 }
 
 double EffectNode::frequency() {
-    QMutexLocker locker(&m_stateLock);
-    return m_frequency;
+    return parameters().frequency;
 }
 
 void EffectNode::setFrequency(double frequency) {
+    auto changed = editParameters([frequency](EffectNodeParameters &p) {
+        if (p.frequency == frequency) return false;
+        p.frequency = frequency;
+        return true;
+    });
+    if (changed) emit frequencyChanged(frequency);
+}
+
+int EffectNode::updateDivisor() {
+    return parameters().updateDivisor;
+}
+
+void EffectNode::setUpdateDivisor(int divisor) {
+    if (divisor < 1) divisor = 1;
+    auto changed = editParameters([divisor](EffectNodeParameters &p) {
+        if (p.updateDivisor == divisor) return false;
+        p.updateDivisor = divisor;
+        return true;
+    });
+    if (changed) emit updateDivisorChanged(divisor);
+}
+
+double EffectNode::maxUpdateRate() {
+    return parameters().maxUpdateRate;
+}
+
+void EffectNode::setMaxUpdateRate(double rate) {
+    if (rate < 0) rate = 0;
+    auto changed = editParameters([rate](EffectNodeParameters &p) {
+        if (p.maxUpdateRate == rate) return false;
+        p.maxUpdateRate = rate;
+        return true;
+    });
+    if (changed) emit maxUpdateRateChanged(rate);
+}
+
+int EffectNode::historyDepth() {
+    return parameters().historyDepth;
+}
+
+void EffectNode::setHistoryDepth(int depth) {
+    if (depth < 0) depth = 0;
+    auto changed = editParameters([depth](EffectNodeParameters &p) {
+        if (p.historyDepth == depth) return false;
+        p.historyDepth = depth;
+        return true;
+    });
+    if (changed) emit historyDepthChanged(depth);
+}
+
+qreal EffectNode::historyScale() {
+    return parameters().historyScale;
+}
+
+void EffectNode::setHistoryScale(qreal scale) {
+    scale = qBound((qreal)0.01, scale, (qreal)1);
+    auto changed = editParameters([scale](EffectNodeParameters &p) {
+        if (p.historyScale == scale) return false;
+        p.historyScale = scale;
+        return true;
+    });
+    if (changed) emit historyScaleChanged(scale);
+}
+
+QString EffectNode::historySource() {
+    return parameters().historyOfInput ? "input" : "output";
+}
+
+void EffectNode::setHistorySource(QString historySource) {
+    bool ofInput;
+    if (historySource == "output") {
+        ofInput = false;
+    } else if (historySource == "input") {
+        ofInput = true;
+    } else {
+        qWarning() << "Unknown history source" << historySource;
+        return;
+    }
+    auto changed = editParameters([ofInput](EffectNodeParameters &p) {
+        if (p.historyOfInput == ofInput) return false;
+        p.historyOfInput = ofInput;
+        return true;
+    });
+    if (changed) emit historySourceChanged(historySource);
+}
+
+QString EffectNode::historyFormat() {
+    switch (parameters().historyFormat) {
+    case GL_RGBA8:
+        return "rgba8";
+    case GL_RGB10_A2:
+        return "rgb10a2";
+    case GL_RGBA16F:
+        return "rgba16f";
+    default:
+        return "render";
+    }
+}
+
+void EffectNode::setHistoryFormat(QString historyFormat) {
+    GLenum format;
+    if (historyFormat == "render") {
+        format = 0;
+    } else if (historyFormat == "rgba8") {
+        format = GL_RGBA8;
+    } else if (historyFormat == "rgb10a2") {
+        format = GL_RGB10_A2;
+    } else if (historyFormat == "rgba16f") {
+        format = GL_RGBA16F;
+    } else {
+        qWarning() << "Unknown history format" << historyFormat;
+        return;
+    }
+    auto changed = editParameters([format](EffectNodeParameters &p) {
+        if (p.historyFormat == format) return false;
+        p.historyFormat = format;
+        return true;
+    });
+    if (changed) emit historyFormatChanged(historyFormat);
+}
+
+bool EffectNode::inputPyramid() {
+    return parameters().inputPyramid;
+}
+
+void EffectNode::setInputPyramid(bool inputPyramid) {
+    auto changed = editParameters([inputPyramid](EffectNodeParameters &p) {
+        if (p.inputPyramid == inputPyramid) return false;
+        p.inputPyramid = inputPyramid;
+        return true;
+    });
+    if (changed) emit inputPyramidChanged(inputPyramid);
+}
+
+bool EffectNode::inputStatistics() {
+    return parameters().inputStatistics;
+}
+
+void EffectNode::setInputStatistics(bool inputStatistics) {
+    auto changed = editParameters([inputStatistics](EffectNodeParameters &p) {
+        if (p.inputStatistics == inputStatistics) return false;
+        p.inputStatistics = inputStatistics;
+        return true;
+    });
+    if (changed) emit inputStatisticsChanged(inputStatistics);
+}
+
+QVariantMap EffectNode::statistics() {
+    QMutexLocker locker(&m_stateLock);
+    return m_statistics;
+}
+
+void EffectNode::setStatistics(QVariantMap statistics) {
     {
         QMutexLocker locker(&m_stateLock);
-        if (frequency == m_frequency) return;
-        m_frequency = frequency;
+        m_statistics = statistics;
     }
-    emit frequencyChanged(frequency);
+    emit statisticsChanged(statistics);
+}
+
+void EffectNode::readBackStatistics(QSharedPointer<EffectNodeRenderState> renderState, GLuint statistics) {
+    auto gl = QOpenGLContext::currentContext()->extraFunctions();
+    auto &buffer = renderState->m_statisticsBuffer;
+    auto &fence = renderState->m_statisticsFence;
+    const int texels = Chain::STATISTICS_BINS * 2;
+
+    if (fence != 0) {
+        auto result = gl->glClientWaitSync(fence, 0, 0);
+        if (result != GL_ALREADY_SIGNALED && result != GL_CONDITION_SATISFIED) {
+            return;
+        }
+        gl->glDeleteSync(fence);
+        fence = 0;
+
+        buffer.bind();
+        auto data = static_cast<const GLfloat *>(buffer.mapRange(0, texels * 4 * sizeof(GLfloat), QOpenGLBuffer::RangeRead));
+        if (data != nullptr) {
+            auto texel = [data](int x, int y) {
+                auto t = &data[(y * Chain::STATISTICS_BINS + x) * 4];
+                return QVariantList{t[0], t[1], t[2], t[3]};
+            };
+            QVariantList r, g, b, luminance;
+            for (int i = 0; i < Chain::STATISTICS_BINS; i++) {
+                auto bin = texel(i, 1);
+                r.append(bin.at(0));
+                g.append(bin.at(1));
+                b.append(bin.at(2));
+                luminance.append(bin.at(3));
+            }
+            QVariantMap map;
+            map.insert("mean", texel(0, 0));
+            map.insert("max", texel(1, 0));
+            map.insert("hue", texel(2, 0).at(3));
+            map.insert("histogram", QVariantMap{{"r", r}, {"g", g}, {"b", b}, {"luminance", luminance}});
+            buffer.unmap();
+            QMetaObject::invokeMethod(this, "setStatistics", Qt::QueuedConnection, Q_ARG(QVariantMap, map));
+        }
+        buffer.release();
+    }
+
+    if (!buffer.isCreated()) {
+        buffer.create();
+        buffer.setUsagePattern(QOpenGLBuffer::StreamRead);
+        buffer.bind();
+        buffer.allocate(texels * 4 * sizeof(GLfloat));
+    } else {
+        buffer.bind();
+    }
+    glBindTexture(GL_TEXTURE_2D, statistics);
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, nullptr);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    buffer.release();
+    fence = gl->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
 }
 
 void EffectNode::setFile(QString file) {
@@ -275,13 +709,17 @@ void EffectNode::reload() {
         "^\\s*#buffershader\\s*$"
       , QRegularExpression::CaseInsensitiveOption
         );
+    auto computeshader_reg = QRegularExpression(
+        "^\\s*#computeshader(\\s+(?<x>\\d+)\\s+(?<y>\\d+))?\\s*$"
+      , QRegularExpression::CaseInsensitiveOption
+        );
     auto property_reg = QRegularExpression(
         "^\\s*#property\\s+(?<file>\\w+)\\s+(?<value>.*)$"
       , QRegularExpression::CaseInsensitiveOption
         );
 
     auto passes = QVector<QStringList>{QStringList{"#line 0"}};
-    auto props  = QMap<QString,QString>{{"inputCount","1"}};
+    auto props  = QMap<QString,QString>{{"inputCount","1"},{"historyDepth","0"},{"historyScale","1"},{"historySource","output"},{"historyFormat","render"},{"inputPyramid","false"},{"inputStatistics","false"}};
     auto lineno = 1;
     for(auto next_line = QString{}; stream.readLineInto(&next_line);++lineno) {
         {
@@ -300,6 +738,15 @@ void EffectNode::reload() {
                 continue;
             }
         }
+        {
+            // The directive is kept as the first line of the pass
+            // so that the worker knows what kind of shader it is
+            auto m = computeshader_reg.match(next_line);
+            if(m.hasMatch()) {
+                passes.append({next_line.trimmed(), QString{"#line %1"}.arg(lineno)});
+                continue;
+            }
+        }
         passes.back().append(next_line);
     }
 
@@ -321,14 +768,28 @@ void EffectNode::reload() {
 // EffectNodeRenderState methods
 
 // Requires a valid OpenGL context
-EffectNodeRenderState::EffectNodeRenderState(QVector<QSharedPointer<QOpenGLShaderProgram>> shaders) {
-    for(auto shader : shaders) {
+EffectNodeRenderState::EffectNodeRenderState(QVector<QSharedPointer<QOpenGLShaderProgram>> shaders, QVector<QSize> computeGroups) {
+    for (int i = 0; i < shaders.count(); i++) {
         Pass p;
-        p.m_shader = copyProgram(shader);
+        p.m_shader = copyProgram(shaders.at(i));
+        p.m_compute = !shaders.at(i)->shaders().isEmpty()
+                   && shaders.at(i)->shaders().first()->shaderType() == QOpenGLShader::Compute;
+        if (p.m_compute && p.m_shader) {
+            GLint localSize[3]{};
+            QOpenGLContext::currentContext()->extraFunctions()->glGetProgramiv(p.m_shader->programId(), GL_COMPUTE_WORK_GROUP_SIZE, localSize);
+            p.m_localSize = QSize(localSize[0], localSize[1]);
+            p.m_groups = computeGroups.at(i);
+        }
         m_passes.append(p);
     }
 }
 
+EffectNodeRenderState::~EffectNodeRenderState() {
+    if (m_statisticsFence != 0 && QOpenGLContext::currentContext() != nullptr) {
+        QOpenGLContext::currentContext()->extraFunctions()->glDeleteSync(m_statisticsFence);
+    }
+}
+
 // EffectNodeOpenGLWorker methods
 
 EffectNodeOpenGLWorker::EffectNodeOpenGLWorker(QSharedPointer<EffectNode> p)
@@ -349,10 +810,12 @@ void EffectNodeOpenGLWorker::initialize(QVector<QStringList> sourceCode) {
         "#version 150\n"
         "const vec2 varray[4] = vec2[](vec2(1., 1.),vec2(1., -1.),vec2(-1., 1.),vec2(-1., -1.));\n"
         "out vec2 uv;\n"
+        "uniform vec4 iTileRect;\n"
         "void main() {"
         "    vec2 vertex = varray[gl_VertexID];\n"
         "    gl_Position = vec4(vertex,0.,1.);\n"
-        "    uv = 0.5 * (vertex + 1.);\n"
+        "    // uv is in canvas coordinates, even when rendering one tile\n"
+        "    uv = iTileRect.xy + iTileRect.zw * 0.5 * (vertex + 1.);\n"
         "}"};
 
     auto headerString = QString{};
@@ -368,24 +831,52 @@ void EffectNodeOpenGLWorker::initialize(QVector<QStringList> sourceCode) {
         headerString = headerStream.readAll();
     }
 
+    // Compute passes use the same header,
+    // minus the fragment shader specifics
+    auto computeHeaderString = QString{"#version 430\n#define COMPUTE_SHADER\n"} + headerString.section('\n', 1);
+    auto computeshader_reg = QRegularExpression(
+        "^#computeshader(\\s+(?<x>\\d+)\\s+(?<y>\\d+))?$"
+      , QRegularExpression::CaseInsensitiveOption
+        );
+
     QVector<QSharedPointer<QOpenGLShaderProgram>> shaders;
+    QVector<QSize> computeGroups;
+    bool unmapped = false;
 
     for(auto code : sourceCode) {
         auto program = QSharedPointer<QOpenGLShaderProgram>::create();
-        if(!program->addShaderFromSourceCode(
-            QOpenGLShader::Vertex
-          , vertexString
-            )) {
-            emit error("Could not compile vertex shader");
-            p->setNodeState(VideoNode::Broken);
-            return;
+        auto compute = computeshader_reg.match(code.first());
+        if(compute.hasMatch()) {
+            if(!QOpenGLShader::hasOpenGLShaders(QOpenGLShader::Compute)) {
+                emit error("Compute shaders require OpenGL 4.3");
+                p->setNodeState(VideoNode::Broken);
+                return;
+            }
+            code.removeFirst();
+            computeGroups.append(QSize(compute.captured("x").toInt(), compute.captured("y").toInt()));
+        } else {
+            if(!program->addShaderFromSourceCode(
+                QOpenGLShader::Vertex
+              , vertexString
+                )) {
+                emit error("Could not compile vertex shader");
+                p->setNodeState(VideoNode::Broken);
+                return;
+            }
+            computeGroups.append(QSize());
         }
-        auto frag = headerString + "\n" + code.join("\n");
-        if(!program->addShaderFromSourceCode(QOpenGLShader::Fragment, frag)) {
+        auto type = compute.hasMatch() ? QOpenGLShader::Compute : QOpenGLShader::Fragment;
+        auto body = code.join("\n");
+        if (!compute.hasMatch()) {
+            // Compute passes see the tile directly
+            body = mapToCanvas(body, &unmapped);
+        }
+        auto source = (compute.hasMatch() ? computeHeaderString : headerString) + "\n" + body;
+        if(!program->addShaderFromSourceCode(type, source)) {
             auto log = program->log().trimmed();
             QRegularExpression re("0:(\\d+)\\((\\d+)\\):");
             log.replace(re, "<a href=\"editline,\\1,\\2\">\\1(\\2)</a>:");
-            emit error(QString("Could not compile fragment shader:\n") + log);
+            emit error(QString("Could not compile %1 shader:\n").arg(compute.hasMatch() ? "compute" : "fragment") + log);
             p->setNodeState(VideoNode::Broken);
             return;
         }
@@ -399,6 +890,7 @@ void EffectNodeOpenGLWorker::initialize(QVector<QStringList> sourceCode) {
 
     Q_ASSERT(!shaders.empty());
     std::reverse(shaders.begin(), shaders.end());
+    std::reverse(computeGroups.begin(), computeGroups.end());
     // Shaders are now compiled and ready to go.
 
     // We prepare the state for all chains that exist upon creation
@@ -406,7 +898,7 @@ void EffectNodeOpenGLWorker::initialize(QVector<QStringList> sourceCode) {
     QMap<QSharedPointer<Chain>, QSharedPointer<EffectNodeRenderState>> states;
 
     for (auto chain : chains) {
-        states.insert(chain, QSharedPointer<EffectNodeRenderState>::create(shaders));
+        states.insert(chain, QSharedPointer<EffectNodeRenderState>::create(shaders, computeGroups));
     }
 
     // Swap out the newly loaded stuff
@@ -423,6 +915,9 @@ void EffectNodeOpenGLWorker::initialize(QVector<QStringList> sourceCode) {
         }
 
         p->m_shaders = shaders;
+        p->m_computeGroups = computeGroups;
+        p->m_unmappedLookups = unmapped;
+        p->m_warnedUnmapped = false;
         p->m_ready = true;
     }
 
@@ -438,16 +933,18 @@ void EffectNodeOpenGLWorker::addNewState(QSharedPointer<Chain> c) {
     if (p.isNull()) return; // EffectNode was deleted
 
     QVector<QSharedPointer<QOpenGLShaderProgram>> shaders;
+    QVector<QSize> computeGroups;
     {
         QMutexLocker locker(&p->m_stateLock);
         // Don't make states that we don't have to
         if (!p->m_chains.contains(c)) return;
         if (p->m_renderStates.contains(c)) return;
         shaders = p->m_shaders;
+        computeGroups = p->m_computeGroups;
     }
 
     makeCurrent();
-    auto state = QSharedPointer<EffectNodeRenderState>::create(shaders);
+    auto state = QSharedPointer<EffectNodeRenderState>::create(shaders, computeGroups);
 
     {
         QMutexLocker locker(&p->m_stateLock);
@@ -475,6 +972,14 @@ VideoNodeSP *EffectNode::deserialize(Context *context, QJsonObject obj) {
     if (frequencyJson.isDouble()) {
         (*node)->setFrequency(frequencyJson.toDouble());
     }
+    auto updateDivisorJson = obj.value("updateDivisor");
+    if (updateDivisorJson.isDouble()) {
+        (*node)->setUpdateDivisor(updateDivisorJson.toInt());
+    }
+    auto maxUpdateRateJson = obj.value("maxUpdateRate");
+    if (maxUpdateRateJson.isDouble()) {
+        (*node)->setMaxUpdateRate(maxUpdateRateJson.toDouble());
+    }
     return node;
 }
 
@@ -7,25 +7,92 @@
 #include <QOpenGLFunctions>
 #include <QOpenGLShaderProgram>
 #include <QOpenGLTexture>
+#include <QOpenGLBuffer>
+#include <QVariantMap>
 #include <QMutex>
-#include <QTimer>
 #include <QOpenGLFramebufferObject>
 #include <QEnableSharedFromThis>
+#include <memory>
+#include <functional>
+#include <atomic>
 
 class EffectNodeOpenGLWorker;
 
 class EffectNodeRenderState {
 public:
-    EffectNodeRenderState(QVector<QSharedPointer<QOpenGLShaderProgram>> shaders);
+    EffectNodeRenderState(QVector<QSharedPointer<QOpenGLShaderProgram>> shaders, QVector<QSize> computeGroups);
+   ~EffectNodeRenderState();
 
     struct Pass {
         QSharedPointer<QOpenGLFramebufferObject> m_output;
         QSharedPointer<QOpenGLShaderProgram> m_shader;
+
+        // Compute passes write m_output as an image
+        // instead of drawing into it.
+        // m_groups is the number of work groups to dispatch,
+        // or empty to cover the output with groups of m_localSize.
+        bool m_compute{};
+        QSize m_groups;
+        QSize m_localSize;
     };
 
     QVector<Pass> m_passes;
 
     QSharedPointer<QOpenGLFramebufferObject> m_extra;
+
+    // Bookkeeping for nodes that don't render every frame.
+    // m_lastOutput is held and returned on skipped frames,
+    // and m_lastRenderTime is used to compute iStep
+    // across however many frames were skipped.
+    int m_frameCount{};
+    qreal m_lastRenderTime{};
+    GLuint m_lastOutput{};
+
+    // Ring of previous frames (outputs or inputs, see historySource),
+    // borrowed from the chain's pool.
+    // m_historyHead is the layer holding the newest frame.
+    QSharedPointer<QOpenGLTexture> m_history;
+    int m_historyHead{};
+
+    // Asynchronous readback of the input statistics.
+    // A new readback is only started
+    // once the fence of the previous one has signaled.
+    QOpenGLBuffer m_statisticsBuffer{QOpenGLBuffer::PixelPackBuffer};
+    GLsync m_statisticsFence{};
+};
+
+///////////////////////////////////////////////////////////////////////////////
+
+// The EffectNode parameters that are read while rendering.
+// Setters publish a new version of them
+// and paint() reads a consistent copy without taking any locks
+// (see EffectNode::parameters()),
+// so slider drags and MIDI floods never block rendering.
+// It must stay trivially copyable for that.
+struct EffectNodeParameters {
+    quint64 version{};
+    qreal intensity{};
+    double frequency{};
+    int updateDivisor{1};
+    double maxUpdateRate{};
+    int historyDepth{};
+    qreal historyScale{1};
+    bool historyOfInput{};
+    GLenum historyFormat{}; // 0 means the chain's render format
+    bool inputPyramid{};
+    bool inputStatistics{};
+
+    // Intensity is piecewise-constant between snapshots,
+    // so its integral over beats can be computed exactly.
+    // intensityIntegral is the integral up to integralBeat.
+    qreal intensityIntegral{};
+    qreal integralBeat{};
+
+    // Returns the number of beats from integralBeat to beatNow
+    qreal beatsSince(qreal beatNow) const;
+
+    // Returns the integral of intensity up to beatNow
+    qreal integralAt(qreal beatNow) const;
 };
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -43,6 +110,15 @@ class EffectNode
     Q_PROPERTY(QString file READ file WRITE setFile NOTIFY fileChanged)
     Q_PROPERTY(QString name READ name NOTIFY nameChanged)
     Q_PROPERTY(double frequency READ frequency WRITE setFrequency NOTIFY frequencyChanged)
+    Q_PROPERTY(int updateDivisor READ updateDivisor WRITE setUpdateDivisor NOTIFY updateDivisorChanged)
+    Q_PROPERTY(double maxUpdateRate READ maxUpdateRate WRITE setMaxUpdateRate NOTIFY maxUpdateRateChanged)
+    Q_PROPERTY(int historyDepth READ historyDepth WRITE setHistoryDepth NOTIFY historyDepthChanged)
+    Q_PROPERTY(qreal historyScale READ historyScale WRITE setHistoryScale NOTIFY historyScaleChanged)
+    Q_PROPERTY(QString historySource READ historySource WRITE setHistorySource NOTIFY historySourceChanged)
+    Q_PROPERTY(QString historyFormat READ historyFormat WRITE setHistoryFormat NOTIFY historyFormatChanged)
+    Q_PROPERTY(bool inputPyramid READ inputPyramid WRITE setInputPyramid NOTIFY inputPyramidChanged)
+    Q_PROPERTY(bool inputStatistics READ inputStatistics WRITE setInputStatistics NOTIFY inputStatisticsChanged)
+    Q_PROPERTY(QVariantMap statistics READ statistics NOTIFY statisticsChanged)
 
 public:
     EffectNode(Context *context);
@@ -52,6 +128,9 @@ public:
 
     static constexpr qreal MAX_INTEGRAL = 1024;
     static constexpr qreal FPS = 60;
+    static constexpr qreal INTEGRAL_REFRESH_BEATS = 16;
+    // The most memory that the history of one node on one chain may take
+    static constexpr qreal MAX_HISTORY_BYTES = 128 * 1024 * 1024;
 
     GLuint paint(QSharedPointer<Chain> chain, QVector<GLuint> inputTextures) override;
 
@@ -86,33 +165,138 @@ public slots:
     void setIntensity(qreal value);
     void setFile(QString file);
     void setFrequency(double frequency);
+
+    // Render this node only every Nth frame of a chain,
+    // holding the previous output in between.
+    // Nodes are staggered so that expensive nodes
+    // with the same divisor don't all render on the same frame.
+    // The default of 1 renders every frame.
+    int updateDivisor();
+    void setUpdateDivisor(int divisor);
+
+    // Render this node at most this many times per second
+    // on any given chain, holding the previous output in between.
+    // 0 means no limit.
+    double maxUpdateRate();
+    void setMaxUpdateRate(double rate);
+
+    // Keep this many previous frames
+    // in a texture array that shaders can read as iHistory.
+    // Effects declare this with e.g. "#property historyDepth 8".
+    // 0 (the default) keeps no history.
+    int historyDepth();
+    void setHistoryDepth(int depth);
+
+    // Resolution of the history frames,
+    // as a fraction of the chain size.
+    // It is lowered further if the history
+    // would take more than MAX_HISTORY_BYTES.
+    qreal historyScale();
+    void setHistoryScale(qreal scale);
+
+    // What the history holds:
+    // "output" (the default) keeps this node's previous outputs,
+    // the newest being last frame's,
+    // and "input" keeps its first input, the newest being this frame's.
+    QString historySource();
+    void setHistorySource(QString historySource);
+
+    // Texture format of the history frames:
+    // "render" (the default) for the chain's render format,
+    // or "rgba8", "rgb10a2" or "rgba16f"
+    // (e.g. rgba8 to keep a deep history small on an rgba16f chain.)
+    QString historyFormat();
+    void setHistoryFormat(QString historyFormat);
+
+    // Bind mipmapped copies of the inputs as iInputs,
+    // so that shaders can blur them with textureLod.
+    // The mipmaps come from the chain and are shared
+    // with any other node that blurs the same input.
+    // Effects declare this with "#property inputPyramid true".
+    bool inputPyramid();
+    void setInputPyramid(bool inputPyramid);
+
+    // Measure the first input on the GPU every frame
+    // (see Chain::statistics) and bind the result as iStats.
+    // Effects declare this with "#property inputStatistics true".
+    bool inputStatistics();
+    void setInputStatistics(bool inputStatistics);
+
+    // The most recent input statistics that made it back to the CPU,
+    // for meters and such. They lag the render by a frame or two.
+    // Keys are "mean" and "max" ([r, g, b, luminance]),
+    // "hue" (dominant hue in [0, 1))
+    // and "histogram" ({"r", "g", "b", "luminance"} lists of bin fractions.)
+    QVariantMap statistics();
+
     void reload();
 
 protected slots:
-    void onPeriodic();
+    void setStatistics(QVariantMap statistics);
     void chainsEdited(QList<QSharedPointer<Chain>> added, QList<QSharedPointer<Chain>> removed) override;
 
 protected:
     QString fileToName(QString file);
 
+    // Polls the previous readback of the statistics texture
+    // and starts a new one if it has finished
+    void readBackStatistics(QSharedPointer<EffectNodeRenderState> renderState, GLuint statistics);
+
+    // Returns a copy of the latest parameters.
+    // Never blocks: if a setter is publishing at that moment,
+    // it just reads them again.
+    EffectNodeParameters parameters() const;
+
+    // Publishes edit(current) as the new parameters.
+    // Setters are serialized with m_parametersLock.
+    // Returns false if edit returned false (i.e. nothing to change.)
+    bool editParameters(std::function<bool(EffectNodeParameters &)> edit);
+
+    // Same as editParameters, but returns false
+    // instead of waiting if a setter is publishing,
+    // so that paint() can use it
+    bool tryEditParameters(std::function<bool(EffectNodeParameters &)> edit);
+
+    // Stores the parameters. m_parametersLock must be held.
+    void storeParameters(const EffectNodeParameters &parameters);
+
     QMap<QSharedPointer<Chain>, QSharedPointer<EffectNodeRenderState>> m_renderStates;
-    qreal m_intensity{};
-    qreal m_intensityIntegral{};
-    qreal m_beatLast{};
-    qreal m_realTime{};
-    qreal m_realTimeLast{};
     QString m_file;
     QSharedPointer<EffectNodeOpenGLWorker> m_openGLWorker; // Not shared
-    QTimer m_periodic; // XXX do something better here
     bool m_ready{};
-    double m_frequency{};
+    // Whether the shader has texture lookups that mapToCanvas couldn't rewrite,
+    // and whether we've told the user about them
+    bool m_unmappedLookups{};
+    bool m_warnedUnmapped{};
+    int m_updatePhase{};
+    QVariantMap m_statistics;
+
+    // The parameters are kept in a seqlock:
+    // m_parametersSequence is odd while they are being stored,
+    // and readers retry if it was odd or changed while they read.
+    // They are stored as atomic words so that readers never race on plain memory.
+    static constexpr int PARAMETER_WORDS = (sizeof(EffectNodeParameters) + sizeof(quint32) - 1) / sizeof(quint32);
+    std::atomic<quint32> m_parametersSequence{};
+    std::atomic<quint32> m_parametersWords[PARAMETER_WORDS];
+    QMutex m_parametersLock;
+
     QVector<QSharedPointer<QOpenGLShaderProgram>> m_shaders;
+    QVector<QSize> m_computeGroups;
 
 signals:
     void intensityChanged(qreal value);
     void nameChanged(QString name);
     void fileChanged(QString file);
     void frequencyChanged(double frequency);
+    void updateDivisorChanged(int divisor);
+    void maxUpdateRateChanged(double rate);
+    void historyDepthChanged(int depth);
+    void historyScaleChanged(qreal scale);
+    void historySourceChanged(QString historySource);
+    void historyFormatChanged(QString historyFormat);
+    void inputPyramidChanged(bool inputPyramid);
+    void inputStatisticsChanged(bool inputStatistics);
+    void statisticsChanged(QVariantMap statistics);
 };
 
 typedef QmlSharedPointer<EffectNode, VideoNodeSP> EffectNodeSP;
@@ -2,6 +2,11 @@
 #include <QDebug>
 #include <QJsonObject>
 #include <QGuiApplication>
+#include <QOpenGLContext>
+#include <QOpenGLExtraFunctions>
+
+constexpr int FFmpegOutputNode::QUEUE_LENGTH;
+constexpr int FFmpegOutputNode::READBACK_COUNT;
 
 FFmpegOutputNode::FFmpegOutputNode(Context *context, QSize chainSize)
     : OutputNode(context, chainSize)
@@ -12,41 +17,67 @@ FFmpegOutputNode::FFmpegOutputNode(Context *context, QSize chainSize)
 
 FFmpegOutputNode::~FFmpegOutputNode() {
     setRecording(false);
-}
 
-void FFmpegOutputNode::setRecording(bool recording) {
-    QMutexLocker locker(&m_stateLock);
-    {
-        if (m_recording == recording)
-            return;
+    // Otherwise they go when the context does
+    if (m_readbackContext != nullptr && QOpenGLContext::currentContext() == m_readbackContext) {
+        auto gl = m_readbackContext->extraFunctions();
+        for (auto &readback : m_readbacks) {
+            if (readback.fence != 0) {
+                gl->glDeleteSync(readback.fence);
+            }
+            readback.buffer.destroy();
+        }
+        gl->glDeleteFramebuffers(1, &m_readbackFbo);
+        m_yuvFbo.clear();
+        m_yuvShader.clear();
+    }
+}
 
-        m_recording = recording;
+QJsonObject FFmpegOutputNode::serialize() {
+    QJsonObject o = OutputNode::serialize();
+    o.insert("pixelFormat", pixelFormat());
+    return o;
+}
 
-        if (recording) {
-            QSize size = chain()->size();
-            QString sizeStr(QString("%1x%2").arg(
-                        QString::number(size.width()),
-                        QString::number(size.height())));
+void FFmpegOutputNode::setRecording(bool recording) {
+    QSharedPointer<FFmpegOutputWriter> writer;
+    bool drain = false;
+    if (recording) {
+        auto size = chain()->size();
+        QMutexLocker locker(&m_stateLock);
+        if (m_recording) return;
+        m_recording = true;
 
-            m_pixelBuffer.resize(3 * size.width() * size.height());
+        // ffmpeg is started by the first frame,
+        // once it is known whether yuv420p can be used
+        writer = QSharedPointer<FFmpegOutputWriter>(new FFmpegOutputWriter(QUEUE_LENGTH, m_dropFrames), &FFmpegOutputWriter::release);
+        m_writer = writer;
+        m_frameSize = size;
+        m_framesQueued = 0;
+        m_framesDropped = 0;
+        m_encoderFrameRate = 0;
+    } else {
+        QMutexLocker locker(&m_stateLock);
+        if (!m_recording) return;
+        m_recording = false;
+        writer.swap(m_writer);
+        m_stoppedWriters.removeAll(QPointer<FFmpegOutputWriter>());
+        m_stoppedWriters.append(writer.data());
+        // Frames that are still being read back
+        // can only be picked up in their own context
+        drain = m_readbackContext != nullptr && QOpenGLContext::currentContext() == m_readbackContext;
+    }
 
-            m_ffmpeg.start("ffmpeg", QStringList() 
-                    << "-y"
-                    << "-vcodec" << "rawvideo"
-                    << "-f" << "rawvideo"
-                    << "-pix_fmt" << "rgb24"
-                    << "-s" << sizeStr
-                    << "-i" << "pipe:0"
-                    << "-vf" << "vflip"
-                    << m_ffmpegArguments);
-        } else {
-            m_ffmpeg.closeWriteChannel();
-            m_ffmpeg.waitForFinished();
-            //qInfo() << m_ffmpeg.readAllStandardOutput();
-            //qInfo() << m_ffmpeg.readAllStandardError();
+    if (!recording) {
+        if (drain) {
+            collectReadbacks(true);
         }
+        updateStatistics(writer, true);
+        // Lets ffmpeg finish in the background
+        writer.reset();
     }
     emit recordingChanged(recording);
+    emit statisticsChanged();
 }
 
 bool FFmpegOutputNode::recording() {
@@ -54,6 +85,19 @@ bool FFmpegOutputNode::recording() {
     return m_recording;
 }
 
+void FFmpegOutputNode::waitForStopped() {
+    QList<QPointer<FFmpegOutputWriter>> writers;
+    {
+        QMutexLocker locker(&m_stateLock);
+        writers.swap(m_stoppedWriters);
+    }
+    for (auto writer : writers) {
+        if (!writer.isNull()) {
+            writer->wait();
+        }
+    }
+}
+
 QStringList FFmpegOutputNode::ffmpegArguments() {
     QMutexLocker locker(&m_stateLock);
     return m_ffmpegArguments;
@@ -69,6 +113,76 @@ void FFmpegOutputNode::setFFmpegArguments(QStringList ffmpegArguments) {
     emit ffmpegArgumentsChanged(ffmpegArguments);
 }
 
+bool FFmpegOutputNode::dropFrames() {
+    QMutexLocker locker(&m_stateLock);
+    return m_dropFrames;
+}
+
+void FFmpegOutputNode::setDropFrames(bool dropFrames) {
+    {
+        QMutexLocker locker(&m_stateLock);
+        if (m_dropFrames == dropFrames) return;
+        m_dropFrames = dropFrames;
+        if (!m_writer.isNull()) {
+            m_writer->setDropFrames(dropFrames);
+        }
+    }
+    emit dropFramesChanged(dropFrames);
+}
+
+QString FFmpegOutputNode::pixelFormat() {
+    QMutexLocker locker(&m_stateLock);
+    return m_pixelFormat;
+}
+
+void FFmpegOutputNode::setPixelFormat(QString pixelFormat) {
+    if (pixelFormat != "rgb24" && pixelFormat != "yuv420p") {
+        qWarning() << "Unknown FFmpeg pixel format" << pixelFormat;
+        return;
+    }
+    {
+        QMutexLocker locker(&m_stateLock);
+        if (m_pixelFormat == pixelFormat) return;
+        m_pixelFormat = pixelFormat;
+    }
+    emit pixelFormatChanged(pixelFormat);
+}
+
+int FFmpegOutputNode::framesQueued() {
+    QMutexLocker locker(&m_stateLock);
+    return m_framesQueued;
+}
+
+int FFmpegOutputNode::framesDropped() {
+    QMutexLocker locker(&m_stateLock);
+    return m_framesDropped;
+}
+
+qreal FFmpegOutputNode::encoderFrameRate() {
+    QMutexLocker locker(&m_stateLock);
+    return m_encoderFrameRate;
+}
+
+void FFmpegOutputNode::updateStatistics(QSharedPointer<FFmpegOutputWriter> writer, bool force) {
+    if (writer.isNull()) return;
+    if (!force) {
+        // Only touched by recordFrame()
+        if (m_sinceStatistics.isValid() && m_sinceStatistics.elapsed() < 250) return;
+        m_sinceStatistics.start();
+    }
+
+    auto statistics = writer->statistics();
+    {
+        QMutexLocker locker(&m_stateLock);
+        m_framesQueued = statistics.queued;
+        m_framesDropped = statistics.dropped;
+        m_encoderFrameRate = statistics.frameRate;
+    }
+    if (!force) {
+        emit statisticsChanged();
+    }
+}
+
 QString FFmpegOutputNode::typeName() {
     return "FFmpegOutputNode";
 }
@@ -76,7 +190,12 @@ QString FFmpegOutputNode::typeName() {
 VideoNodeSP *FFmpegOutputNode::deserialize(Context *context, QJsonObject obj) {
     // TODO: You should be able to change the size of an OutputNode after
     // it has been created. For now this is hard-coded
-    return new FFmpegOutputNodeSP(new FFmpegOutputNode(context, QSize(128, 128)));
+    auto node = new FFmpegOutputNodeSP(new FFmpegOutputNode(context, QSize(128, 128)));
+    if (obj.contains("pixelFormat")) {
+        (*node)->setPixelFormat(obj.value("pixelFormat").toString());
+    }
+    (*node)->deserializeSettings(obj);
+    return node;
 }
 
 bool FFmpegOutputNode::canCreateFromFile(QString filename) {
@@ -93,14 +212,447 @@ QMap<QString, QString> FFmpegOutputNode::customInstantiators() {
     return m;
 }
 
+bool FFmpegOutputNode::drawsTiles() {
+    return true;
+}
+
 void FFmpegOutputNode::recordFrame() {
-    GLuint texture = render();
+    // Tiles stay valid until they are rendered again,
+    // so they are all read back once every one is done
+    QVector<RenderedTile> tiles;
+    renderTiles([&tiles](GLuint texture, QRect tileRect, QRect interior) {
+        if (texture == 0) return;
+        tiles.append(RenderedTile{texture, tileRect, interior});
+    });
+    auto chainSize = chain()->size();
+
+    QSharedPointer<FFmpegOutputWriter> writer;
+    QSize size;
+    QString pixelFormat;
+    QStringList ffmpegArguments;
     {
         QMutexLocker locker(&m_stateLock);
-        if (!m_recording)
+        if (m_readbackContext == nullptr) {
+            m_readbackContext = QOpenGLContext::currentContext();
+        } else if (m_readbackContext != QOpenGLContext::currentContext()) {
+            qWarning() << "FFmpegOutputNode frames must all be recorded in the same context";
             return;
-        glBindTexture(GL_TEXTURE_2D, texture);
-        glGetTexImage(GL_TEXTURE_2D, 0, GL_RGB, GL_UNSIGNED_BYTE, m_pixelBuffer.data()); // XXX UNSAFE
-        m_ffmpeg.write(m_pixelBuffer);
+        }
+        writer = m_writer;
+        size = m_frameSize;
+        pixelFormat = m_pixelFormat;
+        ffmpegArguments = m_ffmpegArguments;
+    }
+
+    auto gl = QOpenGLContext::currentContext()->extraFunctions();
+    if (m_readbackFbo == 0) {
+        gl->glGenFramebuffers(1, &m_readbackFbo);
+        for (auto &readback : m_readbacks) {
+            readback.buffer.create();
+            readback.buffer.setUsagePattern(QOpenGLBuffer::StreamRead);
+        }
+    }
+
+    collectReadbacks(false);
+    updateStatistics(writer, false);
+    if (writer.isNull()) return;
+    // Nothing to show
+    if (tiles.isEmpty()) return;
+    auto tiled = tiles.count() > 1 || tiles.first().interior.size() != chainSize;
+
+    if (chainSize != size) {
+        // ffmpeg was told the frame size when it started
+        qWarning() << "FFmpegOutputNode chain was resized from" << size << "to" << chainSize << "while recording, stopping";
+        setRecording(false);
+        return;
     }
+
+    if (!writer->started()) {
+        if (pixelFormat == "yuv420p" && tiled) {
+            qWarning() << "Can't convert tiled frames to yuv420p on the GPU, recording rgb24 instead";
+            pixelFormat = "rgb24";
+        } else if (pixelFormat == "yuv420p" && !prepareYuv(size)) {
+            qWarning() << "Can't convert" << size << "frames to yuv420p on the GPU, recording rgb24 instead";
+            pixelFormat = "rgb24";
+        }
+        QString sizeStr(QString("%1x%2").arg(
+                    QString::number(size.width()),
+                    QString::number(size.height())));
+        auto arguments = QStringList()
+                << "-y"
+                << "-vcodec" << "rawvideo"
+                << "-f" << "rawvideo"
+                << "-pix_fmt" << pixelFormat
+                << "-s" << sizeStr
+                << "-i" << "pipe:0";
+        // yuv420p frames were flipped by the shader
+        if (pixelFormat == "rgb24") {
+            arguments << "-vf" << "vflip";
+        }
+        writer->begin(pixelFormat, arguments + ffmpegArguments);
+    }
+    auto yuv = writer->pixelFormat() == "yuv420p";
+    if (yuv && tiled) {
+        qWarning() << "FFmpegOutputNode was tiled while recording yuv420p, stopping";
+        setRecording(false);
+        return;
+    }
+
+    auto &readback = m_readbacks[m_nextReadback];
+    if (readback.fence != 0) {
+        // The GPU is READBACK_COUNT frames behind
+        finishReadback(readback);
+    }
+    m_nextReadback = (m_nextReadback + 1) % READBACK_COUNT;
+
+    GLint previousFbo{};
+    gl->glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFbo);
+
+    int bytes;
+    if (yuv) {
+        GLint previousViewport[4];
+        gl->glGetIntegerv(GL_VIEWPORT, previousViewport);
+        gl->glDisable(GL_DEPTH_TEST);
+        gl->glDisable(GL_BLEND);
+
+        m_yuvFbo->bind();
+        gl->glViewport(0, 0, m_yuvFbo->width(), m_yuvFbo->height());
+        m_yuvShader->bind();
+        gl->glActiveTexture(GL_TEXTURE0);
+        gl->glBindTexture(GL_TEXTURE_2D, tiles.first().texture);
+        m_yuvShader->setUniformValue("iFrame", 0);
+        gl->glUniform2i(m_yuvShader->uniformLocation("iSize"), size.width(), size.height());
+
+        auto vao = chain()->vao();
+        vao->bind();
+        gl->glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+        vao->release();
+        m_yuvShader->release();
+
+        bytes = m_yuvFbo->width() * m_yuvFbo->height();
+        readback.buffer.bind();
+        if (readback.buffer.size() != bytes) {
+            readback.buffer.allocate(bytes);
+        }
+        gl->glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        gl->glReadPixels(0, 0, m_yuvFbo->width(), m_yuvFbo->height(), GL_RED, GL_UNSIGNED_BYTE, nullptr);
+        gl->glPixelStorei(GL_PACK_ALIGNMENT, 4);
+        readback.buffer.release();
+
+        gl->glViewport(previousViewport[0], previousViewport[1], previousViewport[2], previousViewport[3]);
+    } else {
+        gl->glBindFramebuffer(GL_FRAMEBUFFER, m_readbackFbo);
+
+        bytes = 3 * size.width() * size.height();
+        readback.buffer.bind();
+        if (readback.buffer.size() != bytes) {
+            readback.buffer.allocate(bytes);
+        }
+        gl->glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        gl->glPixelStorei(GL_PACK_ROW_LENGTH, size.width());
+        // Each tile's interior goes straight to its place in the frame
+        for (auto &tile : tiles) {
+            gl->glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tile.texture, 0);
+            gl->glPixelStorei(GL_PACK_SKIP_PIXELS, tile.interior.x());
+            gl->glPixelStorei(GL_PACK_SKIP_ROWS, tile.interior.y());
+            gl->glReadPixels(tile.interior.x() - tile.tileRect.x(), tile.interior.y() - tile.tileRect.y(),
+                             tile.interior.width(), tile.interior.height(), GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+        }
+        gl->glPixelStorei(GL_PACK_SKIP_PIXELS, 0);
+        gl->glPixelStorei(GL_PACK_SKIP_ROWS, 0);
+        gl->glPixelStorei(GL_PACK_ROW_LENGTH, 0);
+        gl->glPixelStorei(GL_PACK_ALIGNMENT, 4);
+        readback.buffer.release();
+
+        gl->glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
+    }
+    gl->glBindFramebuffer(GL_FRAMEBUFFER, previousFbo);
+
+    readback.fence = gl->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    readback.bytes = bytes;
+    readback.writer = writer;
+    gl->glFlush();
+}
+
+void FFmpegOutputNode::collectReadbacks(bool wait) {
+    auto gl = QOpenGLContext::currentContext()->extraFunctions();
+    for (int i = 0; i < READBACK_COUNT; i++) {
+        auto &readback = m_readbacks[(m_nextReadback + i) % READBACK_COUNT];
+        if (readback.fence == 0) continue;
+        if (!wait && gl->glClientWaitSync(readback.fence, 0, 0) == GL_TIMEOUT_EXPIRED) break;
+        finishReadback(readback);
+    }
+}
+
+void FFmpegOutputNode::finishReadback(Readback &readback) {
+    auto gl = QOpenGLContext::currentContext()->extraFunctions();
+
+    // Waits if the GPU isn't done yet
+    gl->glClientWaitSync(readback.fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+    gl->glDeleteSync(readback.fence);
+    readback.fence = 0;
+
+    auto writer = readback.writer.toStrongRef();
+    readback.writer.clear();
+    if (writer.isNull()) return; // The recording was stopped
+
+    auto bytes = readback.bytes;
+    readback.buffer.bind();
+    auto mapped = (const char *)gl->glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes, GL_MAP_READ_BIT);
+    if (mapped == nullptr) {
+        qWarning() << "Could not map FFmpeg readback buffer";
+        readback.buffer.release();
+        return;
+    }
+    QByteArray frame(mapped, bytes);
+    gl->glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    readback.buffer.release();
+
+    writer->push(frame);
+}
+
+bool FFmpegOutputNode::prepareYuv(QSize size) {
+    // Every 2x2 block of pixels shares its U and V
+    if (size.width() % 2 != 0 || size.height() % 2 != 0) return false;
+
+    if (m_yuvShader.isNull()) {
+        if (m_yuvShaderFailed) return false;
+        m_yuvShader = loadYuvShader();
+        if (m_yuvShader.isNull()) {
+            m_yuvShaderFailed = true;
+            return false;
+        }
+    }
+
+    // Y is width x height bytes, and U and V are a quarter of that each
+    auto fboSize = QSize(size.width(), size.height() * 3 / 2);
+    if (m_yuvFbo.isNull() || m_yuvFbo->size() != fboSize) {
+        auto fmt = QOpenGLFramebufferObjectFormat{};
+        fmt.setInternalTextureFormat(GL_R8);
+        m_yuvFbo = QSharedPointer<QOpenGLFramebufferObject>::create(fboSize, fmt);
+    }
+    return true;
+}
+
+QSharedPointer<QOpenGLShaderProgram> FFmpegOutputNode::loadYuvShader() {
+    auto vertexString = QString{
+        "#version 150\n"
+        "const vec2 varray[4] = vec2[](vec2(1., 1.),vec2(1., -1.),vec2(-1., 1.),vec2(-1., -1.));\n"
+        "void main() {\n"
+        "    vec2 vertex = varray[gl_VertexID];\n"
+        "    gl_Position = vec4(vertex,0.,1.);\n"
+        "}\n"};
+    // Each texel is one byte of a yuv420p frame:
+    // the Y plane, then the U plane, then the V plane,
+    // each with the top row first.
+    // The coefficients are BT.601 limited range,
+    // which is what ffmpeg used when converting rgb24 itself.
+    auto fragmentString = QString{
+        "#version 150\n"
+        "uniform sampler2D iFrame;\n"
+        "uniform ivec2 iSize;\n"
+        "out vec4 fragColor;\n"
+        "\n"
+        "vec3 rgb(int x, int y) {\n"
+        "    return texelFetch(iFrame, ivec2(x, iSize.y - 1 - y), 0).rgb;\n"
+        "}\n"
+        "\n"
+        "void main() {\n"
+        "    int width = iSize.x;\n"
+        "    int i = int(gl_FragCoord.y) * width + int(gl_FragCoord.x);\n"
+        "    int lumaBytes = width * iSize.y;\n"
+        "    if (i < lumaBytes) {\n"
+        "        vec3 c = rgb(i % width, i / width);\n"
+        "        fragColor = vec4((16. + dot(c, vec3(65.481, 128.553, 24.966))) / 255.);\n"
+        "        return;\n"
+        "    }\n"
+        "    int chromaWidth = width / 2;\n"
+        "    int chromaBytes = chromaWidth * (iSize.y / 2);\n"
+        "    int j = i - lumaBytes;\n"
+        "    int k = j % chromaBytes;\n"
+        "    int x = 2 * (k % chromaWidth);\n"
+        "    int y = 2 * (k / chromaWidth);\n"
+        "    vec3 c = 0.25 * (rgb(x, y) + rgb(x + 1, y) + rgb(x, y + 1) + rgb(x + 1, y + 1));\n"
+        "    float value = j < chromaBytes\n"
+        "        ? dot(c, vec3(-37.797, -74.203, 112.))\n"
+        "        : dot(c, vec3(112., -93.786, -18.214));\n"
+        "    fragColor = vec4((128. + value) / 255.);\n"
+        "}\n"};
+
+    auto shader = QSharedPointer<QOpenGLShaderProgram>(new QOpenGLShaderProgram());
+
+    if (!shader->addShaderFromSourceCode(QOpenGLShader::Vertex, vertexString)) {
+        qWarning() << "Could not compile FFmpeg yuv420p vertex shader";
+        return nullptr;
+    }
+    if (!shader->addShaderFromSourceCode(QOpenGLShader::Fragment, fragmentString)) {
+        qWarning() << "Could not compile FFmpeg yuv420p fragment shader";
+        return nullptr;
+    }
+    if (!shader->link()) {
+        qWarning() << "Could not link FFmpeg yuv420p shader program";
+        return nullptr;
+    }
+
+    return shader;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+FFmpegOutputWriter::FFmpegOutputWriter(int queueLength, bool dropFrames)
+    : m_queueLength(queueLength)
+    , m_dropFrames(dropFrames) {
+    setObjectName("FFmpegOutputWriter");
+}
+
+void FFmpegOutputWriter::release(FFmpegOutputWriter *writer) {
+    connect(writer, &QThread::finished, writer, &QObject::deleteLater);
+    bool started;
+    bool done;
+    {
+        QMutexLocker locker(&writer->m_lock);
+        writer->m_closing = true;
+        writer->m_queueChanged.wakeAll();
+        started = writer->m_started;
+        done = writer->m_done;
+    }
+    if (!started) {
+        // The thread never ran, so finished will never come
+        writer->deleteLater();
+    } else if (done) {
+        // run() is over or about to return, but finished may have been
+        // emitted before the connection above.
+        // Deleting a QThread that is still running is fatal,
+        // so make sure that it has returned.
+        // deleteLater is safe to call twice.
+        writer->wait();
+        writer->deleteLater();
+    }
+    // Otherwise, finished deletes it once ffmpeg is done
+}
+
+void FFmpegOutputWriter::begin(QString pixelFormat, QStringList arguments) {
+    {
+        QMutexLocker locker(&m_lock);
+        if (m_started) return;
+        m_started = true;
+        m_pixelFormat = pixelFormat;
+        m_arguments = arguments;
+    }
+    start();
+}
+
+bool FFmpegOutputWriter::started() {
+    QMutexLocker locker(&m_lock);
+    return m_started;
+}
+
+QString FFmpegOutputWriter::pixelFormat() {
+    QMutexLocker locker(&m_lock);
+    return m_pixelFormat;
+}
+
+bool FFmpegOutputWriter::push(QByteArray frame) {
+    QMutexLocker locker(&m_lock);
+    while (!m_dropFrames && !m_failed && m_queue.count() >= m_queueLength) {
+        m_queueChanged.wait(&m_lock);
+    }
+    if (m_failed || m_queue.count() >= m_queueLength) {
+        m_statistics.dropped++;
+        return false;
+    }
+    m_queue.enqueue(frame);
+    m_statistics.queued = m_queue.count();
+    m_queueChanged.wakeAll();
+    return true;
+}
+
+void FFmpegOutputWriter::setDropFrames(bool dropFrames) {
+    QMutexLocker locker(&m_lock);
+    m_dropFrames = dropFrames;
+    m_queueChanged.wakeAll();
+}
+
+FFmpegOutputWriter::Statistics FFmpegOutputWriter::statistics() {
+    QMutexLocker locker(&m_lock);
+    return m_statistics;
+}
+
+void FFmpegOutputWriter::fail() {
+    QMutexLocker locker(&m_lock);
+    m_failed = true;
+    m_statistics.dropped += m_queue.count();
+    m_queue.clear();
+    m_statistics.queued = 0;
+    m_statistics.frameRate = 0;
+    m_queueChanged.wakeAll();
+}
+
+void FFmpegOutputWriter::run() {
+    QStringList arguments;
+    {
+        QMutexLocker locker(&m_lock);
+        arguments = m_arguments;
+    }
+
+    // Created here so that it belongs to this thread.
+    // ffmpeg's own messages go to our stderr.
+    QProcess ffmpeg;
+    ffmpeg.setProcessChannelMode(QProcess::ForwardedErrorChannel);
+    ffmpeg.setStandardOutputFile(QProcess::nullDevice());
+    ffmpeg.start("ffmpeg", arguments);
+    if (!ffmpeg.waitForStarted(-1)) {
+        qWarning() << "Could not start ffmpeg:" << ffmpeg.errorString();
+        fail();
+        finish();
+        return;
+    }
+
+    QElapsedTimer sinceRate;
+    sinceRate.start();
+    int framesSinceRate = 0;
+
+    forever {
+        QByteArray frame;
+        {
+            QMutexLocker locker(&m_lock);
+            while (m_queue.isEmpty() && !m_closing) {
+                m_queueChanged.wait(&m_lock);
+            }
+            // Only stop once everything queued is written
+            if (m_queue.isEmpty()) break;
+            frame = m_queue.dequeue();
+            m_statistics.queued = m_queue.count();
+            m_queueChanged.wakeAll();
+        }
+
+        ffmpeg.write(frame);
+        while (ffmpeg.bytesToWrite() > 0) {
+            if (!ffmpeg.waitForBytesWritten(-1)) break;
+        }
+        if (ffmpeg.bytesToWrite() > 0) {
+            qWarning() << "ffmpeg stopped taking frames:" << ffmpeg.errorString();
+            fail();
+            break;
+        }
+
+        framesSinceRate++;
+        if (sinceRate.elapsed() >= 1000) {
+            QMutexLocker locker(&m_lock);
+            m_statistics.frameRate = framesSinceRate * 1000. / sinceRate.restart();
+            framesSinceRate = 0;
+        }
+    }
+
+    ffmpeg.closeWriteChannel();
+    ffmpeg.waitForFinished(-1);
+    if (ffmpeg.exitStatus() != QProcess::NormalExit || ffmpeg.exitCode() != 0) {
+        qWarning() << "ffmpeg exited with code" << ffmpeg.exitCode();
+    }
+    finish();
+}
+
+void FFmpegOutputWriter::finish() {
+    QMutexLocker locker(&m_lock);
+    m_done = true;
 }
@@ -2,18 +2,61 @@
 
 #include "OutputNode.h"
 #include "OutputWindow.h"
+#include <QElapsedTimer>
+#include <QOpenGLBuffer>
+#include <QOpenGLFramebufferObject>
+#include <QOpenGLShaderProgram>
+#include <QPointer>
 #include <QProcess>
+#include <QQueue>
+#include <QThread>
+#include <QWaitCondition>
+
+class FFmpegOutputWriter;
+
+// Pipes frames to an ffmpeg process.
+//
+// recordFrame() renders the model and starts reading it back
+// into one of a few pixel buffers, without waiting for it.
+// The frame is picked up by a later call once the GPU is done,
+// and handed to a writer thread that feeds ffmpeg.
+// So neither the GPU nor ffmpeg can hold up whoever calls recordFrame(),
+// unless dropFrames is turned off and ffmpeg falls behind.
+//
+// Stopping a recording doesn't wait for ffmpeg to finish the file;
+// the writer thread does that on its own.
+//
+// Frames are piped as rgb24 by default, leaving ffmpeg to flip
+// and convert them. With pixelFormat set to yuv420p,
+// a shader does both on the GPU instead,
+// so half as many bytes are read back and piped
+// and ffmpeg does no pixel conversion.
+// yuv420p needs an even width and height, and an untiled output;
+// otherwise the recording falls back to rgb24.
+// Tiled outputs are read back a tile at a time
+// into their places in the frame.
+//
+// The chain must keep its size while recording
+// (so dynamic resolution should be off);
+// if it is resized, the recording stops.
 
 class FFmpegOutputNode
     : public OutputNode {
     Q_OBJECT
     Q_PROPERTY(bool recording READ recording WRITE setRecording NOTIFY recordingChanged);
     Q_PROPERTY(QStringList ffmpegArguments READ ffmpegArguments WRITE setFFmpegArguments NOTIFY ffmpegArgumentsChanged);
+    Q_PROPERTY(bool dropFrames READ dropFrames WRITE setDropFrames NOTIFY dropFramesChanged);
+    Q_PROPERTY(QString pixelFormat READ pixelFormat WRITE setPixelFormat NOTIFY pixelFormatChanged);
+    Q_PROPERTY(int framesQueued READ framesQueued NOTIFY statisticsChanged);
+    Q_PROPERTY(int framesDropped READ framesDropped NOTIFY statisticsChanged);
+    Q_PROPERTY(qreal encoderFrameRate READ encoderFrameRate NOTIFY statisticsChanged);
 
 public:
     FFmpegOutputNode(Context *context, QSize chainSize);
     ~FFmpegOutputNode();
 
+    QJsonObject serialize() override;
+
     // These static methods are required for VideoNode creation
     // through the registry
 
@@ -37,24 +80,173 @@ public:
     // to instantiate custom instances of this VideoNode
     static QMap<QString, QString> customInstantiators();
 
+    // Renders a frame and sends it to ffmpeg.
+    // Must be called with the same OpenGL context current every time.
     void recordFrame();
 
+    // Waits until ffmpeg has exited for every recording that was stopped.
+    // Call this from the thread that started them
+    // before quitting, so that the files are complete.
+    void waitForStopped();
+
+    // Frames that may wait for ffmpeg before dropFrames kicks in
+    static constexpr int QUEUE_LENGTH = 8;
+    // Readbacks in flight
+    static constexpr int READBACK_COUNT = 3;
+
 public slots:
     bool recording();
     void setRecording(bool recording);
     QStringList ffmpegArguments();
     void setFFmpegArguments(QStringList ffmpegArguments);
 
+    // When ffmpeg can't keep up,
+    // drop frames (the default) instead of waiting for it
+    bool dropFrames();
+    void setDropFrames(bool dropFrames);
+
+    // "rgb24" or "yuv420p".
+    // Takes effect when the next recording starts.
+    QString pixelFormat();
+    void setPixelFormat(QString pixelFormat);
+
+    // Statistics of the current recording,
+    // or of the last one if none is going.
+    // Updated a few times a second.
+    int framesQueued();
+    int framesDropped();
+    qreal encoderFrameRate();
+
 signals:
     void recordingChanged(bool recording);
     void ffmpegArgumentsChanged(QStringList ffmpegArguments);
+    void dropFramesChanged(bool dropFrames);
+    void pixelFormatChanged(QString pixelFormat);
+    void statisticsChanged();
 
 protected:
+    struct Readback {
+        QOpenGLBuffer buffer{QOpenGLBuffer::PixelPackBuffer};
+        GLsync fence{};
+        int bytes{};
+        // Who the frame is for.
+        // If the recording stopped in the meantime,
+        // the frame is thrown away.
+        QWeakPointer<FFmpegOutputWriter> writer;
+    };
+
+    bool drawsTiles() override;
+
+    // A rendered tile, in chain pixels
+    struct RenderedTile {
+        GLuint texture;
+        QRect tileRect;
+        QRect interior;
+    };
+
+    // Hands finished readbacks to their writers, oldest first.
+    // If wait is true, waits for all of them.
+    void collectReadbacks(bool wait);
+    // Waits for the readback and hands it to its writer
+    void finishReadback(Readback &readback);
+    void updateStatistics(QSharedPointer<FFmpegOutputWriter> writer, bool force);
+
+    // Gets the conversion to yuv420p ready for frames of the given size.
+    // Returns false if it can't be done.
+    bool prepareYuv(QSize size);
+    static QSharedPointer<QOpenGLShaderProgram> loadYuvShader();
+
     bool m_recording;
     QStringList m_ffmpegArguments;
-    QProcess m_ffmpeg;
-    QByteArray m_pixelBuffer;
+    bool m_dropFrames{true};
+    QString m_pixelFormat{"rgb24"};
+    QSize m_frameSize;
+    QSharedPointer<FFmpegOutputWriter> m_writer;
+    QList<QPointer<FFmpegOutputWriter>> m_stoppedWriters;
+    QOpenGLContext *m_readbackContext{};
+    int m_framesQueued{};
+    int m_framesDropped{};
+    qreal m_encoderFrameRate{};
+
+    // Only touched with m_readbackContext current
+    GLuint m_readbackFbo{};
+    Readback m_readbacks[READBACK_COUNT];
+    // The oldest readback, which is also the next to be reused
+    int m_nextReadback{};
+    QSharedPointer<QOpenGLShaderProgram> m_yuvShader;
+    bool m_yuvShaderFailed{};
+    // The Y, U and V planes end to end,
+    // one byte per texel, in rows as wide as the frame
+    QSharedPointer<QOpenGLFramebufferObject> m_yuvFbo;
+    QElapsedTimer m_sinceStatistics;
 };
 
 typedef QmlSharedPointer<FFmpegOutputNode, OutputNodeSP> FFmpegOutputNodeSP;
 Q_DECLARE_METATYPE(FFmpegOutputNodeSP*)
+
+///////////////////////////////////////////////////////////////////////////////
+
+// Feeds frames to one ffmpeg process from its own thread.
+// Every public method is thread-safe.
+//
+// Create it with release() as the QSharedPointer deleter:
+// when the last reference goes away,
+// ffmpeg is sent whatever is still queued and told to finish,
+// and the writer deletes itself once it has exited.
+// ffmpeg isn't started until begin() is called.
+
+class FFmpegOutputWriter : public QThread {
+    Q_OBJECT
+
+public:
+    FFmpegOutputWriter(int queueLength, bool dropFrames);
+
+    static void release(FFmpegOutputWriter *writer);
+
+    // Starts ffmpeg with the given arguments,
+    // for frames in the given pixel format
+    void begin(QString pixelFormat, QStringList arguments);
+    bool started();
+    QString pixelFormat();
+
+    // Queues a frame for ffmpeg.
+    // If the queue is full, the frame is dropped,
+    // or, with dropFrames off, this waits for room.
+    // Returns false if the frame was dropped.
+    bool push(QByteArray frame);
+
+    void setDropFrames(bool dropFrames);
+
+    struct Statistics {
+        int queued{};
+        int dropped{};
+        // Frames per second that ffmpeg took, over the last second or so
+        qreal frameRate{};
+    };
+    Statistics statistics();
+
+protected:
+    void run() override;
+    // Stops taking frames after ffmpeg went away
+    void fail();
+    // Marks run() as over
+    void finish();
+
+    int m_queueLength{};
+
+    QMutex m_lock;
+    // Please take the lock when
+    // editing or using any of these:
+    QWaitCondition m_queueChanged;
+    QQueue<QByteArray> m_queue;
+    bool m_dropFrames{};
+    bool m_closing{};
+    bool m_failed{};
+    bool m_started{};
+    // run() is over
+    bool m_done{};
+    QString m_pixelFormat;
+    QStringList m_arguments;
+    Statistics m_statistics;
+    // end
+};
@@ -68,6 +68,14 @@ void ImageNode::setFile(QString file) {
 }
 
 GLuint ImageNode::paint(QSharedPointer<Chain> chain, QVector<GLuint> inputTextures) {
+    // Images cover the whole canvas,
+    // so a tiled chain only gets its part of them
+    auto texture = frameTexture();
+    if (texture == 0) return 0;
+    return chain->tileOf(texture);
+}
+
+GLuint ImageNode::frameTexture() {
     int totalDelay;
     QVector<int> frameDelays;
     QVector<QSharedPointer<QOpenGLTexture>> frameTextures;
@@ -62,6 +62,10 @@ private:
     QString fileToName();
 
 protected:
+    // The texture of the frame to show right now,
+    // or 0 if there is none
+    GLuint frameTexture();
+
     QString m_file;
 
     // This is not actually shared,
@@ -0,0 +1,340 @@
+#include "LightOutputHub.h"
+#include "LightOutputNode.h"
+#include <QCoreApplication>
+#include <QDebug>
+#include <QOpenGLExtraFunctions>
+#include <QThread>
+
+QMutex LightOutputHub::s_lock;
+QMap<QString, QWeakPointer<LightOutputHub>> LightOutputHub::s_hubs;
+
+LightOutputHub::LightOutputHub(QString name, OpenGLWorkerContext *context)
+    : OpenGLWorker(context)
+    , m_name(name)
+    , m_context(context)
+    , m_chain(new Chain(QSize(1, 1)), &QObject::deleteLater)
+{
+    m_chain->moveToWorkerContext(context);
+}
+
+LightOutputHub::~LightOutputHub() {
+    {
+        QMutexLocker locker(&s_lock);
+        // Don't remove a newer hub with the same name
+        if (s_hubs.value(m_name).isNull()) {
+            s_hubs.remove(m_name);
+        }
+    }
+
+    makeCurrent();
+    if (m_readbackFence != 0) {
+        QOpenGLContext::currentContext()->extraFunctions()->glDeleteSync(m_readbackFence);
+    }
+    m_chain->releaseContextResources();
+    for (auto chain : m_retiredChains) {
+        chain->releaseContextResources();
+    }
+    m_readbackBuffer.destroy();
+    // m_sampler frees its objects while the context is still current
+}
+
+QSharedPointer<LightOutputHub> LightOutputHub::get(QString name) {
+    Q_ASSERT(QThread::currentThread() == qApp->thread());
+    QMutexLocker locker(&s_lock);
+    auto existing = s_hubs.value(name).toStrongRef();
+    if (!existing.isNull()) return existing;
+
+    auto context = new OpenGLWorkerContext();
+    auto hub = QSharedPointer<LightOutputHub>(new LightOutputHub(name, context), &QObject::deleteLater);
+    connect(hub.data(), &QObject::destroyed, context, &QObject::deleteLater);
+    s_hubs.insert(name, hub);
+
+    auto result = QMetaObject::invokeMethod(hub.data(), "initialize", Qt::QueuedConnection);
+    Q_ASSERT(result);
+    return hub;
+}
+
+QString LightOutputHub::name() const {
+    return m_name;
+}
+
+QSharedPointer<Chain> LightOutputHub::chain() {
+    QMutexLocker locker(&m_lock);
+    return m_chain;
+}
+
+void LightOutputHub::setMember(QSharedPointer<LightOutputNode> node, QSize size) {
+    QSharedPointer<Chain> newChain;
+    {
+        QMutexLocker locker(&m_lock);
+        auto &member = m_members[node.data()];
+        member.node = node;
+        if (size == member.size) return;
+        member.size = size;
+        newChain = resize();
+    }
+    if (!newChain.isNull()) emit chainChanged(newChain);
+}
+
+void LightOutputHub::removeMember(LightOutputNode *node) {
+    QSharedPointer<Chain> newChain;
+    {
+        QMutexLocker locker(&m_lock);
+        if (m_members.remove(node) == 0) return;
+        m_layoutChanged = true;
+        newChain = resize();
+    }
+    if (!newChain.isNull()) emit chainChanged(newChain);
+    QMetaObject::invokeMethod(this, "updateTimer", Qt::QueuedConnection);
+}
+
+QSharedPointer<Chain> LightOutputHub::resize() {
+    QSize size(1, 1);
+    for (auto &member : m_members) {
+        size = size.expandedTo(member.size);
+    }
+    if (size == m_chain->size()) return QSharedPointer<Chain>();
+
+    // The old chain's objects are freed
+    // at the start of the next frame
+    m_retiredChains.append(m_chain);
+    m_chain = QSharedPointer<Chain>(new Chain(m_chain.data(), size), &QObject::deleteLater);
+    return m_chain;
+}
+
+void LightOutputHub::setSlice(LightOutputNode *node, LightOutputSampler::Slice slice) {
+    QMutexLocker locker(&m_lock);
+    if (!m_members.contains(node)) return;
+    m_members[node].slice = slice;
+    m_layoutChanged = true;
+}
+
+void LightOutputHub::setPeriod(LightOutputNode *node, int msec) {
+    {
+        QMutexLocker locker(&m_lock);
+        if (!m_members.contains(node)) return;
+        auto &member = m_members[node];
+        if (msec == member.period) return;
+        member.period = msec;
+    }
+    QMetaObject::invokeMethod(this, "updateTimer", Qt::QueuedConnection);
+}
+
+void LightOutputHub::requestFrame(LightOutputNode *node) {
+    QMutexLocker locker(&m_lock);
+    if (!m_members.contains(node)) return;
+    m_members[node].requested = true;
+    scheduleRender();
+}
+
+void LightOutputHub::scheduleRender() {
+    if (m_renderScheduled) return;
+    m_renderScheduled = true;
+    QMetaObject::invokeMethod(this, "render", Qt::QueuedConnection);
+}
+
+void LightOutputHub::initialize() {
+    Q_ASSERT(QThread::currentThread() == thread());
+
+    m_timer = new QTimer(this);
+    connect(m_timer, &QTimer::timeout, this, &LightOutputHub::render);
+    // Readbacks usually land well within a millisecond or two
+    m_pollTimer = new QTimer(this);
+    m_pollTimer->setInterval(1);
+    connect(m_pollTimer, &QTimer::timeout, this, &LightOutputHub::pollReadback);
+
+    makeCurrent();
+    m_readbackBuffer.create();
+    m_readbackBuffer.setUsagePattern(QOpenGLBuffer::StreamRead);
+}
+
+void LightOutputHub::updateTimer() {
+    Q_ASSERT(QThread::currentThread() == thread());
+    int period = 0;
+    {
+        QMutexLocker locker(&m_lock);
+        for (auto &member : m_members) {
+            if (member.period > 0 && (period == 0 || member.period < period)) {
+                period = member.period;
+            }
+        }
+    }
+    if (period == 0) {
+        m_timer->stop();
+        return;
+    }
+    m_timer->setInterval(period);
+    if (!m_timer->isActive()) m_timer->start();
+}
+
+void LightOutputHub::updateLayout() {
+    QList<LightOutputSampler::Slice> slices;
+    {
+        QMutexLocker locker(&m_lock);
+        for (auto &member : m_members) {
+            if (member.slice.lookupCoordinates.isEmpty()) {
+                member.sliceIndex = -1;
+                continue;
+            }
+            member.sliceIndex = slices.count();
+            slices.append(member.slice);
+        }
+    }
+    m_sampler.setSlices(slices);
+
+    m_readbackBuffer.bind();
+    m_readbackBuffer.allocate(m_sampler.readbackSize());
+    m_readbackBuffer.release();
+}
+
+void LightOutputHub::render() {
+    Q_ASSERT(QThread::currentThread() == thread());
+    if (m_timer == nullptr) return; // Not initialized yet
+    makeCurrent();
+    auto gl = QOpenGLContext::currentContext()->extraFunctions();
+
+    // The readback buffer is about to be reused
+    if (m_readbackFence != 0) {
+        finishReadback();
+    }
+
+    QSharedPointer<Chain> chain;
+    QList<QSharedPointer<Chain>> retiredChains;
+    bool layoutChanged;
+    {
+        QMutexLocker locker(&m_lock);
+        m_renderScheduled = false;
+        chain = m_chain;
+        retiredChains.swap(m_retiredChains);
+        layoutChanged = m_layoutChanged;
+        m_layoutChanged = false;
+    }
+    for (auto retired : retiredChains) {
+        retired->releaseContextResources();
+    }
+    if (layoutChanged) {
+        updateLayout();
+    }
+
+    // Periodic members are due a little early
+    // so that one running at the hub's own rate never skips a frame
+    auto slack = m_timer->isActive() ? m_timer->interval() / 2 : 0;
+    QList<Delivery> deliveries;
+    {
+        QMutexLocker locker(&m_lock);
+        for (auto &member : m_members) {
+            auto due = member.requested
+                    || (member.period > 0
+                     && (!member.sinceFrame.isValid() || member.sinceFrame.elapsed() >= member.period - slack));
+            if (!due) continue;
+            member.requested = false;
+            if (member.sliceIndex < 0) continue;
+            member.sinceFrame.start();
+            deliveries.append(Delivery{member.node, member.sliceIndex});
+        }
+    }
+    if (deliveries.isEmpty()) return;
+
+    // Members are normally all in the same model
+    QList<QSharedPointer<VideoNode>> nodes;
+    QWeakPointer<Model> model;
+    for (auto &delivery : deliveries) {
+        auto node = delivery.node.toStrongRef();
+        nodes.append(node);
+        if (!node.isNull() && model.isNull()) {
+            model = node->lastModel();
+        }
+    }
+    if (model.isNull()) return;
+
+    auto result = Model::createCopyForRendering(model).render(chain);
+
+    // Leave out members that have nothing to show
+    QVector<GLuint> textures;
+    for (int i = deliveries.count() - 1; i >= 0; i--) {
+        auto texture = nodes.at(i).isNull() ? 0 : result.value(nodes.at(i), 0);
+        if (texture == 0) {
+            deliveries.removeAt(i);
+        } else {
+            textures.prepend(texture);
+        }
+    }
+    if (deliveries.isEmpty()) return;
+
+    if (!m_sampler.begin()) return;
+
+    auto vao = chain->vao();
+    vao->bind();
+
+    // Neighboring members that show the same texture
+    // (normally all of them) are sampled by a single draw
+    int i = 0;
+    while (i < deliveries.count()) {
+        auto texture = textures.at(i);
+        auto first = deliveries.at(i).slice;
+        auto end = first + 1;
+        for (i++; i < deliveries.count(); i++) {
+            if (textures.at(i) != texture || deliveries.at(i).slice != end) break;
+            end++;
+        }
+        m_sampler.sample(texture, first, end);
+    }
+
+    // One readback for everybody
+    m_readbackBuffer.bind();
+    m_sampler.readPixels();
+    m_readbackBuffer.release();
+    vao->release();
+    m_readbackFence = gl->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    gl->glFlush();
+    m_deliveries = deliveries;
+
+    m_sampler.end();
+
+    m_pollTimer->start();
+}
+
+void LightOutputHub::pollReadback() {
+    if (m_readbackFence == 0) {
+        m_pollTimer->stop();
+        return;
+    }
+    makeCurrent();
+    auto status = QOpenGLContext::currentContext()->extraFunctions()->glClientWaitSync(m_readbackFence, 0, 0);
+    if (status == GL_TIMEOUT_EXPIRED) return;
+    finishReadback();
+    m_pollTimer->stop();
+}
+
+void LightOutputHub::finishReadback() {
+    auto gl = QOpenGLContext::currentContext()->extraFunctions();
+
+    // Waits if the GPU isn't done yet
+    gl->glClientWaitSync(m_readbackFence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+    gl->glDeleteSync(m_readbackFence);
+    m_readbackFence = 0;
+
+    m_readbackBuffer.bind();
+    auto size = m_sampler.readbackSize();
+    auto mapped = (const char *)gl->glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+    if (mapped == nullptr) {
+        qWarning() << "Could not map light output hub readback buffer";
+        m_readbackBuffer.release();
+        m_deliveries.clear();
+        return;
+    }
+    // One copy, which every member shares
+    QByteArray pixels(mapped, size);
+    gl->glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    m_readbackBuffer.release();
+
+    for (auto &delivery : m_deliveries) {
+        auto node = delivery.node.toStrongRef();
+        if (node.isNull()) continue; // LightOutputNode was deleted
+        QMetaObject::invokeMethod(node->m_worker.data(), "onHubFrame", Qt::QueuedConnection,
+                                  Q_ARG(QByteArray, pixels),
+                                  Q_ARG(int, m_sampler.byteOffset(delivery.slice)),
+                                  Q_ARG(int, m_sampler.byteCount(delivery.slice)));
+    }
+    m_deliveries.clear();
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include "Chain.h"
+#include "LightOutputSampler.h"
+#include "Model.h"
+#include "OpenGLWorker.h"
+#include "OpenGLWorkerContext.h"
+#include <QElapsedTimer>
+#include <QMap>
+#include <QMutex>
+#include <QOpenGLBuffer>
+#include <QSharedPointer>
+#include <QTimer>
+
+class LightOutputNode;
+
+// Samples every LightOutputNode with the same hub name
+// from a single render of the graph.
+//
+// Without a hub, each LightOutputNode renders the whole graph
+// on its own thread, samples it and reads it back.
+// Members of a hub share one chain, one thread and one context instead:
+// their lookup coordinates are laid end to end
+// and sampled with as few draws as there are distinct textures
+// (usually one, when every member shows the same thing),
+// each in its device's pixel format (see LightOutputSampler),
+// then read back with a single glReadPixels.
+// Each member gets its slice of the result
+// and sends it to its device as usual,
+// so the protocol doesn't change.
+//
+// The hub renders at the fastest rate any member asked for.
+// Slower members get every few frames,
+// and one-off requests are answered by the next frame.
+//
+// Every public method is thread-safe.
+
+class LightOutputHub : public OpenGLWorker {
+    Q_OBJECT
+
+public:
+   ~LightOutputHub() override;
+
+    // Returns the hub with the given name,
+    // creating it if no node is using it yet.
+    // Must be called from the GUI thread,
+    // since it may create an OpenGL context.
+    static QSharedPointer<LightOutputHub> get(QString name);
+
+    QString name() const;
+    QSharedPointer<Chain> chain();
+
+    // Adds the node to the hub if it isn't there yet.
+    // The hub's chain is as big as its biggest member.
+    void setMember(QSharedPointer<LightOutputNode> node, QSize size);
+    void removeMember(LightOutputNode *node);
+
+    // What to sample for the member and how to encode it.
+    // Its lookup coordinates are empty until the device has sent them.
+    void setSlice(LightOutputNode *node, LightOutputSampler::Slice slice);
+
+    // How often the member wants a frame, in milliseconds,
+    // or 0 to only send frames when asked
+    void setPeriod(LightOutputNode *node, int msec);
+
+    // Sends the member the next frame
+    void requestFrame(LightOutputNode *node);
+
+signals:
+    // Emitted when the chain is replaced
+    void chainChanged(QSharedPointer<Chain> chain);
+
+protected slots:
+    void initialize();
+    void render();
+    void updateTimer();
+    // Finishes the readback if the GPU is done with it
+    void pollReadback();
+
+protected:
+    LightOutputHub(QString name, OpenGLWorkerContext *context);
+
+    // Replaces the chain if the members' sizes changed.
+    // Returns the new chain, or null if it stayed the same.
+    // m_lock must be held.
+    QSharedPointer<Chain> resize();
+
+    // Lays the members' lookup coordinates end to end
+    // and resizes everything that depends on them
+    void updateLayout();
+
+    // Waits for the readback and hands each member its slice
+    void finishReadback();
+
+    // Asks for render() to run soon, unless it is already going to.
+    // m_lock must be held.
+    void scheduleRender();
+
+    struct Member {
+        QWeakPointer<LightOutputNode> node;
+        QSize size;
+        LightOutputSampler::Slice slice;
+        int period{};
+        bool requested{};
+        // Since the member was last sent a frame
+        QElapsedTimer sinceFrame;
+        // The member's index in the sampler, or -1
+        int sliceIndex{-1};
+    };
+
+    // A slice of a readback, for one member
+    struct Delivery {
+        QWeakPointer<LightOutputNode> node;
+        int slice;
+    };
+
+    QString m_name;
+    OpenGLWorkerContext *m_context{};
+
+    QMutex m_lock;
+    // Please take the lock when
+    // editing or using any of these:
+    QSharedPointer<Chain> m_chain;
+    QList<QSharedPointer<Chain>> m_retiredChains;
+    QMap<LightOutputNode *, Member> m_members;
+    bool m_layoutChanged{};
+    bool m_renderScheduled{};
+    // end
+
+    // Only touched from the hub's thread
+    QTimer *m_timer{};
+    QTimer *m_pollTimer{};
+    LightOutputSampler m_sampler;
+    QOpenGLBuffer m_readbackBuffer{QOpenGLBuffer::PixelPackBuffer};
+    GLsync m_readbackFence{};
+    QList<Delivery> m_deliveries;
+
+    static QMutex s_lock;
+    static QMap<QString, QWeakPointer<LightOutputHub>> s_hubs;
+};
@@ -2,14 +2,28 @@
 #include "Context.h"
 #include <QJsonDocument>
 #include <QJsonArray>
+#include <QOpenGLExtraFunctions>
+#include <QtEndian>
 #include <cmath>
+#include <cstring>
 #include <array>
+#ifdef Q_OS_UNIX
+#include <cerrno>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#endif
 
 LightOutputNode::LightOutputNode(Context *context)
     : OutputNode(context, QSize(300, 300))
     , m_geometry2D(QOpenGLTexture::Target2D) {
 }
 
+LightOutputNode::~LightOutputNode() {
+    if (!m_hub.isNull()) {
+        m_hub->removeMember(this);
+    }
+}
+
 void LightOutputNode::init(QString url)
 {
     m_workerContext = new OpenGLWorkerContext(m_context->threaded());
@@ -18,6 +32,7 @@ void LightOutputNode::init(QString url)
 
     setWorkerContext(m_workerContext);
     connect(m_worker.data(), &LightOutputNodeOpenGLWorker::sizeChanged, this, &OutputNode::resize);
+    connect(m_worker.data(), &LightOutputNodeOpenGLWorker::sizeChanged, this, &LightOutputNode::updateHubMember);
 
     if (!url.isEmpty()) setUrl(url);
 }
@@ -29,16 +44,21 @@ QString LightOutputNode::typeName() {
 VideoNodeSP *LightOutputNode::deserialize(Context *context, QJsonObject obj) {
     auto node = new LightOutputNodeSP(new LightOutputNode(context));
     (*node)->init();
+    (*node)->setHub(obj.value("hub").toString());
     QString url = obj.value("url").toString();
     if (!url.isEmpty()) {
         (*node)->setUrl(url);
     }
+    (*node)->deserializeSettings(obj);
     return node;
 }
 
 QJsonObject LightOutputNode::serialize() {
-    QJsonObject o = VideoNode::serialize();
+    QJsonObject o = OutputNode::serialize();
     o.insert("url", url());
+    if (!hub().isEmpty()) {
+        o.insert("hub", hub());
+    }
     return o;
 }
 
@@ -96,6 +116,67 @@ void LightOutputNode::setName(QString value) {
     emit nameChanged(value);
 }
 
+QString LightOutputNode::hub() {
+    QMutexLocker locker(&m_stateLock);
+    return m_hubName;
+}
+
+void LightOutputNode::setHub(QString value) {
+    {
+        QMutexLocker locker(&m_stateLock);
+        if (value == m_hubName) return;
+    }
+
+    // Creating a hub creates an OpenGL context,
+    // so it can't be done with the lock held
+    auto newHub = value.isEmpty() ? QSharedPointer<LightOutputHub>() : LightOutputHub::get(value);
+    QSharedPointer<LightOutputHub> oldHub;
+    {
+        QMutexLocker locker(&m_stateLock);
+        m_hubName = value;
+        oldHub = m_hub;
+        m_hub = newHub;
+    }
+    if (!oldHub.isNull()) {
+        disconnect(oldHub.data(), &LightOutputHub::chainChanged, this, &LightOutputNode::onHubChainChanged);
+        oldHub->removeMember(this);
+    }
+    if (!newHub.isNull()) {
+        connect(newHub.data(), &LightOutputHub::chainChanged, this, &LightOutputNode::onHubChainChanged);
+    }
+    updateHubMember();
+    updateRequestedChains();
+
+    // The device has to send its lookup coordinates again
+    if (!url().isEmpty()) reload();
+
+    emit hubChanged(value);
+}
+
+void LightOutputNode::onHubChainChanged() {
+    updateRequestedChains();
+}
+
+void LightOutputNode::updateHubMember() {
+    auto hub = hubForRendering();
+    if (hub.isNull()) return;
+    hub->setMember(qSharedPointerCast<LightOutputNode>(sharedFromThis()), outputSize());
+}
+
+QSharedPointer<LightOutputHub> LightOutputNode::hubForRendering() {
+    QMutexLocker locker(&m_stateLock);
+    return m_hub;
+}
+
+bool LightOutputNode::drawsTiles() {
+    return true;
+}
+
+QList<QSharedPointer<Chain>> LightOutputNode::currentChains() {
+    if (m_hub.isNull()) return OutputNode::currentChains();
+    return {m_hub->chain()};
+}
+
 QMutex *LightOutputNode::bufferLock() {
     return &m_bufferLock;
 }
@@ -124,58 +205,33 @@ LightOutputNode::DisplayMode LightOutputNode::displayMode() {
     return m_displayMode;
 }
 
+LightOutputSampler::Format LightOutputNode::colorFormat() {
+    return m_colorFormat;
+}
+
 // LightOutputNodeOpenGLWorker methods
 
+constexpr int LightOutputNodeOpenGLWorker::READBACK_BUFFERS;
+constexpr int LightOutputNodeOpenGLWorker::DELTA_BLOCK_SIZE;
+constexpr int LightOutputNodeOpenGLWorker::DATAGRAM_SIZE;
+constexpr int LightOutputNodeOpenGLWorker::DATAGRAM_HEADER_SIZE;
+
 LightOutputNodeOpenGLWorker::LightOutputNodeOpenGLWorker(QSharedPointer<LightOutputNode> p)
     : OpenGLWorker(p->m_workerContext)
     , m_p(p)
-    , m_lookupTexture2D(QOpenGLTexture::Target2D)
     , m_packet(4, 0) {
     qRegisterMetaType<QAbstractSocket::SocketState>("QAbstractSocket::SocketState");
-    connect(this, &LightOutputNodeOpenGLWorker::packetReceived, this, &LightOutputNodeOpenGLWorker::onPacketReceived);
 
     connect(this, &LightOutputNodeOpenGLWorker::message, p.data(), &LightOutputNode::message);
     connect(this, &LightOutputNodeOpenGLWorker::warning, p.data(), &LightOutputNode::warning);
     connect(this, &LightOutputNodeOpenGLWorker::error,   p.data(), &LightOutputNode::error);
 }
 
-QSharedPointer<QOpenGLShaderProgram> LightOutputNodeOpenGLWorker::loadSamplerShader() {
-    Q_ASSERT(QThread::currentThread() == thread());
-    auto vertexString = QString{
-        "#version 150\n"
-        "out vec2 uv;\n"
-        "const vec2 varray[4] = vec2[](vec2(1., 1.),vec2(1., -1.),vec2(-1., 1.),vec2(-1., -1.));\n"
-        "void main() {\n"
-        "    vec2 vertex = varray[gl_VertexID];\n"
-        "    gl_Position = vec4(vertex,0.,1.);\n"
-        "    uv = 0.5*(vertex+1.);\n"
-        "}\n"};
-    auto fragmentString = QString{
-        "#version 150\n"
-        "uniform sampler2D iFrame;\n"
-        "uniform sampler2D iMap;\n"
-        "in vec2 uv;\n"
-        "out vec4 fragColor;\n"
-        "void main() {\n"
-        "    fragColor = texture(iFrame, texture(iMap, uv).xy);\n"
-        "}\n"};
-
-    auto shader = QSharedPointer<QOpenGLShaderProgram>(new QOpenGLShaderProgram());
-
-    if (!shader->addShaderFromSourceCode(QOpenGLShader::Vertex, vertexString)) {
-        emit error("Could not compile vertex shader");
-        return nullptr;
-    }
-    if (!shader->addShaderFromSourceCode(QOpenGLShader::Fragment, fragmentString)) {
-        emit error("Could not compile fragment shader");
-        return nullptr;
-    }
-    if (!shader->link()) {
-        emit error("Could not link shader program");
-        return nullptr;
-    }
-
-    return shader;
+LightOutputNodeOpenGLWorker::~LightOutputNodeOpenGLWorker() {
+    // The sampler and the readback buffers
+    // are freed on our context
+    makeCurrent();
+    dropReadbacks();
 }
 
 void LightOutputNodeOpenGLWorker::throwError(QString msg) {
@@ -186,6 +242,8 @@ void LightOutputNodeOpenGLWorker::throwError(QString msg) {
     emit error(msg);
     p->setNodeState(VideoNode::Broken);
     m_timer->stop();
+    auto hub = p->hubForRendering();
+    if (!hub.isNull()) hub->setPeriod(p.data(), 0);
     m_socket->close();
 }
 
@@ -239,7 +297,9 @@ void LightOutputNodeOpenGLWorker::onReadyRead() {
             m_packetIndex += bytesRead;
             bytesAvailable -= bytesRead;
             if ((qint64)m_packetIndex == m_packet.size()) {
-                emit packetReceived(m_packet);
+                // Parsed where it lies; shrinking keeps the allocation
+                // for the next packet
+                handlePacket(m_packet.constData(), m_packet.size());
                 m_packet.resize(4);
                 m_packetIndex = 0;
             }
@@ -247,11 +307,11 @@ void LightOutputNodeOpenGLWorker::onReadyRead() {
     }
 }
 
-void LightOutputNodeOpenGLWorker::onPacketReceived(QByteArray packet) {
-    if (packet.size() == 4) return;
-    auto cmd = (unsigned char)packet.at(4);
+void LightOutputNodeOpenGLWorker::handlePacket(const char *packet, int size) {
+    if (size == 4) return;
+    auto cmd = (unsigned char)packet[4];
     if (cmd == 0) { // Description
-        auto data = QJsonDocument::fromJson(packet.right(packet.size() - 5));
+        auto data = QJsonDocument::fromJson(QByteArray::fromRawData(packet + 5, size - 5));
         if (data.isNull()) {
             emit warning("Could not parse JSON in \"description\" packet");
             return;
@@ -279,17 +339,65 @@ void LightOutputNodeOpenGLWorker::onPacketReceived(QByteArray packet) {
                 emit sizeChanged(QSize(width, height));
             }
         }
+        auto udpPort = obj.value("udp_port").toInt();
+        if (udpPort > 0 && udpPort <= 65535) {
+            m_udpPort = udpPort;
+        }
+        auto formatName = obj.value("format").toString();
+        if (!formatName.isEmpty()) {
+            LightOutputSampler::Format format;
+            if (!LightOutputSampler::parseFormat(formatName, &format)) {
+                emit warning(QString("Unknown pixel format \"%1\" in \"description\" packet").arg(formatName));
+            } else if (format != m_format) {
+                m_format = format;
+                updateSampler();
+            }
+        }
+        auto layers = m_layers;
+        auto layersValue = obj.value("layers");
+        auto layersArray = layersValue.toArray();
+        if (layersValue.isUndefined()) {
+            layers = QSize(1, 1);
+        } else if (layersValue.isDouble()) {
+            layers = QSize(layersValue.toInt(), 1);
+        } else if (layersArray.count() == 2) {
+            layers = QSize(layersArray.at(0).toInt(), layersArray.at(1).toInt());
+        } else {
+            layers = QSize();
+        }
+        if (layers.width() < 1 || layers.height() < 1) {
+            emit warning("\"layers\" should be a number or [columns, rows] in \"description\" packet");
+        } else if (layers != m_layers) {
+            m_layers = layers;
+            updateSampler();
+        }
+        LightOutputSampler::Calibration calibration;
+        QString calibrationError;
+        if (!LightOutputSampler::parseCalibration(obj, &calibration, &calibrationError)) {
+            emit warning(calibrationError + " in \"description\" packet");
+        } else if (calibration != m_calibration) {
+            m_calibration = calibration;
+            updateSampler();
+        }
+        auto deltaFrames = obj.value("delta").toBool();
+        if (deltaFrames != m_deltaFrames) {
+            m_deltaFrames = deltaFrames;
+            m_lastFrame.clear();
+        }
     } else if (cmd == 1) {
-        if (packet.size() != 9) {
+        if (size != 9) {
             emit warning("Unexpected number of bytes in \"get frame\" packet");
             return;
         }
-        quint32 msec;
-        QDataStream ds(m_packet);
-        ds.setByteOrder(QDataStream::LittleEndian);
-        ds.skipRawData(5);
-        ds >> msec;
-        if (msec == 0) {
+        auto msec = qFromLittleEndian<quint32>((const uchar *)packet + 5);
+        auto p = m_p.toStrongRef();
+        if (p.isNull()) return; // LightOutputNode was deleted
+        auto hub = p->hubForRendering();
+        if (!hub.isNull()) {
+            // The hub keeps time for all of its members
+            m_timer->stop();
+            hub->setPeriod(p.data(), msec);
+        } else if (msec == 0) {
             m_timer->stop();
         } else {
             m_timer->setInterval(msec);
@@ -297,62 +405,13 @@ void LightOutputNodeOpenGLWorker::onPacketReceived(QByteArray packet) {
         }
         render();
     } else if (cmd == 3) {
-        if ((packet.size() - 5) % 8 != 0) {
+        if ((size - 5) % 8 != 0) {
             emit warning("Unexpected number of bytes in \"lookup coordinates 2D\" packet");
             return;
         }
-
-        // We make a square texture of the minimum necessary size
-        // to store the output
-        m_pixelCount = (packet.size() - 5) / 8;
-        auto dim = (int)ceil(sqrt(m_pixelCount));
-
-        // Load up the lookup texture
-        makeCurrent();
-        if (dim != m_lookupTexture2D.width()) {
-            if (m_lookupTexture2D.isCreated()) {
-                m_lookupTexture2D.destroy();
-            }
-            m_lookupTexture2D.setSize(dim, dim);
-            m_lookupTexture2D.setFormat(QOpenGLTexture::RG32F);
-            m_lookupTexture2D.allocateStorage(QOpenGLTexture::RG, QOpenGLTexture::Float32);
-            m_lookupTexture2D.setMinMagFilters(QOpenGLTexture::Nearest, QOpenGLTexture::Nearest);
-            m_lookupTexture2D.setWrapMode(QOpenGLTexture::ClampToEdge);
-        }
-        auto extraBytes = 8 * (dim * dim - m_pixelCount);
-        m_packet.append(extraBytes, 0);
-        m_lookupTexture2D.setData(QOpenGLTexture::RG, QOpenGLTexture::Float32, m_packet.constData() + 5);
-
-        // Resize the FBO
-        if (m_fbo->width() != dim) {
-            auto fmt = QOpenGLFramebufferObjectFormat{};
-            fmt.setInternalTextureFormat(GL_RGBA);
-            m_fbo = QSharedPointer<QOpenGLFramebufferObject>::create(QSize(dim, dim), fmt);
-        }
-
-        // Resize the output bytearray
-        m_pixelBuffer.resize(dim * dim * 4);
-
-        // Resize the VBOs and write the lookup coordinates
-        auto p = m_p.toStrongRef();
-        if (p.isNull()) return; // LightOutputNode was deleted
-        {
-            QMutexLocker locker(&p->m_bufferLock);
-            if (m_pixelCount != p->m_pixelCount) {
-                p->m_pixelCount = m_pixelCount;
-                p->m_colors.bind();
-                p->m_colors.allocate(m_pixelCount * 4);
-                p->m_lookupCoordinates.bind();
-                p->m_lookupCoordinates.allocate(m_pixelCount * 8);
-                p->m_physicalCoordinates.bind();
-                p->m_physicalCoordinates.allocate(m_pixelCount * 8);
-            }
-            p->m_lookupCoordinates.bind();
-            p->m_lookupCoordinates.write(0, m_packet.constData() + 5, m_pixelCount * 8);
-            p->m_lookupCoordinates.release();
-        }
+        setLookupCoordinates(packet + 5, (size - 5) / 8, 2);
     } else if (cmd == 4) {
-        if ((double)(packet.size() - 5) / 8 != m_pixelCount) {
+        if ((double)(size - 5) / 8 != m_pixelCount) {
             emit warning("Unexpected number of bytes in \"physical coordinates 2D\" packet");
             return;
         }
@@ -362,7 +421,7 @@ void LightOutputNodeOpenGLWorker::onPacketReceived(QByteArray packet) {
         {
             QMutexLocker locker(&p->m_bufferLock);
             p->m_physicalCoordinates.bind();
-            p->m_physicalCoordinates.write(0, m_packet.constData() + 5, m_pixelCount * 8);
+            p->m_physicalCoordinates.write(0, packet + 5, m_pixelCount * 8);
             p->m_physicalCoordinates.release();
             p->m_displayMode = LightOutputNode::DisplayPhysical2D;
         }
@@ -371,7 +430,7 @@ void LightOutputNodeOpenGLWorker::onPacketReceived(QByteArray packet) {
         if (p.isNull()) return; // LightOutputNode was deleted
 
         QImage image;
-        auto result = image.loadFromData((const uchar *)m_packet.constData() + 5, m_packet.size() - 5);
+        auto result = image.loadFromData((const uchar *)packet + 5, size - 5);
         if (result) {
             QMutexLocker locker(&p->m_bufferLock);
             p->m_geometry2D.destroy();
@@ -379,35 +438,281 @@ void LightOutputNodeOpenGLWorker::onPacketReceived(QByteArray packet) {
         } else {
             emit warning("Could not parse image data in \"geometry 2D\" packet");
         }
+    } else if (cmd == 6) {
+        if ((size - 5) % 12 != 0) {
+            emit warning("Unexpected number of bytes in \"lookup coordinates 3D\" packet");
+            return;
+        }
+        setLookupCoordinates(packet + 5, (size - 5) / 12, 3);
+    } else if (cmd == 7) {
+        // The visualization is 2D, so it shows the lookup coordinates instead
+        emit warning("\"physical coordinates 3D\" packets are not supported yet and are ignored");
+    } else if (cmd == 8) {
+        emit warning("\"geometry 3D\" packets are not supported yet and are ignored");
+    } else if (cmd == 9) {
+        emit warning("\"tuv map\" packets are not supported yet and are ignored; use \"layers\" in the description");
     }
 }
 
-void LightOutputNodeOpenGLWorker::sendFrame() {
-    QByteArray packetHeader(5, 0);
-    QDataStream ds(&packetHeader, QIODevice::WriteOnly);
-    ds.setByteOrder(QDataStream::LittleEndian);
-    quint32 packetLength = 4 * m_pixelCount + 1;
-    unsigned char cmdId = 2;
-    ds << packetLength << cmdId;
-    auto result = m_socket->write(packetHeader);
-    if (result != packetHeader.size()) {
-        throwError("Could not write data");
+void LightOutputNodeOpenGLWorker::setLookupCoordinates(const char *coordinates, int pixelCount, int dimensions) {
+    m_pixelCount = pixelCount;
+    m_lookupCoordinates = QByteArray(coordinates, pixelCount * 4 * dimensions);
+    m_lookupDimensions = dimensions;
+    makeCurrent();
+
+    // The visualization shows (u, v)
+    QByteArray uv;
+    if (dimensions == 3) {
+        uv.resize(pixelCount * 8);
+        for (int i = 0; i < pixelCount; i++) {
+            memcpy(uv.data() + 8 * i, coordinates + 12 * i + 4, 8);
+        }
+    } else {
+        uv = m_lookupCoordinates;
+    }
+
+    // Resize the VBOs and write the lookup coordinates
+    auto p = m_p.toStrongRef();
+    if (p.isNull()) return; // LightOutputNode was deleted
+    {
+        QMutexLocker locker(&p->m_bufferLock);
+        if (m_pixelCount != p->m_pixelCount) {
+            p->m_pixelCount = m_pixelCount;
+            p->m_lookupCoordinates.bind();
+            p->m_lookupCoordinates.allocate(m_pixelCount * 8);
+            p->m_physicalCoordinates.bind();
+            p->m_physicalCoordinates.allocate(m_pixelCount * 8);
+        }
+        p->m_lookupCoordinates.bind();
+        p->m_lookupCoordinates.write(0, uv.constData(), m_pixelCount * 8);
+        p->m_lookupCoordinates.release();
+    }
+    updateSampler();
+}
+
+void LightOutputNodeOpenGLWorker::sendFrame(const char *pixels) {
+    if (m_udp) {
+        sendFrameDatagrams(pixels);
         return;
     }
-    result = m_socket->write(m_pixelBuffer.data(), 4 * m_pixelCount);
-    if (result != 4 * m_pixelCount) {
+    if (m_deltaFrames) {
+        if (sendDeltaFrame(pixels)) return;
+        // The next delta is against this frame
+        m_lastFrame.resize(m_frameBytes);
+        memcpy(m_lastFrame.data(), pixels, m_frameBytes);
+    }
+    uchar header[5];
+    qToLittleEndian<quint32>(m_frameBytes + 1, header);
+    header[4] = 2;
+    if (!writePacket((const char *)header, sizeof(header), pixels, m_frameBytes)) {
         throwError("Could not write data");
-        return;
+    }
+}
+
+bool LightOutputNodeOpenGLWorker::writePacket(const char *header, int headerSize, const char *payload, int payloadSize) {
+    qint64 written = 0;
+#ifdef Q_OS_UNIX
+    // With nothing queued in front of it,
+    // the packet can go straight to the kernel in one call
+    // instead of being copied into Qt's write buffer first
+    auto fd = m_socket->socketDescriptor();
+    if (m_socket->bytesToWrite() == 0 && fd != -1
+     && m_socket->state() == QAbstractSocket::ConnectedState) {
+        struct iovec iov[2];
+        iov[0].iov_base = (void *)header;
+        iov[0].iov_len = headerSize;
+        iov[1].iov_base = (void *)payload;
+        iov[1].iov_len = payloadSize;
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = payloadSize > 0 ? 2 : 1;
+        // Qt keeps a reset connection from raising SIGPIPE,
+        // which would kill the whole program, and so must we
+        int flags = 0;
+#ifdef MSG_NOSIGNAL
+        flags |= MSG_NOSIGNAL;
+#endif
+#ifdef SO_NOSIGPIPE
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+        ssize_t result;
+        do {
+            result = ::sendmsg(fd, &msg, flags);
+        } while (result < 0 && errno == EINTR);
+        if (result < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) return false;
+            result = 0;
+        }
+        written = result;
+    }
+#endif
+    // Qt sends whatever the kernel didn't take
+    // once the socket can be written to
+    if (written < headerSize) {
+        auto rest = headerSize - written;
+        if (m_socket->write(header + written, rest) != rest) return false;
+        written = headerSize;
+    }
+    auto payloadWritten = written - headerSize;
+    if (payloadWritten < payloadSize) {
+        auto rest = payloadSize - payloadWritten;
+        if (m_socket->write(payload + payloadWritten, rest) != rest) return false;
+    }
+    return true;
+}
+
+bool LightOutputNodeOpenGLWorker::isBehind() {
+    // Frames over UDP are never queued
+    return !m_udp && m_socket->bytesToWrite() > 0;
+}
+
+void LightOutputNodeOpenGLWorker::onBytesWritten() {
+    if (!m_renderDeferred || isBehind()) return;
+    m_renderDeferred = false;
+    // A periodic frame is simply skipped,
+    // but a requested one is still owed
+    if (!m_timer->isActive()) render();
+}
+
+void LightOutputNodeOpenGLWorker::sendFrameDatagrams(const char *pixels) {
+    // The device reassembles frames by sequence number
+    // and throws away any it didn't get all of,
+    // so a lost datagram costs one frame
+    // instead of holding up every frame after it
+    auto frameBytes = m_frameBytes;
+    auto payloadSize = DATAGRAM_SIZE - DATAGRAM_HEADER_SIZE;
+    auto fragmentCount = qMax(1, (frameBytes + payloadSize - 1) / payloadSize);
+    m_frameSequence++;
+
+    auto address = m_socket->peerAddress();
+    for (int i = 0; i < fragmentCount; i++) {
+        auto offset = i * payloadSize;
+        auto length = qMin(payloadSize, frameBytes - offset);
+        m_datagram.resize(DATAGRAM_HEADER_SIZE + length);
+        auto data = (uchar *)m_datagram.data();
+        qToLittleEndian<quint32>(m_frameSequence, data);
+        qToLittleEndian<quint16>(i, data + 4);
+        qToLittleEndian<quint16>(fragmentCount, data + 6);
+        qToLittleEndian<quint32>(offset, data + 8);
+        if (length > 0) {
+            memcpy(data + DATAGRAM_HEADER_SIZE, pixels + offset, length);
+        }
+        if (m_udpSocket->writeDatagram(m_datagram, address, m_udpPort) < 0) {
+            // The rest of the frame is useless without this part,
+            // and the next frame will be along soon
+            if (m_droppedFrames++ == 0) {
+                emit warning(QString("Dropping frames, could not send datagram: %1").arg(m_udpSocket->errorString()));
+            }
+            return;
+        }
+    }
+}
+
+bool LightOutputNodeOpenGLWorker::sendDeltaFrame(const char *pixels) {
+    if (m_frameBytes == 0 || m_lastFrame.size() != m_frameBytes) return false;
+
+    // Find the runs of blocks that changed
+    auto &runs = m_deltaRuns;
+    runs.clear();
+    int deltaBytes = 0;
+    auto lastFrame = m_lastFrame.constData();
+    for (int offset = 0; offset < m_frameBytes; offset += DELTA_BLOCK_SIZE) {
+        auto length = qMin(DELTA_BLOCK_SIZE, m_frameBytes - offset);
+        if (memcmp(pixels + offset, lastFrame + offset, length) == 0) continue;
+        if (!runs.isEmpty() && runs.last().first + runs.last().second == offset) {
+            runs.last().second += length;
+        } else {
+            runs.append(qMakePair(offset, length));
+            deltaBytes += 8;
+        }
+        deltaBytes += length;
+        // A full frame is cheaper for the device to handle
+        if (deltaBytes >= m_frameBytes / 2) return false;
+    }
+
+    // Assembled in place, in a buffer that is kept between frames
+    m_deltaPacket.resize(5 + deltaBytes);
+    auto packet = (uchar *)m_deltaPacket.data();
+    qToLittleEndian<quint32>(deltaBytes + 1, packet);
+    packet[4] = 10;
+    packet += 5;
+    for (auto &run : runs) {
+        qToLittleEndian<quint32>(run.first, packet);
+        qToLittleEndian<quint32>(run.second, packet + 4);
+        memcpy(packet + 8, pixels + run.first, run.second);
+        memcpy(m_lastFrame.data() + run.first, pixels + run.first, run.second);
+        packet += 8 + run.second;
+    }
+    if (!writePacket(m_deltaPacket.constData(), m_deltaPacket.size(), nullptr, 0)) {
+        throwError("Could not write data");
+    }
+    return true;
+}
+
+void LightOutputNodeOpenGLWorker::updateSampler() {
+    makeCurrent();
+    dropReadbacks();
+    m_frameBytes = m_pixelCount * LightOutputSampler::bytesPerPixel(m_format);
+    m_lastFrame.clear();
+
+    LightOutputSampler::Slice slice;
+    slice.lookupCoordinates = m_lookupCoordinates;
+    slice.lookupDimensions = m_lookupDimensions;
+    slice.layers = m_layers;
+    slice.format = m_format;
+    slice.calibration = m_calibration;
+    m_sampler.setSlices({slice});
+
+    // Resize the readback buffers
+    for (auto &readback : m_readbacks) {
+        if (!readback.buffer.isCreated()) {
+            readback.buffer.create();
+            readback.buffer.setUsagePattern(QOpenGLBuffer::StreamRead);
+        }
+        readback.buffer.bind();
+        readback.buffer.allocate(m_sampler.readbackSize());
+        readback.buffer.release();
+    }
+
+    auto p = m_p.toStrongRef();
+    if (p.isNull()) return; // LightOutputNode was deleted
+    {
+        // The visualization reads the frames as they are sent
+        QMutexLocker locker(&p->m_bufferLock);
+        p->m_colorFormat = m_format;
+        p->m_colors.bind();
+        p->m_colors.allocate(m_frameBytes);
+        p->m_colors.release();
+    }
+    auto hub = p->hubForRendering();
+    if (!hub.isNull()) {
+        hub->setSlice(p.data(), slice);
     }
 }
 
 void LightOutputNodeOpenGLWorker::connectToDevice(QString url) {
     m_socket->close();
+
+    // udp://host:port sends frames as datagrams to the same port.
+    // Everything else still goes over TCP.
+    m_udp = false;
+    if (url.startsWith("udp://")) {
+        m_udp = true;
+        url = url.mid(6);
+    } else if (url.startsWith("tcp://")) {
+        url = url.mid(6);
+    }
+
     auto parts = url.split(":");
     auto port = 11647;
     if (parts.count() == 2) {
         port = parts.at(1).toInt();
     }
+    m_udpPort = port;
+    m_frameSequence = 0;
+    m_droppedFrames = 0;
     m_socket->connectToHost(parts.at(0), port);
 }
 
@@ -423,23 +728,26 @@ void LightOutputNodeOpenGLWorker::initialize() {
         m_socket = new QTcpSocket(this);
         connect(m_socket, &QAbstractSocket::stateChanged, this, &LightOutputNodeOpenGLWorker::onStateChanged);
         connect(m_socket, &QAbstractSocket::readyRead, this, &LightOutputNodeOpenGLWorker::onReadyRead);
+        connect(m_socket, &QAbstractSocket::bytesWritten, this, &LightOutputNodeOpenGLWorker::onBytesWritten);
+    }
+    if (m_udpSocket == NULL) {
+        m_udpSocket = new QUdpSocket(this);
     }
     if (m_timer == NULL) {
         m_timer = new QTimer(this);
         connect(m_timer, &QTimer::timeout, this, &LightOutputNodeOpenGLWorker::render);
     }
-
-    if (m_shader.isNull()) {
-        m_shader = loadSamplerShader();
-        if (m_shader.isNull()) return;
+    if (m_pollTimer == NULL) {
+        // Readbacks usually land well within a millisecond or two
+        m_pollTimer = new QTimer(this);
+        m_pollTimer->setInterval(1);
+        connect(m_pollTimer, &QTimer::timeout, this, &LightOutputNodeOpenGLWorker::pollReadbacks);
     }
 
-    if (m_fbo.isNull()) {
-        makeCurrent();
-
-        auto fmt = QOpenGLFramebufferObjectFormat{};
-        fmt.setInternalTextureFormat(GL_RGBA);
-        m_fbo = QSharedPointer<QOpenGLFramebufferObject>::create(QSize(1, 1), fmt);
+    makeCurrent();
+    auto hub = p->hubForRendering();
+    if (!hub.isNull()) {
+        hub->setPeriod(p.data(), 0);
     }
 
     {
@@ -464,6 +772,16 @@ void LightOutputNodeOpenGLWorker::initialize() {
         p->m_displayMode = LightOutputNode::DisplayLookup2D;
     }
 
+    // Nothing is known about the new device yet
+    m_lookupCoordinates.clear();
+    m_lookupDimensions = 2;
+    m_layers = QSize(1, 1);
+    m_format = LightOutputSampler::RGBA8;
+    m_calibration = LightOutputSampler::Calibration();
+    m_deltaFrames = false;
+    m_renderDeferred = false;
+    updateSampler();
+
     connectToDevice(url);
 }
 
@@ -471,57 +789,156 @@ void LightOutputNodeOpenGLWorker::render() {
     Q_ASSERT(QThread::currentThread() == thread());
     auto p = m_p.toStrongRef();
     if (p.isNull()) return; // LightOutputNode was deleted
+    if (m_pixelCount == 0) {
+        // Nothing to sample, but the device may be waiting on a frame
+        sendFrame(nullptr);
+        return;
+    }
+    if (isBehind()) {
+        // A frame now would only wait behind the ones still queued.
+        // Render once the queue drains instead.
+        m_renderDeferred = true;
+        return;
+    }
+
+    auto hub = p->hubForRendering();
+    if (!hub.isNull()) {
+        // The frame arrives in onHubFrame
+        hub->requestFrame(p.data());
+        return;
+    }
 
     makeCurrent();
-    GLuint texture = p->render();
+    if (!m_sampler.begin()) {
+        throwError("Could not load sampler shader");
+        return;
+    }
 
-    if (texture == 0) {
+    // Each tile is sampled for the pixels that fall in it
+    // while its textures are still around
+    auto chain = p->chain();
+    auto canvas = QSizeF(chain->size());
+    auto normalized = [canvas](QRect rect) {
+        return QRectF(rect.x() / canvas.width(), rect.y() / canvas.height(),
+                      rect.width() / canvas.width(), rect.height() / canvas.height());
+    };
+    auto vao = chain->vao();
+    int sampled = 0;
+    p->renderTiles([&](GLuint texture, QRect tileRect, QRect interior) {
+        if (texture == 0) return;
+        vao->bind();
+        m_sampler.sample(texture, 0, 1, normalized(tileRect), normalized(interior));
+        vao->release();
+        sampled++;
+    });
+    if (sampled == 0) {
         qWarning() << "No frame available";
         return;
     }
 
-    auto vao = p->chain()->vao();
+    // If every buffer is in flight, the oldest has to land first
+    auto index = m_nextReadback;
+    if (m_pendingReadbacks.contains(index)) {
+        finishReadback(index);
+    }
+    m_nextReadback = (m_nextReadback + 1) % READBACK_BUFFERS;
+    auto &readback = m_readbacks[index];
 
-    glClearColor(0, 0, 0, 0);
-    glDisable(GL_DEPTH_TEST);
-    glDisable(GL_BLEND);
+    // The sampled image is exactly what the device asked for,
+    // so it is read back and sent as is
+    auto gl = QOpenGLContext::currentContext()->extraFunctions();
+    vao->bind();
+    readback.buffer.bind();
+    m_sampler.readPixels();
+    readback.buffer.release();
+    vao->release();
+    readback.fence = gl->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    readback.frameBytes = m_frameBytes;
+    gl->glFlush();
+    m_pendingReadbacks.append(index);
+    m_sampler.end();
 
-    m_fbo->bind();
-    // VAO??
-    auto size = m_fbo->size();
-    glViewport(0, 0, size.width(), size.height());
+    m_pollTimer->start();
+}
 
-    m_shader->bind();
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, texture);
-    glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_LINEAR);
+void LightOutputNodeOpenGLWorker::pollReadbacks() {
+    makeCurrent();
+    auto gl = QOpenGLContext::currentContext()->extraFunctions();
+    while (!m_pendingReadbacks.isEmpty()) {
+        auto index = m_pendingReadbacks.first();
+        auto status = gl->glClientWaitSync(m_readbacks[index].fence, 0, 0);
+        if (status == GL_TIMEOUT_EXPIRED) return;
+        finishReadback(index);
+    }
+    m_pollTimer->stop();
+}
 
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, m_lookupTexture2D.textureId());
-    glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_NEAREST);
+void LightOutputNodeOpenGLWorker::finishReadback(int index) {
+    auto gl = QOpenGLContext::currentContext()->extraFunctions();
+    auto &readback = m_readbacks[index];
 
-    m_shader->setUniformValue("iFrame", 0);
-    m_shader->setUniformValue("iMap", 1);
+    // Readbacks land in order,
+    // so anything older than this one must go first
+    while (!m_pendingReadbacks.isEmpty() && m_pendingReadbacks.first() != index) {
+        finishReadback(m_pendingReadbacks.first());
+    }
+    m_pendingReadbacks.removeAll(index);
 
-    vao->bind();
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-    vao->release();
+    // Waits if the GPU isn't done yet
+    gl->glClientWaitSync(readback.fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+    gl->glDeleteSync(readback.fence);
+    readback.fence = 0;
+    if (readback.frameBytes != m_frameBytes) return;
+
+    auto p = m_p.toStrongRef();
+    if (p.isNull()) return; // LightOutputNode was deleted
+
+    readback.buffer.bind();
+    auto pixels = (const char *)gl->glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, m_frameBytes, GL_MAP_READ_BIT);
+    if (pixels != nullptr) {
+        // Write the new colors to the VBO for visualization
+        {
+            QMutexLocker locker(&p->m_bufferLock);
+            p->m_colors.bind();
+            p->m_colors.write(0, pixels, m_frameBytes);
+            p->m_colors.release();
+        }
+        sendFrame(pixels);
+        readback.buffer.bind();
+        gl->glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    } else {
+        qWarning() << "Could not map readback buffer";
+    }
+    readback.buffer.release();
+}
+
+void LightOutputNodeOpenGLWorker::dropReadbacks() {
+    auto context = QOpenGLContext::currentContext();
+    for (auto index : m_pendingReadbacks) {
+        context->extraFunctions()->glDeleteSync(m_readbacks[index].fence);
+        m_readbacks[index].fence = 0;
+    }
+    m_pendingReadbacks.clear();
+    if (m_pollTimer != nullptr) m_pollTimer->stop();
+}
 
-    glReadPixels(0, 0, size.width(), size.height(), GL_RGBA, GL_UNSIGNED_BYTE, m_pixelBuffer.data());
+void LightOutputNodeOpenGLWorker::onHubFrame(QByteArray pixels, int offset, int size) {
+    Q_ASSERT(QThread::currentThread() == thread());
+    // The lookup coordinates or the format changed since the frame was sampled
+    if (size != m_frameBytes) return;
+    if (m_connectionState != LightOutputNodeOpenGLWorker::Connected) return;
+    if (isBehind()) return; // The hub will send another
 
-    m_fbo->release();
-    m_shader->release();
-    glActiveTexture(GL_TEXTURE0);
+    auto p = m_p.toStrongRef();
+    if (p.isNull()) return; // LightOutputNode was deleted
 
-    // Write the new colors to the VBO for visualization
+    auto slice = pixels.constData() + offset;
+    makeCurrent();
     {
         QMutexLocker locker(&p->m_bufferLock);
         p->m_colors.bind();
-        p->m_colors.write(0, m_pixelBuffer.constData(), m_pixelCount * 4);
+        p->m_colors.write(0, slice, m_frameBytes);
         p->m_colors.release();
     }
-
-    sendFrame();
+    sendFrame(slice);
 }
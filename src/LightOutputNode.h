@@ -3,12 +3,16 @@
 #include <QOpenGLShaderProgram>
 #include <QOpenGLFramebufferObject>
 #include <QTcpSocket>
+#include <QUdpSocket>
+#include <QHostAddress>
 #include <QDataStream>
 #include <QtGlobal>
 #include <QOpenGLBuffer>
 #include "OutputNode.h"
 #include "OpenGLWorkerContext.h"
 #include "OpenGLWorker.h"
+#include "LightOutputHub.h"
+#include "LightOutputSampler.h"
 
 class LightOutputNodeOpenGLWorker;
 class LightOutputNodePrivate;
@@ -18,12 +22,15 @@ class LightOutputNode
     Q_OBJECT
     Q_PROPERTY(QString url READ url WRITE setUrl NOTIFY urlChanged)
     Q_PROPERTY(QString name READ name NOTIFY nameChanged)
+    Q_PROPERTY(QString hub READ hub WRITE setHub NOTIFY hubChanged)
 
     friend class WeakLightOutputNode;
     friend class LightOutputNodeOpenGLWorker;
+    friend class LightOutputHub;
 
 public:
     LightOutputNode(Context *context);
+   ~LightOutputNode() override;
     void init(QString url="");
 
     enum DisplayMode {
@@ -62,6 +69,9 @@ public:
     QOpenGLBuffer &physicalCoordinatesBuffer();
     QOpenGLTexture *geometry2DTexture();
     DisplayMode displayMode();
+    // The format of the colors buffer,
+    // which holds exactly what is sent to the device
+    LightOutputSampler::Format colorFormat();
     // end
 
 public slots:
@@ -70,17 +80,40 @@ public slots:
     QString name();
     void reload();
 
+    // LightOutputNodes with the same hub name
+    // are rendered and sampled together
+    // (see LightOutputHub.)
+    // Empty (the default) for a node that renders on its own.
+    // Changing it reconnects to the device.
+    QString hub();
+    void setHub(QString value);
+
 signals:
     void urlChanged(QString value);
     void nameChanged(QString value);
+    void hubChanged(QString value);
+
+protected slots:
+    void onHubChainChanged();
+    void updateHubMember();
 
 protected:
     void setName(QString value);
+    // Each tile is sampled as soon as it is rendered.
+    // Members of a hub are sampled from the hub's chain,
+    // which isn't tiled.
+    bool drawsTiles() override;
+    QList<QSharedPointer<Chain>> currentChains() override;
+
+    // The hub that samples this node, if any
+    QSharedPointer<LightOutputHub> hubForRendering();
 
     OpenGLWorkerContext *m_workerContext{};
     QSharedPointer<LightOutputNodeOpenGLWorker> m_worker;
     QString m_url;
     QString m_name;
+    QString m_hubName;
+    QSharedPointer<LightOutputHub> m_hub;
 
     QMutex m_bufferLock;
     // Please take the bufferlock when
@@ -91,6 +124,7 @@ protected:
     QOpenGLBuffer m_physicalCoordinates;
     QOpenGLTexture m_geometry2D;
     LightOutputNode::DisplayMode m_displayMode{LightOutputNode::DisplayLookup2D};
+    LightOutputSampler::Format m_colorFormat{LightOutputSampler::RGBA8};
     // end
 };
 
@@ -103,6 +137,7 @@ class LightOutputNodeOpenGLWorker : public OpenGLWorker {
     Q_OBJECT
 public:
     LightOutputNodeOpenGLWorker(QSharedPointer<LightOutputNode> p);
+   ~LightOutputNodeOpenGLWorker() override;
 
     enum LightOutputNodeState {
         Disconnected,
@@ -110,6 +145,18 @@ public:
         Broken
     };
 
+    // Readbacks that can be in flight at once
+    static constexpr int READBACK_BUFFERS = 2;
+
+    // With a udp:// URL, frames are sent as datagrams of at most this many bytes
+    // (small enough to never be fragmented by IP on an Ethernet or Wi-Fi link)
+    static constexpr int DATAGRAM_SIZE = 1400;
+    // sequence (uint32), fragment index (uint16), fragment count (uint16), offset (uint32)
+    static constexpr int DATAGRAM_HEADER_SIZE = 12;
+
+    // Delta frames compare frames in blocks of this many bytes
+    static constexpr int DELTA_BLOCK_SIZE = 64;
+
 public slots:
     void initialize();
     void render();
@@ -118,32 +165,100 @@ signals:
     void message(QString str);
     void warning(QString str);
     void error(QString str);
-    void packetReceived(QByteArray packet);
     void sizeChanged(QSize size);
 
 protected:
-    QSharedPointer<QOpenGLShaderProgram> loadSamplerShader();
     void connectToDevice(QString url);
     void throwError(QString msg);
-    void sendFrame();
+    void sendFrame(const char *pixels);
+    // Writes a packet made of a header and a payload
+    // without copying them together first.
+    // Returns false if the socket failed.
+    bool writePacket(const char *header, int headerSize, const char *payload, int payloadSize);
+    // Whether frames already sent are still waiting to go out
+    bool isBehind();
+    // Handles one packet from the device,
+    // including its length, without copying it
+    void handlePacket(const char *packet, int size);
+    // For the "lookup coordinates" packets
+    // (2 or 3 floats per pixel)
+    void setLookupCoordinates(const char *coordinates, int pixelCount, int dimensions);
+    // Sends a frame over UDP, split into fragments
+    void sendFrameDatagrams(const char *pixels);
+    // Sends only the parts of the frame that changed since the last one.
+    // Returns false if that wouldn't save much,
+    // in which case nothing is sent.
+    bool sendDeltaFrame(const char *pixels);
+
+    // Lays out the sampler for the current lookup coordinates and format
+    // and resizes everything that depends on them
+    void updateSampler();
+    // Finishes the given readback: sends it to the device
+    // and shows it in the visualization
+    void finishReadback(int index);
+    // Forgets readbacks that are in flight
+    void dropReadbacks();
 
 protected slots:
     void onStateChanged(QAbstractSocket::SocketState socketState);
     void onReadyRead();
-    void onPacketReceived(QByteArray packet);
+    void onBytesWritten();
+    // Finishes any readbacks that the GPU is done with
+    void pollReadbacks();
+    // Sends this node's slice of a frame sampled by its hub
+    void onHubFrame(QByteArray pixels, int offset, int size);
 
 private:
     QWeakPointer<LightOutputNode> m_p;
     QTimer *m_timer{};
-    QByteArray m_pixelBuffer;
-    QSharedPointer<QOpenGLShaderProgram> m_shader;
-    QSharedPointer<QOpenGLFramebufferObject> m_fbo;
+    QTimer *m_pollTimer{};
     QTcpSocket *m_socket{};
     LightOutputNodeState m_connectionState{Disconnected};
-    QOpenGLTexture m_lookupTexture2D;
+    LightOutputSampler m_sampler;
+    QByteArray m_lookupCoordinates;
+    int m_lookupDimensions{2};
     quint32 m_pixelCount{};
+    // What the device asked for in its description
+    LightOutputSampler::Format m_format{LightOutputSampler::RGBA8};
+    LightOutputSampler::Calibration m_calibration;
+    // How 3D lookups find their layer in the canvas
+    QSize m_layers{1, 1};
+    bool m_deltaFrames{};
+    // The size of a frame in m_format
+    int m_frameBytes{};
+    // The last frame sent, for delta frames.
+    // Empty when the next frame must be sent in full.
+    QByteArray m_lastFrame;
+    // Kept between frames so sending a delta doesn't allocate
+    QByteArray m_deltaPacket;
+    QVector<QPair<int, int>> m_deltaRuns;
+    // A frame was due while the socket was behind
+    bool m_renderDeferred{};
+
+    // Sampled colors are read into pixel buffers
+    // and only mapped once a fence says the copy is done,
+    // so the GPU never stalls the worker thread
+    struct Readback {
+        QOpenGLBuffer buffer{QOpenGLBuffer::PixelPackBuffer};
+        GLsync fence{};
+        int frameBytes{};
+    };
+    Readback m_readbacks[READBACK_BUFFERS];
+    int m_nextReadback{};
+    // Indices of the readbacks in flight, oldest first
+    QList<int> m_pendingReadbacks;
 
     // For the radiance output protocol
     QByteArray m_packet;
     quint64 m_packetIndex{};
+
+    // Frames go over UDP and everything else over TCP
+    bool m_udp{};
+    QUdpSocket *m_udpSocket{};
+    quint16 m_udpPort{};
+    quint32 m_frameSequence{};
+    QByteArray m_datagram;
+    // Frames that could not be sent in full
+    // because the socket's buffer was full
+    quint64 m_droppedFrames{};
 };
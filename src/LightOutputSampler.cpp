@@ -0,0 +1,621 @@
+#include "LightOutputSampler.h"
+#include <QDebug>
+#include <QJsonArray>
+#include <QOpenGLContext>
+#include <QOpenGLExtraFunctions>
+#include <QVector4D>
+#include <cmath>
+#include <cstring>
+
+constexpr int LightOutputSampler::READBACK_WIDTH;
+constexpr int LightOutputSampler::LUT_SIZE;
+
+// Each byte of the stream is described by
+// 16 * (the pixel's index) + (one of these codes),
+// or -1 for the padding at the end of a slice
+enum ByteCode {
+    // 0-3: a channel, 8 bits
+    BYTE_CODE_565_LOW = 4,
+    BYTE_CODE_565_HIGH = 5,
+    // 6-11: a channel, 16 bits, low byte first
+    BYTE_CODE_16 = 6,
+};
+
+static int byteCode(LightOutputSampler::Format format, int byte) {
+    switch (format) {
+    case LightOutputSampler::RGBA8:
+    case LightOutputSampler::RGB8:
+        return byte;
+    case LightOutputSampler::RGB565:
+        return BYTE_CODE_565_LOW + byte;
+    case LightOutputSampler::RGB16:
+        return BYTE_CODE_16 + byte;
+    }
+    return -1;
+}
+
+bool LightOutputSampler::parseFormat(QString name, Format *format) {
+    if (name == "rgba8") {
+        *format = RGBA8;
+    } else if (name == "rgb8") {
+        *format = RGB8;
+    } else if (name == "rgb565") {
+        *format = RGB565;
+    } else if (name == "rgb16") {
+        *format = RGB16;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+int LightOutputSampler::bytesPerPixel(Format format) {
+    switch (format) {
+    case RGBA8: return 4;
+    case RGB8: return 3;
+    case RGB565: return 2;
+    case RGB16: return 6;
+    }
+    return 4;
+}
+
+bool LightOutputSampler::Calibration::operator==(const Calibration &other) const {
+    return lut == other.lut
+        && colorMatrix == other.colorMatrix
+        && maxBrightness == other.maxBrightness
+        && dither == other.dither;
+}
+
+bool LightOutputSampler::Calibration::operator!=(const Calibration &other) const {
+    return !(*this == other);
+}
+
+// Reads an array of at least 2 numbers
+static bool readCurve(QJsonValue value, QVector<float> *curve) {
+    if (!value.isArray()) return false;
+    auto array = value.toArray();
+    if (array.count() < 2) return false;
+    curve->clear();
+    for (auto point : array) {
+        if (!point.isDouble()) return false;
+        curve->append(point.toDouble());
+    }
+    return true;
+}
+
+// Samples a curve whose points are evenly spaced from 0 to 1
+static float interpolate(const QVector<float> &curve, float x) {
+    auto position = x * (curve.count() - 1);
+    auto i = qMin((int)position, curve.count() - 2);
+    return curve.at(i) + (position - i) * (curve.at(i + 1) - curve.at(i));
+}
+
+bool LightOutputSampler::parseCalibration(QJsonObject description, Calibration *calibration, QString *error) {
+    Calibration result;
+
+    // A power law, for all channels or for each
+    auto gammaValue = description.value("gamma");
+    if (!gammaValue.isUndefined()) {
+        QVector3D gamma;
+        auto gammaArray = gammaValue.toArray();
+        if (gammaValue.isDouble()) {
+            gamma = QVector3D(1, 1, 1) * gammaValue.toDouble();
+        } else if (gammaArray.count() == 3 && gammaArray.at(0).isDouble() && gammaArray.at(1).isDouble() && gammaArray.at(2).isDouble()) {
+            gamma = QVector3D(gammaArray.at(0).toDouble(), gammaArray.at(1).toDouble(), gammaArray.at(2).toDouble());
+        } else {
+            *error = "\"gamma\" should be a number or [red, green, blue]";
+            return false;
+        }
+        if (gamma.x() <= 0 || gamma.y() <= 0 || gamma.z() <= 0) {
+            *error = "\"gamma\" should be positive";
+            return false;
+        }
+        result.lut.resize(LUT_SIZE);
+        for (int i = 0; i < LUT_SIZE; i++) {
+            auto x = (float)i / (LUT_SIZE - 1);
+            result.lut[i] = QVector3D(std::pow(x, gamma.x()), std::pow(x, gamma.y()), std::pow(x, gamma.z()));
+        }
+    }
+
+    // Any curve, for all channels or for each.
+    // Takes precedence over "gamma".
+    auto lutValue = description.value("gamma_lut");
+    if (!lutValue.isUndefined()) {
+        QVector<float> curves[3];
+        auto lutArray = lutValue.toArray();
+        auto ok = false;
+        if (!lutArray.isEmpty() && lutArray.at(0).isArray()) {
+            ok = lutArray.count() == 3
+              && readCurve(lutArray.at(0), &curves[0])
+              && readCurve(lutArray.at(1), &curves[1])
+              && readCurve(lutArray.at(2), &curves[2]);
+        } else if (readCurve(lutValue, &curves[0])) {
+            curves[1] = curves[0];
+            curves[2] = curves[0];
+            ok = true;
+        }
+        if (!ok) {
+            *error = "\"gamma_lut\" should be a list of at least 2 numbers, or 3 such lists";
+            return false;
+        }
+        result.lut.resize(LUT_SIZE);
+        for (int i = 0; i < LUT_SIZE; i++) {
+            auto x = (float)i / (LUT_SIZE - 1);
+            result.lut[i] = QVector3D(interpolate(curves[0], x), interpolate(curves[1], x), interpolate(curves[2], x));
+        }
+    }
+
+    auto matrixValue = description.value("color_matrix");
+    if (!matrixValue.isUndefined()) {
+        QVector<float> values;
+        for (auto row : matrixValue.toArray()) {
+            auto rowArray = row.toArray();
+            if (rowArray.count() != 3) break;
+            for (auto value : rowArray) {
+                if (value.isDouble()) values.append(value.toDouble());
+            }
+        }
+        if (values.count() != 9) {
+            *error = "\"color_matrix\" should be 3 rows of 3 numbers";
+            return false;
+        }
+        for (int i = 0; i < 9; i++) {
+            result.colorMatrix(i / 3, i % 3) = values.at(i);
+        }
+    }
+
+    auto brightnessValue = description.value("max_brightness");
+    if (!brightnessValue.isUndefined()) {
+        auto brightness = brightnessValue.toDouble(-1);
+        if (brightness < 0 || brightness > 1) {
+            *error = "\"max_brightness\" should be a number from 0 to 1";
+            return false;
+        }
+        result.maxBrightness = brightness;
+    }
+
+    result.dither = description.value("dither").toBool();
+
+    *calibration = result;
+    return true;
+}
+
+LightOutputSampler::LightOutputSampler()
+    : m_lookupTexture(QOpenGLTexture::Target2D)
+    , m_calibrationTexture(QOpenGLTexture::Target2D)
+    , m_byteTexture(QOpenGLTexture::Target2D)
+{
+}
+
+LightOutputSampler::~LightOutputSampler() {
+    m_fbo.clear();
+    m_sampleFbo.clear();
+    m_sampleShader.clear();
+    m_encodeShader.clear();
+    m_lookupTexture.destroy();
+    m_calibrationTexture.destroy();
+    m_byteTexture.destroy();
+}
+
+QSize LightOutputSampler::imageSize(int texels) {
+    if (texels == 0) return QSize(1, 1);
+    auto width = qMin(texels, READBACK_WIDTH);
+    return QSize(width, (texels + width - 1) / width);
+}
+
+QSharedPointer<QOpenGLShaderProgram> LightOutputSampler::loadShader(QString name, QString fragmentString) {
+    auto vertexString = QString{
+        "#version 150\n"
+        "const vec2 varray[4] = vec2[](vec2(1., 1.),vec2(1., -1.),vec2(-1., 1.),vec2(-1., -1.));\n"
+        "void main() {\n"
+        "    vec2 vertex = varray[gl_VertexID];\n"
+        "    gl_Position = vec4(vertex,0.,1.);\n"
+        "}\n"};
+
+    auto shader = QSharedPointer<QOpenGLShaderProgram>(new QOpenGLShaderProgram());
+
+    if (!shader->addShaderFromSourceCode(QOpenGLShader::Vertex, vertexString)) {
+        qWarning() << "Could not compile light output" << name << "vertex shader";
+        return nullptr;
+    }
+    if (!shader->addShaderFromSourceCode(QOpenGLShader::Fragment, fragmentString)) {
+        qWarning() << "Could not compile light output" << name << "fragment shader";
+        return nullptr;
+    }
+    if (!shader->link()) {
+        qWarning() << "Could not link light output" << name << "shader program";
+        return nullptr;
+    }
+
+    return shader;
+}
+
+// Shared by both passes
+static const char *SAMPLER_COMMON =
+    "#version 150\n"
+    "const int LUT_SIZE = %1;\n"
+    "uniform sampler2D iMap;\n"
+    "uniform sampler2D iCalibration;\n"
+    "\n"
+    "vec4 calibration(int slice, int column) {\n"
+    "    return texelFetch(iCalibration, ivec2(column, slice), 0);\n"
+    "}\n"
+    "\n"
+    "// (u, v, slice, t) of a pixel\n"
+    "vec4 map(int pixel) {\n"
+    "    int width = textureSize(iMap, 0).x;\n"
+    "    return texelFetch(iMap, ivec2(pixel % width, pixel / width), 0);\n"
+    "}\n"
+    "\n"
+    "// A pixel samples layer t of a stack of layers laid out in a grid\n"
+    "// by blending the two nearest, first + 0 and first + 1.\n"
+    "// With a single layer, this is a plain 2D lookup.\n"
+    "float layerCount(int slice) {\n"
+    "    vec2 grid = calibration(slice, LUT_SIZE + 3).zw;\n"
+    "    return grid.x * grid.y;\n"
+    "}\n"
+    "float layerPosition(vec4 map) {\n"
+    "    return clamp(map.w, 0., 1.) * (layerCount(int(map.z)) - 1.);\n"
+    "}\n"
+    "float firstLayer(vec4 map) {\n"
+    "    return min(floor(layerPosition(map)), max(layerCount(int(map.z)) - 2., 0.));\n"
+    "}\n";
+
+QSharedPointer<QOpenGLShaderProgram> LightOutputSampler::loadSampleShader() {
+    // Each texel is one of the two colors a pixel blends.
+    // Only pixels in [iFirst, iEnd) whose lookup lands in iInterior are written.
+    auto fragmentString = QString(SAMPLER_COMMON).arg(LUT_SIZE) + QString{
+        "uniform sampler2D iFrame;\n"
+        "uniform int iFirst;\n"
+        "uniform int iEnd;\n"
+        "// The part of the canvas that iFrame covers, (x, y, width, height)\n"
+        "uniform vec4 iTileRect;\n"
+        "// The part of the canvas to take from iFrame, (left, bottom, right, top)\n"
+        "uniform vec4 iInterior;\n"
+        "out vec4 fragColor;\n"
+        "\n"
+        "void main() {\n"
+        "    ivec2 coord = ivec2(gl_FragCoord.xy);\n"
+        "    int index = coord.y * %1 + coord.x;\n"
+        "    int pixel = index / 2;\n"
+        "    if (pixel < iFirst || pixel >= iEnd) discard;\n"
+        "    vec4 m = map(pixel);\n"
+        "    int slice = int(m.z);\n"
+        "    vec2 grid = calibration(slice, LUT_SIZE + 3).zw;\n"
+        "    float layer = firstLayer(m) + float(index % 2);\n"
+        "    if (layer >= layerCount(slice)) discard;\n"
+        "    vec2 cell = clamp(m.xy, 0., 1.) / grid;\n"
+        "    vec2 uv = vec2(mod(layer, grid.x), floor(layer / grid.x)) / grid + cell;\n"
+        "    // Interiors meet without overlapping;\n"
+        "    // the far edge of the canvas belongs to the last tile\n"
+        "    if (any(lessThan(uv, iInterior.xy))) discard;\n"
+        "    bvec2 beyond = greaterThanEqual(uv, iInterior.zw);\n"
+        "    if ((beyond.x && iInterior.z < 1.) || (beyond.y && iInterior.w < 1.)) discard;\n"
+        "    fragColor = texture(iFrame, (uv - iTileRect.xy) / iTileRect.zw);\n"
+        "}\n"}.arg(READBACK_WIDTH);
+    return loadShader("sample", fragmentString);
+}
+
+QSharedPointer<QOpenGLShaderProgram> LightOutputSampler::loadEncodeShader() {
+    // Each texel holds 4 bytes of the stream,
+    // which come from at most 2 neighboring pixels.
+    auto fragmentString = QString(SAMPLER_COMMON).arg(LUT_SIZE) + QString{
+        "uniform sampler2D iSamples;\n"
+        "uniform isampler2D iBytes;\n"
+        "uniform int iFrameIndex;\n"
+        "out vec4 fragColor;\n"
+        "\n"
+        "vec3 curve(int slice, vec3 x) {\n"
+        "    vec3 position = clamp(x, 0., 1.) * float(LUT_SIZE - 1);\n"
+        "    ivec3 i = ivec3(min(floor(position), float(LUT_SIZE - 2)));\n"
+        "    vec3 f = position - vec3(i);\n"
+        "    vec3 result;\n"
+        "    for (int c = 0; c < 3; c++) {\n"
+        "        result[c] = mix(calibration(slice, i[c])[c], calibration(slice, i[c] + 1)[c], f[c]);\n"
+        "    }\n"
+        "    return result;\n"
+        "}\n"
+        "\n"
+        "vec4 gathered(int index) {\n"
+        "    int width = textureSize(iSamples, 0).x;\n"
+        "    return texelFetch(iSamples, ivec2(index % width, index / width), 0);\n"
+        "}\n"
+        "\n"
+        "// The calibrated color, and whether to dither it\n"
+        "vec4 lookup(int pixel, out bool dither) {\n"
+        "    vec4 m = map(pixel);\n"
+        "    int slice = int(m.z);\n"
+        "    vec4 parameters = calibration(slice, LUT_SIZE + 3);\n"
+        "    vec4 color = gathered(2 * pixel);\n"
+        "    if (layerCount(slice) >= 2.) {\n"
+        "        color = mix(color, gathered(2 * pixel + 1), layerPosition(m) - firstLayer(m));\n"
+        "    }\n"
+        "    color = clamp(color, 0., 1.);\n"
+        "    vec3 rgb = curve(slice, color.rgb);\n"
+        "    rgb = vec3(dot(calibration(slice, LUT_SIZE).rgb, rgb),\n"
+        "               dot(calibration(slice, LUT_SIZE + 1).rgb, rgb),\n"
+        "               dot(calibration(slice, LUT_SIZE + 2).rgb, rgb));\n"
+        "    dither = parameters.y > 0.5;\n"
+        "    return vec4(clamp(rgb * parameters.x, 0., 1.), color.a);\n"
+        "}\n"
+        "\n"
+        "// 4 values in [-0.5, 0.5) that are different for every pixel and frame\n"
+        "vec4 noise(int pixel) {\n"
+        "    uint h = uint(pixel) * 747796405u + uint(iFrameIndex) * 2891336453u;\n"
+        "    vec4 result;\n"
+        "    for (int i = 0; i < 4; i++) {\n"
+        "        h ^= h >> 16u;\n"
+        "        h *= 2246822519u;\n"
+        "        h ^= h >> 13u;\n"
+        "        h *= 3266489917u;\n"
+        "        h ^= h >> 16u;\n"
+        "        result[i] = float(h >> 8u) / 16777216. - 0.5;\n"
+        "    }\n"
+        "    return result;\n"
+        "}\n"
+        "\n"
+        "float quantize(float x, float steps, float offset) {\n"
+        "    return clamp(floor(x * steps + 0.5 + offset), 0., steps);\n"
+        "}\n"
+        "\n"
+        "float encode(vec4 color, vec4 offset, int code) {\n"
+        "    if (code < 4) return quantize(color[code], 255., offset[code]);\n"
+        "    if (code < 6) {\n"
+        "        int v = int(quantize(color.r, 31., offset.r)) * 2048\n"
+        "              + int(quantize(color.g, 63., offset.g)) * 32\n"
+        "              + int(quantize(color.b, 31., offset.b));\n"
+        "        return float(code == 4 ? v & 255 : v >> 8);\n"
+        "    }\n"
+        "    int c = (code - 6) / 2;\n"
+        "    int v = int(quantize(color[c], 65535., offset[c]));\n"
+        "    return float((code & 1) == 0 ? v & 255 : v >> 8);\n"
+        "}\n"
+        "\n"
+        "void main() {\n"
+        "    ivec4 bytes = texelFetch(iBytes, ivec2(gl_FragCoord.xy), 0);\n"
+        "    if (bytes.x < 0) discard;\n"
+        "    vec4 result = vec4(0.);\n"
+        "    int pixel = -1;\n"
+        "    vec4 color;\n"
+        "    vec4 offset;\n"
+        "    for (int i = 0; i < 4; i++) {\n"
+        "        if (bytes[i] < 0) continue;\n"
+        "        if (bytes[i] / 16 != pixel) {\n"
+        "            pixel = bytes[i] / 16;\n"
+        "            bool dither;\n"
+        "            color = lookup(pixel, dither);\n"
+        "            offset = dither ? noise(pixel) : vec4(0.);\n"
+        "        }\n"
+        "        result[i] = encode(color, offset, bytes[i] % 16);\n"
+        "    }\n"
+        "    fragColor = result / 255.;\n"
+        "}\n"};
+    return loadShader("encode", fragmentString);
+}
+
+void LightOutputSampler::setSlices(QList<Slice> slices) {
+    m_slices = slices;
+    m_firstPixels.clear();
+    m_firstTexels.clear();
+    m_pixelCount = 0;
+    m_texelCount = 0;
+    for (auto &slice : m_slices) {
+        auto pixels = slice.lookupCoordinates.size() / (4 * slice.lookupDimensions);
+        m_firstPixels.append(m_pixelCount);
+        m_firstTexels.append(m_texelCount);
+        m_pixelCount += pixels;
+        m_texelCount += (pixels * bytesPerPixel(slice.format) + 3) / 4;
+    }
+    m_firstPixels.append(m_pixelCount);
+    m_firstTexels.append(m_texelCount);
+    if (m_pixelCount == 0) return;
+
+    // (u, v, slice, t), one texel per pixel
+    auto lookupSize = imageSize(m_pixelCount);
+    QVector<float> lookup(4 * lookupSize.width() * lookupSize.height(), 0.f);
+    for (int i = 0; i < m_slices.count(); i++) {
+        auto coordinates = m_slices.at(i).lookupCoordinates.constData();
+        auto is3D = m_slices.at(i).lookupDimensions == 3;
+        for (int pixel = m_firstPixels.at(i); pixel < m_firstPixels.at(i + 1); pixel++) {
+            if (is3D) {
+                memcpy(&lookup[4 * pixel + 3], coordinates, 4);
+                coordinates += 4;
+            }
+            memcpy(&lookup[4 * pixel], coordinates, 8);
+            lookup[4 * pixel + 2] = i;
+            coordinates += 8;
+        }
+    }
+    if (lookupSize != QSize(m_lookupTexture.width(), m_lookupTexture.height())) {
+        if (m_lookupTexture.isCreated()) {
+            m_lookupTexture.destroy();
+        }
+        m_lookupTexture.setSize(lookupSize.width(), lookupSize.height());
+        m_lookupTexture.setFormat(QOpenGLTexture::RGBA32F);
+        m_lookupTexture.allocateStorage(QOpenGLTexture::RGBA, QOpenGLTexture::Float32);
+        m_lookupTexture.setMinMagFilters(QOpenGLTexture::Nearest, QOpenGLTexture::Nearest);
+        m_lookupTexture.setWrapMode(QOpenGLTexture::ClampToEdge);
+    }
+    m_lookupTexture.setData(QOpenGLTexture::RGBA, QOpenGLTexture::Float32, lookup.constData());
+
+    // One row per slice; see m_calibrationTexture
+    auto calibrationSize = QSize(LUT_SIZE + 4, m_slices.count());
+    QVector<float> calibration;
+    calibration.reserve(4 * calibrationSize.width() * calibrationSize.height());
+    for (auto &slice : m_slices) {
+        auto &c = slice.calibration;
+        for (int i = 0; i < LUT_SIZE; i++) {
+            auto value = c.lut.isEmpty() ? QVector3D(1, 1, 1) * i / (LUT_SIZE - 1) : c.lut.at(i);
+            calibration << value.x() << value.y() << value.z() << 0.f;
+        }
+        for (int row = 0; row < 3; row++) {
+            calibration << c.colorMatrix(row, 0) << c.colorMatrix(row, 1) << c.colorMatrix(row, 2) << 0.f;
+        }
+        calibration << c.maxBrightness << (c.dither ? 1.f : 0.f) << slice.layers.width() << slice.layers.height();
+    }
+    if (calibrationSize != QSize(m_calibrationTexture.width(), m_calibrationTexture.height())) {
+        if (m_calibrationTexture.isCreated()) {
+            m_calibrationTexture.destroy();
+        }
+        m_calibrationTexture.setSize(calibrationSize.width(), calibrationSize.height());
+        m_calibrationTexture.setFormat(QOpenGLTexture::RGBA32F);
+        m_calibrationTexture.allocateStorage(QOpenGLTexture::RGBA, QOpenGLTexture::Float32);
+        m_calibrationTexture.setMinMagFilters(QOpenGLTexture::Nearest, QOpenGLTexture::Nearest);
+        m_calibrationTexture.setWrapMode(QOpenGLTexture::ClampToEdge);
+    }
+    m_calibrationTexture.setData(QOpenGLTexture::RGBA, QOpenGLTexture::Float32, calibration.constData());
+
+    // What goes in each byte of the stream
+    auto size = imageSize(m_texelCount);
+    QVector<GLint> bytes(4 * size.width() * size.height(), -1);
+    for (int i = 0; i < m_slices.count(); i++) {
+        auto format = m_slices.at(i).format;
+        auto bytesPerPixel = LightOutputSampler::bytesPerPixel(format);
+        auto first = 4 * m_firstTexels.at(i);
+        for (int pixel = m_firstPixels.at(i); pixel < m_firstPixels.at(i + 1); pixel++) {
+            for (int byte = 0; byte < bytesPerPixel; byte++) {
+                bytes[first++] = 16 * pixel + byteCode(format, byte);
+            }
+        }
+    }
+    if (size != QSize(m_byteTexture.width(), m_byteTexture.height())) {
+        if (m_byteTexture.isCreated()) {
+            m_byteTexture.destroy();
+        }
+        m_byteTexture.setSize(size.width(), size.height());
+        m_byteTexture.setFormat(QOpenGLTexture::RGBA32I);
+        m_byteTexture.allocateStorage(QOpenGLTexture::RGBA_Integer, QOpenGLTexture::Int32);
+        m_byteTexture.setMinMagFilters(QOpenGLTexture::Nearest, QOpenGLTexture::Nearest);
+        m_byteTexture.setWrapMode(QOpenGLTexture::ClampToEdge);
+    }
+    m_byteTexture.setData(QOpenGLTexture::RGBA_Integer, QOpenGLTexture::Int32, bytes.constData());
+
+    if (m_fbo.isNull() || m_fbo->size() != size) {
+        auto fmt = QOpenGLFramebufferObjectFormat{};
+        fmt.setInternalTextureFormat(GL_RGBA8);
+        m_fbo = QSharedPointer<QOpenGLFramebufferObject>::create(size, fmt);
+    }
+
+    // Two colors per pixel; see sample()
+    auto sampleSize = imageSize(2 * m_pixelCount);
+    if (m_sampleFbo.isNull() || m_sampleFbo->size() != sampleSize) {
+        auto fmt = QOpenGLFramebufferObjectFormat{};
+        fmt.setInternalTextureFormat(GL_RGBA16F);
+        m_sampleFbo = QSharedPointer<QOpenGLFramebufferObject>::create(sampleSize, fmt);
+    }
+}
+
+int LightOutputSampler::sliceCount() const {
+    return m_slices.count();
+}
+
+int LightOutputSampler::byteOffset(int slice) const {
+    return 4 * m_firstTexels.at(slice);
+}
+
+int LightOutputSampler::byteCount(int slice) const {
+    return (m_firstPixels.at(slice + 1) - m_firstPixels.at(slice)) * bytesPerPixel(m_slices.at(slice).format);
+}
+
+int LightOutputSampler::readbackSize() const {
+    return 4 * m_texelCount;
+}
+
+bool LightOutputSampler::begin() {
+    if (m_pixelCount == 0) return false;
+    if (m_sampleShader.isNull() || m_encodeShader.isNull()) {
+        if (m_shaderFailed) return false;
+        m_sampleShader = loadSampleShader();
+        m_encodeShader = loadEncodeShader();
+        if (m_sampleShader.isNull() || m_encodeShader.isNull()) {
+            m_sampleShader.clear();
+            m_encodeShader.clear();
+            m_shaderFailed = true;
+            return false;
+        }
+    }
+    m_frameIndex = (m_frameIndex + 1) & 0xFFFFFF;
+    return true;
+}
+
+void LightOutputSampler::sample(GLuint texture, int first, int end, QRectF tileRect, QRectF interior) {
+    // Only the rows the slices occupy
+    auto width = m_sampleFbo->width();
+    auto firstRow = 2 * m_firstPixels.at(first) / width;
+    auto endRow = (2 * m_firstPixels.at(end) + width - 1) / width;
+    if (endRow <= firstRow) return;
+
+    // Whatever was rendered since the last call
+    // may have changed any of this
+    auto gl = QOpenGLContext::currentContext()->extraFunctions();
+    gl->glDisable(GL_DEPTH_TEST);
+    gl->glDisable(GL_BLEND);
+    m_sampleFbo->bind();
+    gl->glViewport(0, 0, m_sampleFbo->width(), m_sampleFbo->height());
+    gl->glEnable(GL_SCISSOR_TEST);
+    gl->glScissor(0, firstRow, width, endRow - firstRow);
+
+    m_sampleShader->bind();
+    gl->glActiveTexture(GL_TEXTURE1);
+    gl->glBindTexture(GL_TEXTURE_2D, m_lookupTexture.textureId());
+    gl->glActiveTexture(GL_TEXTURE2);
+    gl->glBindTexture(GL_TEXTURE_2D, m_calibrationTexture.textureId());
+    gl->glActiveTexture(GL_TEXTURE0);
+    gl->glBindTexture(GL_TEXTURE_2D, texture);
+    gl->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    gl->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    m_sampleShader->setUniformValue("iFrame", 0);
+    m_sampleShader->setUniformValue("iMap", 1);
+    m_sampleShader->setUniformValue("iCalibration", 2);
+    m_sampleShader->setUniformValue("iFirst", (GLint)m_firstPixels.at(first));
+    m_sampleShader->setUniformValue("iEnd", (GLint)m_firstPixels.at(end));
+    m_sampleShader->setUniformValue("iTileRect", QVector4D(tileRect.x(), tileRect.y(), tileRect.width(), tileRect.height()));
+    m_sampleShader->setUniformValue("iInterior", QVector4D(interior.x(), interior.y(), interior.x() + interior.width(), interior.y() + interior.height()));
+
+    gl->glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+
+    gl->glDisable(GL_SCISSOR_TEST);
+    m_sampleShader->release();
+    m_sampleFbo->release();
+}
+
+void LightOutputSampler::readPixels() {
+    auto gl = QOpenGLContext::currentContext()->extraFunctions();
+    gl->glDisable(GL_DEPTH_TEST);
+    gl->glDisable(GL_BLEND);
+    m_fbo->bind();
+    gl->glViewport(0, 0, m_fbo->width(), m_fbo->height());
+
+    m_encodeShader->bind();
+    gl->glActiveTexture(GL_TEXTURE1);
+    gl->glBindTexture(GL_TEXTURE_2D, m_lookupTexture.textureId());
+    gl->glActiveTexture(GL_TEXTURE2);
+    gl->glBindTexture(GL_TEXTURE_2D, m_calibrationTexture.textureId());
+    gl->glActiveTexture(GL_TEXTURE3);
+    gl->glBindTexture(GL_TEXTURE_2D, m_byteTexture.textureId());
+    gl->glActiveTexture(GL_TEXTURE0);
+    gl->glBindTexture(GL_TEXTURE_2D, m_sampleFbo->texture());
+    m_encodeShader->setUniformValue("iSamples", 0);
+    m_encodeShader->setUniformValue("iMap", 1);
+    m_encodeShader->setUniformValue("iCalibration", 2);
+    m_encodeShader->setUniformValue("iBytes", 3);
+    m_encodeShader->setUniformValue("iFrameIndex", (GLint)m_frameIndex);
+    gl->glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+
+    auto width = m_fbo->width();
+    // The full rows, then what there is of the last one
+    auto fullRows = m_texelCount / width;
+    auto lastRow = m_texelCount % width;
+    if (fullRows > 0) {
+        gl->glReadPixels(0, 0, width, fullRows, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    }
+    if (lastRow > 0) {
+        gl->glReadPixels(0, fullRows, lastRow, 1, GL_RGBA, GL_UNSIGNED_BYTE,
+                         (const void *)(qintptr)(4 * fullRows * width));
+    }
+}
+
+void LightOutputSampler::end() {
+    m_encodeShader->release();
+    m_fbo->release();
+}
@@ -0,0 +1,172 @@
+#pragma once
+
+#include <QByteArray>
+#include <QGenericMatrix>
+#include <QJsonObject>
+#include <QList>
+#include <QOpenGLFramebufferObject>
+#include <QOpenGLShaderProgram>
+#include <QOpenGLTexture>
+#include <QRectF>
+#include <QSharedPointer>
+#include <QString>
+#include <QVector>
+#include <QVector3D>
+
+// Samples a texture at the pixels that light output devices asked for,
+// corrects each color for its device's LEDs (see Calibration)
+// and encodes it the way the device wants it,
+// so that what is read back can be sent without touching it.
+//
+// The sampled image is a byte stream, 4 bytes to a texel,
+// in rows of READBACK_WIDTH texels.
+// Several devices ("slices") can be sampled into one image;
+// their streams are laid end to end,
+// each starting on a new texel.
+//
+// Sampling happens in two passes.
+// sample() gathers the colors under each pixel's lookup coordinates
+// (two per pixel, for blending layers) into an intermediate image,
+// and may be called once per tile of a tiled output,
+// each call filling in the pixels that fall in its tile.
+// readPixels() then calibrates and encodes the gathered colors.
+//
+// Everything but the static methods must be called
+// with the same OpenGL context current.
+
+class LightOutputSampler {
+public:
+    // The pixel formats that devices can ask for
+    enum Format {
+        // red, green, blue, alpha: 1 byte each
+        RGBA8,
+        // red, green, blue: 1 byte each
+        RGB8,
+        // A little-endian uint16 with 5 bits of red (the high bits),
+        // 6 of green and 5 of blue
+        RGB565,
+        // red, green, blue: a little-endian uint16 each
+        RGB16,
+    };
+
+    // Understands "rgba8", "rgb8", "rgb565" and "rgb16".
+    // Returns false for anything else.
+    static bool parseFormat(QString name, Format *format);
+    static int bytesPerPixel(Format format);
+
+    // How to turn a sampled color into what a device's LEDs should show.
+    // In order: the gamma curve, the color matrix,
+    // the brightness limit, then dithering.
+    struct Calibration {
+        // LUT_SIZE output values per channel
+        // for inputs evenly spaced from 0 to 1,
+        // interpolated in between.
+        // Empty for none.
+        QVector<QVector3D> lut;
+        // Multiplies (red, green, blue), e.g. to white balance
+        QMatrix3x3 colorMatrix;
+        // Every channel is scaled by this,
+        // e.g. to keep a power supply within budget
+        float maxBrightness{1.f};
+        // Adds noise that changes from frame to frame before rounding,
+        // so that levels in between output steps
+        // come out right on average instead of banding
+        bool dither{};
+
+        bool operator==(const Calibration &other) const;
+        bool operator!=(const Calibration &other) const;
+    };
+    static constexpr int LUT_SIZE = 256;
+
+    // Reads the calibration keys of a device description:
+    // "gamma", "gamma_lut", "color_matrix", "max_brightness" and "dither".
+    // Returns false and describes the problem if any of them is malformed,
+    // in which case calibration is left as it was.
+    static bool parseCalibration(QJsonObject description, Calibration *calibration, QString *error);
+
+    struct Slice {
+        // As in the "lookup coordinates 2D" packet (u, v)
+        // or the "lookup coordinates 3D" packet (t, u, v),
+        // depending on lookupDimensions
+        QByteArray lookupCoordinates;
+        int lookupDimensions{2};
+        // For 3D lookups, the canvas holds a stack of layers
+        // in a grid of this many columns and rows,
+        // the first at the top left (uv 0, 0), left to right, then down.
+        // t goes from the first layer (0) to the last (1),
+        // blending the two nearest.
+        QSize layers{1, 1};
+        Format format{RGBA8};
+        Calibration calibration;
+    };
+
+    LightOutputSampler();
+   ~LightOutputSampler();
+
+    // Lays out the slices and uploads their lookup coordinates
+    void setSlices(QList<Slice> slices);
+
+    int sliceCount() const;
+    // Where the slice's bytes start in the read back stream
+    int byteOffset(int slice) const;
+    // The number of bytes the slice's pixels encode to
+    int byteCount(int slice) const;
+    // The number of bytes readPixels() writes
+    int readbackSize() const;
+
+    // Starts a frame.
+    // Returns false if there is nothing to sample
+    // or the shaders could not be loaded.
+    bool begin();
+
+    // Samples the texture into slices [first, end).
+    // The texture covers tileRect of the canvas,
+    // and only lookup coordinates within interior are taken from it,
+    // both as fractions of the canvas (x, y, width, height.)
+    // Must be called between begin() and end()
+    // with a VAO bound.
+    // Other rendering may happen in between calls.
+    void sample(GLuint texture, int first, int end,
+                QRectF tileRect=QRectF(0, 0, 1, 1), QRectF interior=QRectF(0, 0, 1, 1));
+
+    // Encodes what was sampled and reads the whole stream back
+    // into the pixel pack buffer that is bound, at offset 0.
+    // Must be called between begin() and end()
+    // with a VAO bound.
+    void readPixels();
+
+    void end();
+
+    static constexpr int READBACK_WIDTH = 1024;
+
+protected:
+    static QSharedPointer<QOpenGLShaderProgram> loadShader(QString name, QString fragmentString);
+    QSharedPointer<QOpenGLShaderProgram> loadSampleShader();
+    QSharedPointer<QOpenGLShaderProgram> loadEncodeShader();
+    static QSize imageSize(int texels);
+
+    QList<Slice> m_slices;
+    QVector<int> m_firstPixels;
+    QVector<int> m_firstTexels;
+    int m_pixelCount{};
+    int m_texelCount{};
+
+    QSharedPointer<QOpenGLShaderProgram> m_sampleShader;
+    QSharedPointer<QOpenGLShaderProgram> m_encodeShader;
+    bool m_shaderFailed{};
+    // The colors gathered by sample(), 2 texels per pixel
+    QSharedPointer<QOpenGLFramebufferObject> m_sampleFbo;
+    // The encoded stream
+    QSharedPointer<QOpenGLFramebufferObject> m_fbo;
+    // Lookup coordinates and which slice the pixel is in:
+    // (u, v, slice, t), 1 texel per pixel
+    QOpenGLTexture m_lookupTexture;
+    // 1 row per slice: the LUT, then the color matrix,
+    // then (max brightness, dither, layer columns, layer rows)
+    QOpenGLTexture m_calibrationTexture;
+    // Seeds the dithering
+    int m_frameIndex{};
+    // Which pixel and which part of its color each byte holds,
+    // 1 texel per sampled texel
+    QOpenGLTexture m_byteTexture;
+};
@@ -0,0 +1,53 @@
+#include "LockStatistics.h"
+
+void LockStatistics::updateMax(std::atomic<qint64> &max, qint64 value) {
+    auto current = max.load(std::memory_order_relaxed);
+    while (value > current && !max.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+    }
+}
+
+void LockStatistics::record(qint64 waitNs, qint64 holdNs) {
+    m_count.fetch_add(1, std::memory_order_relaxed);
+    m_waitTotal.fetch_add(waitNs, std::memory_order_relaxed);
+    m_holdTotal.fetch_add(holdNs, std::memory_order_relaxed);
+    updateMax(m_waitMax, waitNs);
+    updateMax(m_holdMax, holdNs);
+}
+
+QVariantMap LockStatistics::toVariantMap() const {
+    QVariantMap result;
+    result.insert("count", m_count.load());
+    result.insert("waitTotalUs", m_waitTotal.load() / 1000.);
+    result.insert("waitMaxUs", m_waitMax.load() / 1000.);
+    result.insert("holdTotalUs", m_holdTotal.load() / 1000.);
+    result.insert("holdMaxUs", m_holdMax.load() / 1000.);
+    return result;
+}
+
+void LockStatistics::reset() {
+    m_count = 0;
+    m_waitTotal = 0;
+    m_waitMax = 0;
+    m_holdTotal = 0;
+    m_holdMax = 0;
+}
+
+TimedMutexLocker::TimedMutexLocker(QMutex *mutex, LockStatistics *statistics)
+    : m_mutex(mutex)
+    , m_statistics(statistics) {
+    m_timer.start();
+    m_mutex->lock();
+    m_waitNs = m_timer.nsecsElapsed();
+}
+
+TimedMutexLocker::~TimedMutexLocker() {
+    unlock();
+}
+
+void TimedMutexLocker::unlock() {
+    if (m_mutex == nullptr) return;
+    auto holdNs = m_timer.nsecsElapsed() - m_waitNs;
+    m_mutex->unlock();
+    m_mutex = nullptr;
+    m_statistics->record(m_waitNs, holdNs);
+}
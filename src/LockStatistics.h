@@ -0,0 +1,51 @@
+#pragma once
+
+#include <QMutex>
+#include <QElapsedTimer>
+#include <QVariantMap>
+#include <atomic>
+
+// This class accumulates how long a lock
+// was waited on and held for.
+// It is thread-safe and cheap enough
+// to leave enabled on the render path.
+
+class LockStatistics {
+public:
+    // Record one acquisition of the lock
+    void record(qint64 waitNs, qint64 holdNs);
+
+    // Returns count, waitTotalUs, waitMaxUs, holdTotalUs, holdMaxUs
+    QVariantMap toVariantMap() const;
+
+    void reset();
+
+protected:
+    static void updateMax(std::atomic<qint64> &max, qint64 value);
+
+    std::atomic<qint64> m_count{0};
+    std::atomic<qint64> m_waitTotal{0};
+    std::atomic<qint64> m_waitMax{0};
+    std::atomic<qint64> m_holdTotal{0};
+    std::atomic<qint64> m_holdMax{0};
+};
+
+// This class works like QMutexLocker,
+// but records how long it waited for and held the mutex
+// into the given LockStatistics.
+
+class TimedMutexLocker {
+public:
+    TimedMutexLocker(QMutex *mutex, LockStatistics *statistics);
+    ~TimedMutexLocker();
+
+    void unlock();
+
+private:
+    Q_DISABLE_COPY(TimedMutexLocker)
+
+    QMutex *m_mutex;
+    LockStatistics *m_statistics;
+    QElapsedTimer m_timer;
+    qint64 m_waitNs{};
+};
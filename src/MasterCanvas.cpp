@@ -0,0 +1,145 @@
+#include "MasterCanvas.h"
+#include <QCoreApplication>
+#include <QDebug>
+#include <QOpenGLExtraFunctions>
+#include <QSurface>
+#include <QThread>
+#include <cmath>
+
+QMap<QString, QWeakPointer<MasterCanvas>> MasterCanvas::s_canvases;
+
+MasterCanvas::MasterCanvas(QString name)
+    : m_name(name)
+    , m_chain(new Chain(QSize(640, 480)), &QObject::deleteLater)
+{
+    // Canvases are for projectors,
+    // which get the extra precision by default
+    m_chain->setRenderFormat(GL_RGBA16F);
+
+    auto previousContext = QOpenGLContext::currentContext();
+    auto previousSurface = previousContext != nullptr ? previousContext->surface() : nullptr;
+    m_context = QSharedPointer<OpenGLWorkerContext>(new OpenGLWorkerContext(false), &QObject::deleteLater);
+    if (previousContext != nullptr) {
+        previousContext->makeCurrent(previousSurface);
+    }
+}
+
+MasterCanvas::~MasterCanvas() {
+    // Don't remove a newer canvas with the same name
+    if (s_canvases.value(m_name).isNull()) {
+        s_canvases.remove(m_name);
+    }
+
+    auto previousContext = QOpenGLContext::currentContext();
+    auto previousSurface = previousContext != nullptr ? previousContext->surface() : nullptr;
+    m_context->makeCurrent();
+    auto gl = QOpenGLContext::currentContext()->extraFunctions();
+    if (m_rendered != 0) gl->glDeleteSync(m_rendered);
+    for (auto fence : m_consumed) {
+        gl->glDeleteSync(fence);
+    }
+    m_chain->releaseContextResources();
+    for (auto chain : m_retiredChains) {
+        chain->releaseContextResources();
+    }
+    if (previousContext != nullptr) {
+        previousContext->makeCurrent(previousSurface);
+    }
+}
+
+QSharedPointer<MasterCanvas> MasterCanvas::get(QString name) {
+    Q_ASSERT(QThread::currentThread() == qApp->thread());
+    auto existing = s_canvases.value(name).toStrongRef();
+    if (!existing.isNull()) return existing;
+    auto canvas = QSharedPointer<MasterCanvas>(new MasterCanvas(name), &QObject::deleteLater);
+    s_canvases.insert(name, canvas);
+    return canvas;
+}
+
+QString MasterCanvas::name() const {
+    return m_name;
+}
+
+QSharedPointer<Chain> MasterCanvas::chain() const {
+    return m_chain;
+}
+
+void MasterCanvas::setMember(const void *member, QSize size, QRectF region) {
+    m_members.insert(member, Member{size, region});
+    resize();
+}
+
+void MasterCanvas::removeMember(const void *member) {
+    m_members.remove(member);
+    m_seen.remove(member);
+    // The fence is left for the next round to wait on
+    resize();
+}
+
+void MasterCanvas::resize() {
+    // Big enough that no member has to upscale its region
+    QSize size(1, 1);
+    for (auto &member : m_members) {
+        auto width = member.region.width() > 0 ? member.size.width() / member.region.width() : 0;
+        auto height = member.region.height() > 0 ? member.size.height() / member.region.height() : 0;
+        size = size.expandedTo(QSize(std::ceil(width), std::ceil(height)));
+    }
+    if (m_members.isEmpty() || size == m_chain->size()) return;
+
+    // The old chain's objects on our context are freed
+    // the next time it is current
+    m_retiredChains.append(m_chain);
+    m_chain = QSharedPointer<Chain>(new Chain(m_chain.data(), size), &QObject::deleteLater);
+    m_result.clear();
+    m_seen.clear();
+    emit chainChanged(m_chain);
+}
+
+QMap<QSharedPointer<VideoNode>, GLuint> MasterCanvas::render(const void *consumer, QWeakPointer<Model> model) {
+    if (m_result.isEmpty() || m_seen.contains(consumer)) {
+        auto previousContext = QOpenGLContext::currentContext();
+        auto previousSurface = previousContext != nullptr ? previousContext->surface() : nullptr;
+        m_context->makeCurrent();
+        auto gl = QOpenGLContext::currentContext()->extraFunctions();
+
+        // Don't draw over textures that consumers may still be reading
+        for (auto fence : m_consumed) {
+            gl->glWaitSync(fence, 0, GL_TIMEOUT_IGNORED);
+            gl->glDeleteSync(fence);
+        }
+        m_consumed.clear();
+        if (m_rendered != 0) {
+            gl->glDeleteSync(m_rendered);
+            m_rendered = 0;
+        }
+        for (auto chain : m_retiredChains) {
+            chain->releaseContextResources();
+        }
+        m_retiredChains.clear();
+
+        m_result = Model::createCopyForRendering(model).render(m_chain);
+
+        // Consumers can only see the fence once it is flushed
+        m_rendered = gl->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        gl->glFlush();
+        m_seen.clear();
+
+        if (previousContext != nullptr) {
+            previousContext->makeCurrent(previousSurface);
+        }
+    }
+
+    m_seen.insert(consumer);
+    if (m_rendered != 0) {
+        QOpenGLContext::currentContext()->extraFunctions()->glWaitSync(m_rendered, 0, GL_TIMEOUT_IGNORED);
+    }
+    return m_result;
+}
+
+void MasterCanvas::finished(const void *consumer) {
+    auto gl = QOpenGLContext::currentContext()->extraFunctions();
+    auto fence = m_consumed.value(consumer, 0);
+    if (fence != 0) gl->glDeleteSync(fence);
+    m_consumed.insert(consumer, gl->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0));
+    gl->glFlush();
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "Chain.h"
+#include "Model.h"
+#include "OpenGLWorkerContext.h"
+#include <QObject>
+#include <QSharedPointer>
+#include <QMap>
+#include <QSet>
+#include <QRectF>
+
+// A chain shared by several outputs,
+// each of which shows a region of it
+// (e.g. the projectors of an edge-blended wall.)
+//
+// The model is rendered onto the canvas once per round,
+// where a round ends as soon as any output asks for a frame
+// it has already been given.
+// With outputs running at the same rate,
+// that is once per frame no matter how many outputs there are.
+//
+// The canvas renders on a context of its own,
+// since node state for a chain can only live on one context,
+// and hands the result to the outputs' contexts with fences.
+// The canvas is sized so that every output's region
+// gets at least as many pixels as the output has.
+//
+// Everything here must happen on the GUI thread,
+// which is where OutputWindows paint.
+
+class MasterCanvas : public QObject {
+    Q_OBJECT
+
+public:
+   ~MasterCanvas() override;
+
+    // Returns the canvas with the given name,
+    // creating it if no output is using it yet
+    static QSharedPointer<MasterCanvas> get(QString name);
+
+    QString name() const;
+    QSharedPointer<Chain> chain() const;
+
+    // Outputs tell the canvas how big they are
+    // and which part of the canvas they show (as a fraction of it)
+    // so that it can size itself
+    void setMember(const void *member, QSize size, QRectF region);
+    void removeMember(const void *member);
+
+    // Returns the textures of every node
+    // for the current round,
+    // starting a new round first if `consumer` has already seen this one.
+    // The textures may be sampled from the current context
+    // until finished() is called.
+    QMap<QSharedPointer<VideoNode>, GLuint> render(const void *consumer, QWeakPointer<Model> model);
+
+    // Called from the consumer's context
+    // once it has issued every draw that reads this round's textures
+    void finished(const void *consumer);
+
+signals:
+    // Emitted when the canvas is resized,
+    // which replaces the chain
+    void chainChanged(QSharedPointer<Chain> chain);
+
+protected:
+    MasterCanvas(QString name);
+    void resize();
+
+    struct Member {
+        QSize size;
+        QRectF region;
+    };
+
+    QString m_name;
+    QSharedPointer<Chain> m_chain;
+    QList<QSharedPointer<Chain>> m_retiredChains;
+    QSharedPointer<OpenGLWorkerContext> m_context;
+    QMap<const void *, Member> m_members;
+
+    QMap<QSharedPointer<VideoNode>, GLuint> m_result;
+    // Set on the canvas's context after rendering a round
+    GLsync m_rendered{};
+    // Set on each consumer's context after it is done with a round
+    QMap<const void *, GLsync> m_consumed;
+    QSet<const void *> m_seen;
+
+    static QMap<QString, QWeakPointer<MasterCanvas>> s_canvases;
+};
@@ -34,17 +34,19 @@ Model::Model() {
 }
 
 void Model::addChain(QSharedPointer<Chain> chain) {
-    if (!m_chains.contains(chain)) {
+    if (m_chainRequests[chain]++ == 0) {
         m_chains.append(chain);
         emit chainsChanged(m_chains);
     }
 }
 
 void Model::removeChain(QSharedPointer<Chain> chain) {
-    if (m_chains.contains(chain)) {
-        m_chains.removeAll(chain);
-        emit chainsChanged(m_chains);
-    }
+    auto requests = m_chainRequests.find(chain);
+    if (requests == m_chainRequests.end()) return;
+    if (--*requests > 0) return;
+    m_chainRequests.erase(requests);
+    m_chains.removeAll(chain);
+    emit chainsChanged(m_chains);
 }
 
 QList<QSharedPointer<Chain>> Model::chains() {
@@ -69,9 +71,7 @@ void Model::prepareNode(VideoNodeSP *videoNode) {
     // See if this VideoNodeSP requests any chains
     auto requestedChains = (*videoNode)->requestedChains();
     for (auto c = requestedChains.begin(); c != requestedChains.end(); c++) {
-        if (!m_chains.contains(*c)) {
-            addChain(*c);
-        }
+        addChain(*c);
     }
     // and be notified of changes
     connect(videoNode->data(), &VideoNode::requestedChainAdded, this, &Model::addChain);
@@ -92,13 +92,8 @@ void Model::disownNode(VideoNodeSP *videoNode) {
     disconnect(videoNode->data(), &VideoNode::error, this, &Model::onError);
 
     auto requestedChains = (*videoNode)->requestedChains();
-    auto chains = m_chains;
     for (auto c = requestedChains.begin(); c != requestedChains.end(); c++) {
-        m_chains.removeAll(*c);
-    }
-
-    if (chains != m_chains) {
-        emit chainsChanged(m_chains);
+        removeChain(*c);
     }
 }
 
@@ -493,11 +488,12 @@ QVariantList Model::qmlDescendants(VideoNodeSP *vn) const {
 }
 
 QMap<QSharedPointer<VideoNode>, GLuint> ModelCopyForRendering::render(QSharedPointer<Chain> chain) {
-    // inputs is parallel to vertices
-    // and contains the VideoNodes connected to the
-    // corresponding vertex's inputs
+    chain->beginFrame();
+    return renderInFrame(chain);
+}
+
+QVector<QVector<int>> ModelCopyForRendering::inputIndices() const {
     QVector<QVector<int>> inputs;
-    auto vao = chain->vao();
 
     // Create a list of -1's
     for (int i=0; i<vertices.count(); i++) {
@@ -514,13 +510,25 @@ QMap<QSharedPointer<VideoNode>, GLuint> ModelCopyForRendering::render(QSharedPoi
                 inputs[to][toInput.at(i)] = fromVertex.at(i);
         }
     }
+    return inputs;
+}
+
+QMap<QSharedPointer<VideoNode>, GLuint> ModelCopyForRendering::renderInFrame(QSharedPointer<Chain> chain) {
+    // inputs is parallel to vertices
+    // and contains the VideoNodes connected to the
+    // corresponding vertex's inputs
+    auto inputs = inputIndices();
+    auto vao = chain->vao();
 
     QVector<GLuint> resultTextures(vertices.count(), 0);
 
     for (int i=0; i<vertices.count(); i++) {
         auto vertex = vertices.at(i);
-        QVector<GLuint> inputTextures(vertex->inputCount(), chain->blankTexture());
-        for (int j=0; j<vertex->inputCount(); j++) {
+        // Use the input count from above
+        // in case it changed in the meantime
+        auto inputCount = inputs.at(i).count();
+        QVector<GLuint> inputTextures(inputCount, chain->blankTexture());
+        for (int j=0; j<inputCount; j++) {
             auto fromVertex = inputs.at(i).at(j);
             if (fromVertex != -1) {
                 auto inpTexture = resultTextures.at(fromVertex);
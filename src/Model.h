@@ -38,10 +38,19 @@ struct ModelCopyForRendering {
     QVector<int> toVertex;
     QVector<int> toInput;
 
+    // For each vertex, the index of the vertex
+    // connected to each of its inputs, or -1
+    QVector<QVector<int>> inputIndices() const;
+
     // Render this model
     // The return value is a mapping of VideoNodes to OpenGL textures
     // that were rendered into
     QMap<QSharedPointer<VideoNode>, GLuint> render(QSharedPointer<Chain> chain);
+
+    // Like render, but as part of a frame of the chain
+    // that is already under way,
+    // e.g. for a model nested inside another one
+    QMap<QSharedPointer<VideoNode>, GLuint> renderInFrame(QSharedPointer<Chain> chain);
 };
 
 // These functions are not thread-safe unless noted.
@@ -136,6 +145,9 @@ public slots:
     // or a different thead.
     // When requesting a render of the model,
     // you must use one of its chains.
+    // Chains are reference counted,
+    // since several nodes may request the same chain,
+    // so every addChain needs a matching removeChain.
     QList<QSharedPointer<Chain>> chains();
     void addChain(QSharedPointer<Chain> chain);
     void removeChain(QSharedPointer<Chain> chain);
@@ -189,6 +201,8 @@ protected:
 
     // Chains used for rendering this model
     QList<QSharedPointer<Chain>> m_chains;
+    // How many times each chain was added
+    QMap<QSharedPointer<Chain>, int> m_chainRequests;
 
     // Find which VideoNodeSP* in this model
     // emitted a signal
@@ -270,7 +270,7 @@ GLuint MovieNode::paint(QSharedPointer<Chain> chain, QVector<GLuint> inputTextur
     // and leave lightweight FBO creation here
     if(!renderFbo || renderFbo->size() != chain->size()) {
         auto fmt = QOpenGLFramebufferObjectFormat{};
-        fmt.setInternalTextureFormat(GL_RGBA);
+        fmt.setInternalTextureFormat(chain->renderFormat());
         renderFbo = renderState->m_output = QSharedPointer<QOpenGLFramebufferObject>::create(chain->size(), fmt);
     }
 
@@ -294,8 +294,11 @@ GLuint MovieNode::paint(QSharedPointer<Chain> chain, QVector<GLuint> inputTextur
 
             blitShader->setUniformValue("iVideoFrame", 0);
 
-            auto factorFitX = (float)fboi->height() * renderFbo->width() / fboi->width() / renderFbo->height();
-            auto factorFitY = (float)fboi->width() * renderFbo->height() / fboi->height() / renderFbo->width();
+            // Fit the video to the whole canvas,
+            // not just the tile being rendered
+            auto canvasSize = chain->canvasSize();
+            auto factorFitX = (float)fboi->height() * canvasSize.width() / fboi->width() / canvasSize.height();
+            auto factorFitY = (float)fboi->width() * canvasSize.height() / fboi->height() / canvasSize.width();
 
             switch(f) {
                 case Shrink:
@@ -313,6 +316,7 @@ GLuint MovieNode::paint(QSharedPointer<Chain> chain, QVector<GLuint> inputTextur
                     break;
             }
             blitShader->setUniformValue("iFactor", GLfloat(factorFitX), GLfloat(factorFitY));
+            blitShader->setUniformValue("iTileRect", chain->normalizedTileRect());
 
             glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
             renderFbo->release();
@@ -370,8 +374,10 @@ void MovieNodeOpenGLWorker::initialize(QString filename) {
     mpv_set_property_string(m_mpv, "hwdec", "auto");
     mpv_set_property_string(m_mpv, "scale", "spline36");
     mpv_set_property_string(m_mpv, "loop", "inf");
-    mpv_set_property_string(m_mpv, "fbo-format", "rgba32f");
-    mpv_set_property_string(m_mpv, "opengl-fbo-format", "rgba32f");
+    // Half floats are plenty for 8 and 10 bit video
+    // and take half the bandwidth of rgba32f
+    mpv_set_property_string(m_mpv, "fbo-format", "rgba16f");
+    mpv_set_property_string(m_mpv, "opengl-fbo-format", "rgba16f");
 
     // Make use of the MPV_SUB_API_OPENGL_CB API.
     mpv::qt::set_option_variant(m_mpv, "vo", "opengl-cb");
@@ -621,11 +627,12 @@ QSharedPointer<QOpenGLShaderProgram> MovieNodeOpenGLWorker::loadBlitShader(Movie
     auto vertexString = QString{
         "#version 150\n"
         "out vec2 uv;\n"
+        "uniform vec4 iTileRect;\n"
         "const vec2 varray[4] = vec2[](vec2(1., 1.),vec2(1., -1.),vec2(-1., 1.),vec2(-1., -1.));\n"
         "void main() {\n"
         "    vec2 vertex = varray[gl_VertexID];\n"
         "    gl_Position = vec4(vertex,0.,1.);\n"
-        "    uv = 0.5*(vertex+1.);\n"
+        "    uv = iTileRect.xy + iTileRect.zw * 0.5*(vertex+1.);\n"
         "}\n"};
     auto fragmentString = QString{
         "#version 150\n"
@@ -5,14 +5,50 @@
 OutputNode::OutputNode(Context *context, QSize chainSize)
     : VideoNode(context)
     , m_chain(new Chain(chainSize), &QObject::deleteLater)
+    , m_outputSize(chainSize)
 {
     setInputCount(1);
+    m_requestedChains.append(m_chain);
 }
 
 QList<QSharedPointer<Chain>> OutputNode::requestedChains() {
-    auto l = QList<QSharedPointer<Chain>>();
-    l.append(chain());
-    return l;
+    QMutexLocker locker(&m_stateLock);
+    return m_requestedChains;
+}
+
+QList<QSharedPointer<Chain>> OutputNode::currentChains() {
+    QList<QSharedPointer<Chain>> chains;
+    if (m_tiles.isEmpty()) {
+        chains.append(m_chain);
+    } else {
+        for (auto &tile : m_tiles) {
+            chains.append(tile.chain);
+        }
+    }
+    return chains;
+}
+
+void OutputNode::updateRequestedChains() {
+    QList<QSharedPointer<Chain>> added;
+    QList<QSharedPointer<Chain>> removed;
+    {
+        QMutexLocker locker(&m_stateLock);
+        auto chains = currentChains();
+        for (auto chain : chains) {
+            if (!m_requestedChains.contains(chain)) added.append(chain);
+        }
+        for (auto chain : m_requestedChains) {
+            if (!chains.contains(chain)) removed.append(chain);
+        }
+        m_requestedChains = chains;
+    }
+    // Add first so that nodes never go without a chain
+    for (auto chain : added) {
+        emit requestedChainAdded(chain);
+    }
+    for (auto chain : removed) {
+        emit requestedChainRemoved(chain);
+    }
 }
 
 GLuint OutputNode::paint(QSharedPointer<Chain> chain, QVector<GLuint> inputTextures) {
@@ -25,15 +61,146 @@ GLuint OutputNode::render() {
 }
 
 GLuint OutputNode::render(QWeakPointer<Model> model) {
+    if (tileCount() > 0) return 0;
+    GLuint result = 0;
+    renderTiles(model, [&result](GLuint texture, QRect tileRect, QRect interior) {
+        Q_UNUSED(tileRect);
+        Q_UNUSED(interior);
+        result = texture;
+    });
+    return result;
+}
+
+void OutputNode::renderTiles(TileCallback draw) {
+    renderTiles(lastModel(), draw);
+}
+
+void OutputNode::renderTiles(QWeakPointer<Model> model, TileCallback draw) {
+    bool dynamicResolution;
+    qreal targetFrameTime;
+    qreal minRenderScale;
+    qreal maxRenderScale;
+    qreal renderScale;
+    QList<Tile> tiles;
+    {
+        QMutexLocker locker(&m_stateLock);
+        dynamicResolution = m_dynamicResolution;
+        targetFrameTime = m_targetFrameTime;
+        minRenderScale = m_minRenderScale;
+        maxRenderScale = m_maxRenderScale;
+        renderScale = m_renderScale;
+        tiles = m_tiles;
+    }
+
+    auto self = qSharedPointerCast<VideoNode>(sharedFromThis());
     auto modelCopy = Model::createCopyForRendering(model);
-    auto result = modelCopy.render(chain());
-    return result.value(qSharedPointerCast<VideoNode>(sharedFromThis()), 0);
+    auto renderAll = [&]() {
+        if (tiles.isEmpty()) {
+            auto result = renderModel(modelCopy);
+            auto size = chain()->size();
+            draw(result.value(self, 0), QRect(QPoint(0, 0), size), QRect(QPoint(0, 0), size));
+            return;
+        }
+        for (auto &tile : tiles) {
+            auto result = modelCopy.render(tile.chain);
+            draw(result.value(self, 0), tile.chain->tileRect(), tile.interior);
+        }
+    };
+
+    if (!dynamicResolution) {
+        m_renderScaleController.reset();
+        renderAll();
+        return;
+    }
+
+    m_renderScaleController.setTargetFrameTime(targetFrameTime);
+    m_renderScaleController.setScaleRange(minRenderScale, maxRenderScale);
+    m_renderScaleController.beginFrame();
+    renderAll();
+    m_renderScaleController.endFrame();
+
+    auto newRenderScale = m_renderScaleController.scale();
+    if (newRenderScale != renderScale) {
+        // Resizing the chain must happen on this node's thread
+        QMetaObject::invokeMethod(this, "setRenderScale", Qt::QueuedConnection, Q_ARG(qreal, newRenderScale));
+    }
+}
+
+QMap<QSharedPointer<VideoNode>, GLuint> OutputNode::renderModel(ModelCopyForRendering &modelCopy) {
+    // The contexts and the chain are changed together
+    QList<QSharedPointer<OpenGLWorkerContext>> renderContexts;
+    QSharedPointer<Chain> chain;
+    qreal renderSubmissionOverlap;
+    {
+        QMutexLocker locker(&m_stateLock);
+        renderContexts = m_renderContexts;
+        chain = m_chain;
+        renderSubmissionOverlap = m_renderSubmissionOverlap;
+    }
+
+    m_renderScheduler.setWorkerContexts(renderContexts);
+    auto result = m_renderScheduler.render(modelCopy, chain);
+    if (m_renderScheduler.retiredChain() == chain) {
+        QMetaObject::invokeMethod(this, "renewChain", Qt::QueuedConnection, Q_ARG(QSharedPointer<Chain>, chain));
+    }
+
+    // Only report meaningful changes
+    auto overlap = m_renderScheduler.submissionOverlap();
+    if (qAbs(overlap - renderSubmissionOverlap) >= 0.05) {
+        QMetaObject::invokeMethod(this, "setRenderSubmissionOverlap", Qt::QueuedConnection, Q_ARG(qreal, overlap));
+    }
+    return result;
+}
+
+QJsonObject OutputNode::serialize() {
+    QJsonObject o = VideoNode::serialize();
+    o.insert("renderFormat", renderFormat());
+    o.insert("dynamicResolution", dynamicResolution());
+    o.insert("targetFrameTime", targetFrameTime());
+    o.insert("minRenderScale", minRenderScale());
+    o.insert("maxRenderScale", maxRenderScale());
+    o.insert("renderThreads", renderThreads());
+    o.insert("maxTileSize", maxTileSize());
+    o.insert("tileOverlap", tileOverlap());
+    return o;
+}
+
+void OutputNode::deserializeSettings(QJsonObject obj) {
+    if (obj.contains("renderFormat")) {
+        setRenderFormat(obj.value("renderFormat").toString());
+    }
+    if (obj.contains("targetFrameTime")) {
+        setTargetFrameTime(obj.value("targetFrameTime").toDouble());
+    }
+    if (obj.contains("minRenderScale")) {
+        setMinRenderScale(obj.value("minRenderScale").toDouble());
+    }
+    if (obj.contains("maxRenderScale")) {
+        setMaxRenderScale(obj.value("maxRenderScale").toDouble());
+    }
+    if (obj.contains("dynamicResolution")) {
+        setDynamicResolution(obj.value("dynamicResolution").toBool());
+    }
+    if (obj.contains("renderThreads")) {
+        setRenderThreads(obj.value("renderThreads").toInt());
+    }
+    if (obj.contains("tileOverlap")) {
+        setTileOverlap(obj.value("tileOverlap").toInt());
+    }
+    // Outputs that can't be tiled save 0, which is the default anyway
+    if (obj.value("maxTileSize").toInt() > 0) {
+        setMaxTileSize(obj.value("maxTileSize").toInt());
+    }
 }
 
 void OutputNode::setWorkerContext(OpenGLWorkerContext *context) {
+    QMutexLocker locker(&m_stateLock);
     m_workerContext = context;
     if (m_workerContext != nullptr) {
         m_chain->moveToWorkerContext(m_workerContext);
+        for (auto &tile : m_tiles) {
+            tile.chain->moveToWorkerContext(m_workerContext);
+        }
     }
 }
 
@@ -42,19 +209,281 @@ QSharedPointer<Chain> OutputNode::chain() {
     return m_chain;
 }
 
+QSize OutputNode::outputSize() {
+    QMutexLocker locker(&m_stateLock);
+    return m_outputSize;
+}
+
+QSize OutputNode::scaledSize(QSize size, qreal scale) {
+    return QSize(qMax(1, qRound(size.width() * scale)),
+                 qMax(1, qRound(size.height() * scale)));
+}
+
 void OutputNode::resize(QSize size) {
-    QSharedPointer<Chain> oldChain;
-    QSharedPointer<Chain> newChain;
+    QSize chainSize;
+    {
+        QMutexLocker locker(&m_stateLock);
+        m_outputSize = size;
+        chainSize = scaledSize(size, m_renderScale);
+    }
+    resizeChain(chainSize);
+}
+
+void OutputNode::resizeChain(QSize size) {
+    replaceChain(size, chain()->renderFormat());
+}
+
+void OutputNode::replaceChain(QSize size, GLenum format) {
     {
         QMutexLocker locker(&m_stateLock);
-        oldChain = m_chain;
-        if (size == oldChain->size()) return;
-        newChain = QSharedPointer<Chain>(new Chain(oldChain.data(), size), &QObject::deleteLater);
-        m_chain = newChain;
+        auto oldChain = m_chain;
+        if (size == oldChain->size() && format == oldChain->renderFormat()) return;
+        m_chain = QSharedPointer<Chain>(new Chain(oldChain.data(), size), &QObject::deleteLater);
+        m_chain->setRenderFormat(format);
         if (m_workerContext != nullptr) {
             m_chain->moveToWorkerContext(m_workerContext);
         }
+        m_tiles = makeTiles();
+    }
+    updateRequestedChains();
+}
+
+QList<OutputNode::Tile> OutputNode::makeTiles() {
+    QList<Tile> tiles;
+    auto canvasSize = m_chain->size();
+    if (m_maxTileSize <= 0
+     || (canvasSize.width() <= m_maxTileSize && canvasSize.height() <= m_maxTileSize)) {
+        return tiles;
+    }
+
+    // Each tile is responsible for an interior of step x step pixels
+    // and renders the overlap around it as well
+    auto overlap = qBound(0, m_tileOverlap, (m_maxTileSize - 1) / 2);
+    auto step = m_maxTileSize - 2 * overlap;
+    auto canvas = QRect(QPoint(0, 0), canvasSize);
+    for (int y = 0; y < canvasSize.height(); y += step) {
+        for (int x = 0; x < canvasSize.width(); x += step) {
+            auto interior = QRect(x, y, step, step) & canvas;
+            auto rect = interior.adjusted(-overlap, -overlap, overlap, overlap) & canvas;
+            auto chain = QSharedPointer<Chain>(new Chain(m_chain.data(), rect.size()), &QObject::deleteLater);
+            chain->setTile(rect, canvasSize);
+            if (m_workerContext != nullptr) {
+                chain->moveToWorkerContext(m_workerContext);
+            }
+            tiles.append(Tile{chain, interior});
+        }
+    }
+    return tiles;
+}
+
+bool OutputNode::dynamicResolution() {
+    QMutexLocker locker(&m_stateLock);
+    return m_dynamicResolution;
+}
+
+void OutputNode::setDynamicResolution(bool dynamicResolution) {
+    {
+        QMutexLocker locker(&m_stateLock);
+        if (dynamicResolution == m_dynamicResolution) return;
+        m_dynamicResolution = dynamicResolution;
+    }
+    if (!dynamicResolution) setRenderScale(1);
+    emit dynamicResolutionChanged(dynamicResolution);
+}
+
+qreal OutputNode::targetFrameTime() {
+    QMutexLocker locker(&m_stateLock);
+    return m_targetFrameTime;
+}
+
+void OutputNode::setTargetFrameTime(qreal targetFrameTime) {
+    {
+        QMutexLocker locker(&m_stateLock);
+        if (targetFrameTime == m_targetFrameTime) return;
+        m_targetFrameTime = targetFrameTime;
+    }
+    emit targetFrameTimeChanged(targetFrameTime);
+}
+
+qreal OutputNode::minRenderScale() {
+    QMutexLocker locker(&m_stateLock);
+    return m_minRenderScale;
+}
+
+void OutputNode::setMinRenderScale(qreal minRenderScale) {
+    minRenderScale = qBound((qreal)0.1, minRenderScale, (qreal)1);
+    {
+        QMutexLocker locker(&m_stateLock);
+        if (minRenderScale == m_minRenderScale) return;
+        m_minRenderScale = minRenderScale;
+    }
+    emit minRenderScaleChanged(minRenderScale);
+}
+
+qreal OutputNode::maxRenderScale() {
+    QMutexLocker locker(&m_stateLock);
+    return m_maxRenderScale;
+}
+
+void OutputNode::setMaxRenderScale(qreal maxRenderScale) {
+    maxRenderScale = qBound((qreal)0.1, maxRenderScale, (qreal)1);
+    {
+        QMutexLocker locker(&m_stateLock);
+        if (maxRenderScale == m_maxRenderScale) return;
+        m_maxRenderScale = maxRenderScale;
+    }
+    emit maxRenderScaleChanged(maxRenderScale);
+}
+
+qreal OutputNode::renderScale() {
+    QMutexLocker locker(&m_stateLock);
+    return m_renderScale;
+}
+
+void OutputNode::setRenderScale(qreal renderScale) {
+    QSize chainSize;
+    {
+        QMutexLocker locker(&m_stateLock);
+        if (renderScale == m_renderScale) return;
+        m_renderScale = renderScale;
+        chainSize = scaledSize(m_outputSize, m_renderScale);
+    }
+    resizeChain(chainSize);
+    emit renderScaleChanged(renderScale);
+}
+
+QString OutputNode::renderFormat() {
+    switch (chain()->renderFormat()) {
+    case GL_RGB10_A2:
+        return "rgb10a2";
+    case GL_RGBA16F:
+        return "rgba16f";
+    default:
+        return "rgba8";
+    }
+}
+
+void OutputNode::setRenderFormat(QString renderFormat) {
+    GLenum format;
+    if (renderFormat == "rgba8") {
+        format = GL_RGBA8;
+    } else if (renderFormat == "rgb10a2") {
+        format = GL_RGB10_A2;
+    } else if (renderFormat == "rgba16f") {
+        format = GL_RGBA16F;
+    } else {
+        qWarning() << "Unknown render format" << renderFormat;
+        return;
+    }
+
+    auto oldChain = chain();
+    if (format == oldChain->renderFormat()) return;
+    replaceChain(oldChain->size(), format);
+    emit renderFormatChanged(renderFormat);
+}
+
+int OutputNode::renderThreads() {
+    QMutexLocker locker(&m_stateLock);
+    return m_renderContexts.count() + 1;
+}
+
+void OutputNode::setRenderThreads(int renderThreads) {
+    renderThreads = qBound(1, renderThreads, 16);
+    {
+        QMutexLocker locker(&m_stateLock);
+        if (renderThreads == m_renderContexts.count() + 1) return;
+        // Contexts must be created on the GUI thread
+        while (m_renderContexts.count() < renderThreads - 1) {
+            m_renderContexts.append(QSharedPointer<OpenGLWorkerContext>(new OpenGLWorkerContext(), &QObject::deleteLater));
+        }
+        while (m_renderContexts.count() > renderThreads - 1) {
+            m_renderContexts.removeLast();
+        }
+
+        // Nodes keep state for the chain on the context that first rendered them,
+        // so they need a fresh chain before they can be moved to other contexts
+        renewChainLocked();
+    }
+    updateRequestedChains();
+    emit renderThreadsChanged(renderThreads);
+}
+
+void OutputNode::renewChain(QSharedPointer<Chain> chain) {
+    {
+        QMutexLocker locker(&m_stateLock);
+        if (m_chain != chain) return; // Already replaced
+        renewChainLocked();
+    }
+    updateRequestedChains();
+}
+
+void OutputNode::renewChainLocked() {
+    auto oldChain = m_chain;
+    m_chain = QSharedPointer<Chain>(new Chain(oldChain.data(), oldChain->size()), &QObject::deleteLater);
+    if (m_workerContext != nullptr) {
+        m_chain->moveToWorkerContext(m_workerContext);
+    }
+    m_tiles = makeTiles();
+}
+
+qreal OutputNode::renderSubmissionOverlap() {
+    QMutexLocker locker(&m_stateLock);
+    return m_renderSubmissionOverlap;
+}
+
+void OutputNode::setRenderSubmissionOverlap(qreal renderSubmissionOverlap) {
+    {
+        QMutexLocker locker(&m_stateLock);
+        if (renderSubmissionOverlap == m_renderSubmissionOverlap) return;
+        m_renderSubmissionOverlap = renderSubmissionOverlap;
+    }
+    emit renderSubmissionOverlapChanged(renderSubmissionOverlap);
+}
+
+int OutputNode::maxTileSize() {
+    QMutexLocker locker(&m_stateLock);
+    return m_maxTileSize;
+}
+
+void OutputNode::setMaxTileSize(int maxTileSize) {
+    maxTileSize = qMax(0, maxTileSize);
+    if (maxTileSize > 0 && !drawsTiles()) {
+        // render() has no single texture to return for a tiled chain
+        qWarning() << metaObject()->className() << "can't be tiled, ignoring maxTileSize";
+        return;
     }
-    emit requestedChainAdded(newChain);
-    emit requestedChainRemoved(oldChain);
+    {
+        QMutexLocker locker(&m_stateLock);
+        if (maxTileSize == m_maxTileSize) return;
+        m_maxTileSize = maxTileSize;
+        m_tiles = makeTiles();
+    }
+    updateRequestedChains();
+    emit maxTileSizeChanged(maxTileSize);
+}
+
+int OutputNode::tileOverlap() {
+    QMutexLocker locker(&m_stateLock);
+    return m_tileOverlap;
+}
+
+void OutputNode::setTileOverlap(int tileOverlap) {
+    tileOverlap = qMax(0, tileOverlap);
+    {
+        QMutexLocker locker(&m_stateLock);
+        if (tileOverlap == m_tileOverlap) return;
+        m_tileOverlap = tileOverlap;
+        m_tiles = makeTiles();
+    }
+    updateRequestedChains();
+    emit tileOverlapChanged(tileOverlap);
+}
+
+bool OutputNode::drawsTiles() {
+    return false;
+}
+
+int OutputNode::tileCount() {
+    QMutexLocker locker(&m_stateLock);
+    return m_tiles.count();
 }
@@ -2,23 +2,62 @@
 
 #include "VideoNode.h"
 #include "Model.h"
+#include "RenderScaleController.h"
+#include "RenderScheduler.h"
 #include <QOpenGLTexture>
 #include <QMutex>
 #include <QTimer>
+#include <QRect>
 #include <vector>
+#include <functional>
 
 // This abstract class extends VideoNode to provide radiance output functionality.
 // You should extend it if you are writing an output.
 
 class OutputNode : public VideoNode {
     Q_OBJECT
+    Q_PROPERTY(bool dynamicResolution READ dynamicResolution WRITE setDynamicResolution NOTIFY dynamicResolutionChanged);
+    Q_PROPERTY(qreal targetFrameTime READ targetFrameTime WRITE setTargetFrameTime NOTIFY targetFrameTimeChanged);
+    Q_PROPERTY(qreal minRenderScale READ minRenderScale WRITE setMinRenderScale NOTIFY minRenderScaleChanged);
+    Q_PROPERTY(qreal maxRenderScale READ maxRenderScale WRITE setMaxRenderScale NOTIFY maxRenderScaleChanged);
+    Q_PROPERTY(qreal renderScale READ renderScale NOTIFY renderScaleChanged);
+    Q_PROPERTY(QString renderFormat READ renderFormat WRITE setRenderFormat NOTIFY renderFormatChanged);
+    Q_PROPERTY(int renderThreads READ renderThreads WRITE setRenderThreads NOTIFY renderThreadsChanged);
+    Q_PROPERTY(qreal renderSubmissionOverlap READ renderSubmissionOverlap NOTIFY renderSubmissionOverlapChanged);
+    Q_PROPERTY(int maxTileSize READ maxTileSize WRITE setMaxTileSize NOTIFY maxTileSizeChanged);
+    Q_PROPERTY(int tileOverlap READ tileOverlap WRITE setTileOverlap NOTIFY tileOverlapChanged);
 
 public:
     OutputNode(Context *context, QSize chainSize);
 
+    // Saves the render settings
+    // (format, dynamic resolution, threads and tiling)
+    QJsonObject serialize() override;
+
     GLuint paint(QSharedPointer<Chain> chain, QVector<GLuint> inputTextures) override;
+    // Renders the model and returns the output texture.
+    // Returns 0 when the output is tiled,
+    // since there is no texture holding the whole canvas.
     GLuint render();
     GLuint render(QWeakPointer<Model> model);
+
+    // Receives each rendered tile:
+    // its texture, the part of the canvas the texture covers,
+    // and the part of that which the tile is responsible for
+    // (the rest being overlap with its neighbors.)
+    // Rectangles are in chain pixels from the bottom left.
+    typedef std::function<void(GLuint texture, QRect tileRect, QRect interior)> TileCallback;
+
+    // Renders the model one tile at a time,
+    // handing each tile to draw as soon as it is done.
+    // Every tile is a chain of its own, and nodes keep
+    // their textures for each chain between frames,
+    // so tiling bounds the size of each texture, not the memory used.
+    // If the output isn't tiled,
+    // draw is called once with the whole chain.
+    void renderTiles(TileCallback draw);
+    void renderTiles(QWeakPointer<Model> model, TileCallback draw);
+
     void setWorkerContext(OpenGLWorkerContext *context);
 
 public slots:
@@ -26,11 +65,142 @@ public slots:
 
     QSharedPointer<Chain> chain();
 
+    // The size that was requested through resize().
+    // The chain may be smaller than this
+    // if dynamic resolution is turned on.
+    QSize outputSize();
+
+    // When dynamic resolution is on,
+    // the GPU time spent rendering each frame is measured
+    // and the chain is shrunk (down to minRenderScale)
+    // or grown (up to maxRenderScale)
+    // to keep it near targetFrameTime (in milliseconds.)
+    // Outputs are expected to upscale the result.
+    bool dynamicResolution();
+    void setDynamicResolution(bool dynamicResolution);
+    qreal targetFrameTime();
+    void setTargetFrameTime(qreal targetFrameTime);
+    qreal minRenderScale();
+    void setMinRenderScale(qreal minRenderScale);
+    qreal maxRenderScale();
+    void setMaxRenderScale(qreal maxRenderScale);
+
+    // The fraction of outputSize that is currently being rendered
+    qreal renderScale();
+
+    // The pixel format that the chain renders in,
+    // one of "rgba8", "rgb10a2" or "rgba16f".
+    // Changing it replaces the chain.
+    QString renderFormat();
+    void setRenderFormat(QString renderFormat);
+
+    // The number of OpenGL contexts to render on (at least 1.)
+    // With more than one, independent branches of the graph
+    // are rendered at the same time (see RenderScheduler.)
+    // Changing it replaces the chain.
+    int renderThreads();
+    void setRenderThreads(int renderThreads);
+
+    // How many contexts were submitting commands at once, on average
+    // (see RenderScheduler::submissionOverlap)
+    qreal renderSubmissionOverlap();
+
+    // When the chain is wider or taller than maxTileSize,
+    // it is rendered as a grid of smaller chains instead
+    // so that canvases bigger than GL_MAX_TEXTURE_SIZE can be drawn.
+    // 0 (the default) turns tiling off.
+    // Each tile renders tileOverlap extra pixels on every side
+    // so that effects that look at their neighbors
+    // (blurs, displacements) don't show seams.
+    // Only outputs that draw through renderTiles() support tiling;
+    // on the others, it stays 0.
+    // Tiles render on a single context, whatever renderThreads is.
+    int maxTileSize();
+    void setMaxTileSize(int maxTileSize);
+    int tileOverlap();
+    void setTileOverlap(int tileOverlap);
+
+    // The number of tiles, or 0 if the output isn't tiled
+    int tileCount();
+
+protected slots:
+    void setRenderScale(qreal renderScale);
+    void setRenderSubmissionOverlap(qreal renderSubmissionOverlap);
+
+    // Replaces the chain with a fresh one of the same size and format,
+    // unless it was replaced already.
+    // Nodes keep state for a chain on the context that rendered them,
+    // which a fresh chain lets them start over from.
+    void renewChain(QSharedPointer<Chain> chain);
+
+signals:
+    void dynamicResolutionChanged(bool dynamicResolution);
+    void targetFrameTimeChanged(qreal targetFrameTime);
+    void minRenderScaleChanged(qreal minRenderScale);
+    void maxRenderScaleChanged(qreal maxRenderScale);
+    void renderScaleChanged(qreal renderScale);
+    void renderFormatChanged(QString renderFormat);
+    void renderThreadsChanged(int renderThreads);
+    void renderSubmissionOverlapChanged(qreal renderSubmissionOverlap);
+    void maxTileSizeChanged(int maxTileSize);
+    void tileOverlapChanged(int tileOverlap);
+
 protected:
     virtual QList<QSharedPointer<Chain>> requestedChains() override;
 
+    // Replaces the chain with one of exactly the given size
+    // and render format
+    void resizeChain(QSize size);
+    void replaceChain(QSize size, GLenum format);
+    // renewChain() with m_stateLock held
+    void renewChainLocked();
+    QMap<QSharedPointer<VideoNode>, GLuint> renderModel(ModelCopyForRendering &modelCopy);
+    static QSize scaledSize(QSize size, qreal scale);
+
+    struct Tile {
+        QSharedPointer<Chain> chain;
+        QRect interior;
+    };
+
+    // Splits the chain into tiles,
+    // or returns nothing if it doesn't need to be.
+    // m_stateLock must be held.
+    QList<Tile> makeTiles();
+
+    // Restores the render settings that serialize() saved.
+    // Outputs call this from their deserialize().
+    void deserializeSettings(QJsonObject obj);
+
+    // Whether the output draws through renderTiles(),
+    // and so can be tiled
+    virtual bool drawsTiles();
+
+    // The chains that the output renders with right now.
+    // m_stateLock must be held.
+    virtual QList<QSharedPointer<Chain>> currentChains();
+
+    // Emits requestedChainAdded and requestedChainRemoved
+    // for whatever changed since the last call
+    void updateRequestedChains();
+
     QSharedPointer<Chain> m_chain;
     OpenGLWorkerContext *m_workerContext{};
+    QSize m_outputSize;
+    bool m_dynamicResolution{};
+    qreal m_targetFrameTime{14};
+    qreal m_minRenderScale{0.5};
+    qreal m_maxRenderScale{1};
+    qreal m_renderScale{1};
+    QList<QSharedPointer<OpenGLWorkerContext>> m_renderContexts;
+    qreal m_renderSubmissionOverlap{1};
+    int m_maxTileSize{};
+    int m_tileOverlap{32};
+    QList<Tile> m_tiles;
+    QList<QSharedPointer<Chain>> m_requestedChains;
+
+    // Only touched from the rendering thread
+    RenderScaleController m_renderScaleController;
+    RenderScheduler m_renderScheduler;
 };
 
 typedef QmlSharedPointer<OutputNode, VideoNodeSP> OutputNodeSP;
@@ -3,6 +3,9 @@
 #include <QScreen>
 #include <QGuiApplication>
 #include <QKeyEvent>
+#include <QVector4D>
+#include <QMatrix3x3>
+#include <QDebug>
 
 // OutputWindow
 
@@ -118,11 +121,37 @@ void OutputWindow::initializeGL()
     auto fragmentString = QString{
         "#version 150\n"
         "uniform sampler2D iTexture;\n"
+        "// Maps the window to the output, undoing the keystone\n"
+        "uniform mat3 iKeystone;\n"
+        "// The part of the picture to show\n"
+        "uniform vec4 iRegion;\n"
+        "// The part of the picture that iTexture covers\n"
+        "// and the part of that to draw\n"
+        "uniform vec4 iTileRect;\n"
+        "uniform vec4 iInterior;\n"
+        "// Widths of the left, bottom, right and top ramps\n"
+        "uniform vec4 iEdgeBlend;\n"
+        "uniform float iEdgeBlendGamma;\n"
         "in vec2 uv;\n"
         "out vec4 fragColor;\n"
         "void main() {\n"
-        "   fragColor = vec4(texture(iTexture, uv).rgb, 1.);\n"
-        "}"};;
+        "    vec3 q = iKeystone * vec3(uv, 1.);\n"
+        "    vec2 p = q.xy / q.z;\n"
+        "    vec2 c = iRegion.xy + iRegion.zw * p;\n"
+        "    // Other tiles and the black background cover the rest\n"
+        "    if (q.z <= 0. || any(lessThan(p, vec2(0.))) || any(greaterThanEqual(p, vec2(1.)))\n"
+        "     || any(lessThan(c, iInterior.xy)) || any(greaterThanEqual(c, iInterior.xy + iInterior.zw))) {\n"
+        "        discard;\n"
+        "    }\n"
+        "    vec3 color = texture(iTexture, (c - iTileRect.xy) / iTileRect.zw).rgb;\n"
+        "    vec2 ramp = clamp(p / max(iEdgeBlend.xy, 1e-6), 0., 1.)\n"
+        "              * clamp((1. - p) / max(iEdgeBlend.zw, 1e-6), 0., 1.);\n"
+        "    ramp = smoothstep(0., 1., ramp);\n"
+        "    // The ramps of two projectors add up to one in light,\n"
+        "    // so undo the gamma of the projector\n"
+        "    float weight = pow(ramp.x * ramp.y, 1. / iEdgeBlendGamma);\n"
+        "    fragColor = vec4(color * weight, 1.);\n"
+        "}"};
 
     m_program = new QOpenGLShaderProgram(this);
     m_program->addShaderFromSourceCode(QOpenGLShader::Vertex, vertexString);
@@ -133,21 +162,79 @@ void OutputWindow::initializeGL()
 void OutputWindow::resizeGL(int w, int h) {
 }
 
+void OutputWindow::setView(QSharedPointer<MasterCanvas> canvas, QRectF region, QVector4D edgeBlend, qreal edgeBlendGamma, QPolygonF keystone) {
+    m_canvas = canvas;
+    m_region = region;
+    m_edgeBlend = edgeBlend;
+    m_edgeBlendGamma = edgeBlendGamma;
+    // The shader needs the other direction,
+    // from the window back to the output
+    if (!QTransform::quadToSquare(keystone, m_keystone)) {
+        qWarning() << "Keystone corners don't make a quadrilateral";
+        m_keystone = QTransform();
+    }
+}
+
 void OutputWindow::paintGL() {
-    GLuint texture = m_videoNode->render();
     auto dpr = devicePixelRatio();
     glViewport(0, 0, width() * dpr, height() * dpr);
     glClearColor(0, 0, 0, 0);
     glDisable(GL_DEPTH_TEST);
     glDisable(GL_BLEND);
     glClear(GL_COLOR_BUFFER_BIT);
-    m_program->bind();
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, texture);
-    m_videoNode->chain()->vao()->bind();
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-    m_videoNode->chain()->vao()->release();
-    m_program->release();
+
+    // Every draw covers the whole window
+    // and the shader throws away what isn't its part.
+    // Rectangles are fractions of the picture.
+    auto draw = [&](GLuint texture, QRectF tileRect, QRectF interior) {
+        // Rendering may have changed these
+        glViewport(0, 0, width() * dpr, height() * dpr);
+        glDisable(GL_DEPTH_TEST);
+        glDisable(GL_BLEND);
+
+        m_program->bind();
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        // The picture may be smaller than the window
+        // e.g. when dynamic resolution is on
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        m_program->setUniformValue("iTexture", 0);
+        const float keystone[] = {
+            (float)m_keystone.m11(), (float)m_keystone.m21(), (float)m_keystone.m31(),
+            (float)m_keystone.m12(), (float)m_keystone.m22(), (float)m_keystone.m32(),
+            (float)m_keystone.m13(), (float)m_keystone.m23(), (float)m_keystone.m33(),
+        };
+        m_program->setUniformValue("iKeystone", QMatrix3x3(keystone));
+        m_program->setUniformValue("iRegion", QVector4D(m_region.x(), m_region.y(), m_region.width(), m_region.height()));
+        m_program->setUniformValue("iTileRect", QVector4D(tileRect.x(), tileRect.y(), tileRect.width(), tileRect.height()));
+        m_program->setUniformValue("iInterior", QVector4D(interior.x(), interior.y(), interior.width(), interior.height()));
+        m_program->setUniformValue("iEdgeBlend", m_edgeBlend);
+        m_program->setUniformValue("iEdgeBlendGamma", GLfloat(m_edgeBlendGamma));
+        m_videoNode->chain()->vao()->bind();
+        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+        m_videoNode->chain()->vao()->release();
+        m_program->release();
+    };
+
+    auto whole = QRectF(0, 0, 1, 1);
+    if (!m_canvas.isNull()) {
+        // The canvas is rendered once for all of the outputs sharing it
+        auto textures = m_canvas->render(m_videoNode.data(), m_videoNode->lastModel());
+        draw(textures.value(m_videoNode, m_videoNode->chain()->blankTexture()), whole, whole);
+        m_canvas->finished(m_videoNode.data());
+    } else {
+        // Each tile is drawn as soon as it is rendered.
+        // The overlap around its interior is thrown away.
+        auto size = QSizeF(m_videoNode->chain()->size());
+        auto normalize = [size](QRect r) {
+            return QRectF(r.x() / size.width(), r.y() / size.height(),
+                          r.width() / size.width(), r.height() / size.height());
+        };
+        m_videoNode->renderTiles([&](GLuint texture, QRect tileRect, QRect interior) {
+            draw(texture, normalize(tileRect), normalize(interior));
+        });
+    }
     update();
 }
 
@@ -1,9 +1,14 @@
 #pragma once
 
 #include "OutputNode.h"
+#include "MasterCanvas.h"
 #include <QOpenGLWindow>
 #include <QTimer>
 #include <QOpenGLShaderProgram>
+#include <QPolygonF>
+#include <QTransform>
+#include <QRectF>
+#include <QVector4D>
 
 class OutputWindow : public QOpenGLWindow {
     Q_OBJECT
@@ -17,6 +22,11 @@ protected:
     QOpenGLVertexArrayObject m_vao;
     bool m_shown;
     QSize m_screenSize;
+    QSharedPointer<MasterCanvas> m_canvas;
+    QRectF m_region{0, 0, 1, 1};
+    QVector4D m_edgeBlend;
+    qreal m_edgeBlendGamma{2.2};
+    QTransform m_keystone;
 
     void putOnScreen();
 
@@ -34,6 +44,14 @@ protected slots:
 public:
     OutputWindow(QSharedPointer<OutputNode> videoNode);
 
+    // Sets what to draw and how:
+    // the canvas to take the picture from (or null for the node's own chain),
+    // the region of the picture to show,
+    // the edge blend ramps (left, bottom, right, top) and gamma,
+    // and where the corners of the picture go on the window
+    // (see ScreenOutputNode for details.)
+    void setView(QSharedPointer<MasterCanvas> canvas, QRectF region, QVector4D edgeBlend, qreal edgeBlendGamma, QPolygonF keystone);
+
 public slots:
     void setScreenName(QString screen);
     QString screenName();
@@ -56,6 +56,7 @@ public:
                 auto pixelCount = m_videoNode->pixelCount();
                 auto colors = m_videoNode->colorsBuffer();
                 auto displayMode = m_videoNode->displayMode();
+                auto colorFormat = m_videoNode->colorFormat();
                 auto lookupCoordinates = m_videoNode->lookupCoordinatesBuffer();
                 auto physicalCoordinates = m_videoNode->physicalCoordinatesBuffer();
 
@@ -74,6 +75,7 @@ public:
                 glEnableVertexAttribArray(colAttr);
                 m_lightShader->setUniformValue("mvp", projection);
                 m_lightShader->setUniformValue("dpr", (GLfloat)m_devicePixelRatio);
+                m_lightShader->setUniformValue("rgb565", colorFormat == LightOutputSampler::RGB565);
 
                 if (displayMode == LightOutputNode::DisplayPhysical2D) {
                     physicalCoordinates.bind();
@@ -82,7 +84,23 @@ public:
                 }
                 glVertexAttribPointer(posAttr, 2, GL_FLOAT, GL_FALSE, 0, 0);
                 colors.bind();
-                glVertexAttribPointer(colAttr, 4, GL_UNSIGNED_BYTE, GL_TRUE, 0, 0);
+                // The colors are in whatever format the device asked for.
+                // Missing alpha comes out as 1.
+                switch (colorFormat) {
+                case LightOutputSampler::RGBA8:
+                    glVertexAttribPointer(colAttr, 4, GL_UNSIGNED_BYTE, GL_TRUE, 0, 0);
+                    break;
+                case LightOutputSampler::RGB8:
+                    glVertexAttribPointer(colAttr, 3, GL_UNSIGNED_BYTE, GL_TRUE, 0, 0);
+                    break;
+                case LightOutputSampler::RGB565:
+                    // Unpacked in the vertex shader
+                    glVertexAttribPointer(colAttr, 1, GL_UNSIGNED_SHORT, GL_FALSE, 0, 0);
+                    break;
+                case LightOutputSampler::RGB16:
+                    glVertexAttribPointer(colAttr, 3, GL_UNSIGNED_SHORT, GL_TRUE, 0, 0);
+                    break;
+                }
                 colors.release();
                 glDrawArrays(GL_POINTS, 0, pixelCount);
                 glDisableVertexAttribArray(posAttr);
@@ -119,8 +137,14 @@ private:
             "out vec4 col;\n"
             "uniform mat4 mvp;\n"
             "uniform float dpr;\n"
+            "uniform bool rgb565;\n"
             "void main() {\n"
-            "   col = colAttr;\n"
+            "   if (rgb565) {\n"
+            "       float v = colAttr.x;\n"
+            "       col = vec4(floor(v / 2048.) / 31., mod(floor(v / 32.), 64.) / 63., mod(v, 32.) / 31., 1.);\n"
+            "   } else {\n"
+            "       col = colAttr;\n"
+            "   }\n"
             "   gl_Position = mvp * vec4(posAttr, 0., 1.);\n"
             "   gl_PointSize = 10 * dpr;\n"
             "}\n"};
@@ -7,6 +7,9 @@ QQuickPreviewAdapter::QQuickPreviewAdapter(QSize size)
     : m_previewSize(size)
     , m_previewChain(new Chain(size), &QObject::deleteLater)
 {
+    // Previews are small and only for looking at,
+    // so half-float noise is plenty
+    m_previewChain->setNoiseFormat(QOpenGLTexture::RGBA16F);
 }
 
 QQuickPreviewAdapter::~QQuickPreviewAdapter() {
@@ -45,11 +48,12 @@ void QQuickPreviewAdapter::setPreviewSize(QSize size) {
         {
             QMutexLocker locker(&m_previewLock);
             m_previewSize = size;
-            QSharedPointer<Chain> previewChain(new Chain(size));
+            QSharedPointer<Chain> previewChain(new Chain(m_previewChain.data(), size), &QObject::deleteLater);
             if (m_model != nullptr) {
                 (*m_model)->removeChain(m_previewChain);
                 (*m_model)->addChain(previewChain);
             }
+            m_retiredChains.append(m_previewChain);
             m_previewChain = previewChain;
         }
         emit previewSizeChanged(size);
@@ -76,6 +80,15 @@ void QQuickPreviewAdapter::setPreviewWindow(QQuickWindow *window) {
 }
 
 void QQuickPreviewAdapter::onBeforeSynchronizing() {
+    QList<QSharedPointer<Chain>> retiredChains;
+    {
+        QMutexLocker locker(&m_previewLock);
+        retiredChains.swap(m_retiredChains);
+    }
+    for (auto chain : retiredChains) {
+        chain->releaseContextResources();
+    }
+
     if (m_model != nullptr) {
         auto modelCopy = (*m_model)->createCopyForRendering();
         m_lastPreviewRender = modelCopy.render(m_previewChain);
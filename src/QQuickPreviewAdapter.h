@@ -42,6 +42,9 @@ protected:
     ModelSP *m_model{};
     QSize m_previewSize;
     QSharedPointer<Chain> m_previewChain;
+    // Replaced chains, to be released on the render thread,
+    // since they are deleted on this one, which has no context
+    QList<QSharedPointer<Chain>> m_retiredChains;
     QQuickWindow *m_previewWindow{};
     QMap<QSharedPointer<VideoNode>, GLuint> m_lastPreviewRender;
     QMutex m_previewLock;
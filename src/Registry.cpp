@@ -9,7 +9,10 @@
 #include "FFmpegOutputNode.h"
 #include "PlaceholderNode.h"
 #include "ConsoleOutputNode.h"
+#include "SharedMemoryOutputNode.h"
 #include "LightOutputNode.h"
+#include "CompositorNode.h"
+#include "SubgraphNode.h"
 #include "Paths.h"
 
 #ifdef USE_MPV
@@ -25,7 +28,10 @@ Registry::Registry()
     registerType<FFmpegOutputNode>();
     registerType<PlaceholderNode>();
     registerType<ConsoleOutputNode>();
+    registerType<SharedMemoryOutputNode>();
     registerType<LightOutputNode>();
+    registerType<CompositorNode>();
+    registerType<SubgraphNode>();
 #ifdef USE_MPV
     registerType<MovieNode>();
 #endif
@@ -0,0 +1,131 @@
+#include "RenderScaleController.h"
+#include <QDebug>
+#include <cmath>
+
+constexpr qreal RenderScaleController::SCALE_STEP;
+constexpr int RenderScaleController::QUERY_COUNT;
+constexpr int RenderScaleController::COOLDOWN_FRAMES;
+constexpr int RenderScaleController::UPSCALE_FRAMES;
+constexpr qreal RenderScaleController::SMOOTHING;
+constexpr qreal RenderScaleController::HIGH_WATER;
+constexpr qreal RenderScaleController::LOW_WATER;
+
+RenderScaleController::RenderScaleController() {
+}
+
+void RenderScaleController::setTargetFrameTime(qreal ms) {
+    m_targetFrameTime = qMax(ms, (qreal)1);
+}
+
+void RenderScaleController::setScaleRange(qreal minScale, qreal maxScale) {
+    if (maxScale < minScale) maxScale = minScale;
+    m_minScale = minScale;
+    m_maxScale = maxScale;
+    setScale(m_scale);
+}
+
+void RenderScaleController::beginFrame() {
+    auto context = QOpenGLContext::currentContext();
+    if (context != m_context) {
+        m_queries.clear();
+        m_pending.clear();
+        m_context = context;
+        m_supported = true;
+        for (int i = 0; i < QUERY_COUNT; i++) {
+            auto query = QSharedPointer<QOpenGLTimerQuery>::create();
+            if (!query->create()) {
+                qWarning() << "Timer queries are not supported, dynamic resolution is disabled";
+                m_queries.clear();
+                m_supported = false;
+                break;
+            }
+            m_queries.append(query);
+        }
+    }
+
+    m_current = -1;
+    if (!m_supported || m_pending.count() >= m_queries.count()) {
+        // Every query is still in flight; skip timing this frame
+        return;
+    }
+    for (int i = 0; i < m_queries.count(); i++) {
+        if (!m_pending.contains(i)) {
+            m_current = i;
+            break;
+        }
+    }
+    m_queries.at(m_current)->begin();
+}
+
+void RenderScaleController::endFrame() {
+    if (m_current >= 0) {
+        m_queries.at(m_current)->end();
+        m_pending.enqueue(m_current);
+        m_current = -1;
+    }
+
+    // Collect any results that are ready without waiting
+    while (!m_pending.isEmpty() && m_queries.at(m_pending.head())->isResultAvailable()) {
+        auto ns = m_queries.at(m_pending.dequeue())->waitForResult();
+        addSample(ns / 1e6);
+    }
+}
+
+void RenderScaleController::addSample(qreal ms) {
+    if (m_frameTime == 0) {
+        m_frameTime = ms;
+    } else {
+        m_frameTime += (ms - m_frameTime) * SMOOTHING;
+    }
+
+    // Give the pipeline a moment to settle after a change
+    if (m_cooldown > 0) {
+        m_cooldown--;
+        return;
+    }
+
+    if (m_frameTime > m_targetFrameTime * HIGH_WATER) {
+        m_underBudgetCount = 0;
+        // Render cost is roughly proportional to pixel count,
+        // so jump straight to the scale that should fit
+        auto fit = m_scale * std::sqrt(LOW_WATER * m_targetFrameTime / m_frameTime);
+        setScale(std::floor(fit / SCALE_STEP) * SCALE_STEP);
+    } else if (m_frameTime < m_targetFrameTime * LOW_WATER) {
+        if (++m_underBudgetCount >= UPSCALE_FRAMES) {
+            m_underBudgetCount = 0;
+            setScale(m_scale + SCALE_STEP);
+        }
+    } else {
+        m_underBudgetCount = 0;
+    }
+}
+
+void RenderScaleController::setScale(qreal scale) {
+    scale = qBound(m_minScale, scale, m_maxScale);
+    if (std::abs(scale - m_scale) < SCALE_STEP / 2) return;
+    m_scale = scale;
+    m_frameTime = 0;
+    m_cooldown = COOLDOWN_FRAMES;
+    m_underBudgetCount = 0;
+}
+
+qreal RenderScaleController::scale() const {
+    return m_scale;
+}
+
+qreal RenderScaleController::frameTime() const {
+    return m_frameTime;
+}
+
+bool RenderScaleController::supported() const {
+    return m_supported;
+}
+
+void RenderScaleController::reset() {
+    m_pending.clear();
+    m_current = -1;
+    m_frameTime = 0;
+    m_cooldown = 0;
+    m_underBudgetCount = 0;
+    m_scale = m_maxScale;
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <QOpenGLContext>
+#include <QOpenGLTimerQuery>
+#include <QSharedPointer>
+#include <QVector>
+#include <QQueue>
+
+// This class measures how long the GPU spends
+// rendering each frame of a chain
+// and picks a render scale that keeps that time
+// within a target budget.
+//
+// Measurements come from asynchronous timer queries
+// that are read back a few frames later,
+// so timing never stalls the pipeline.
+//
+// To avoid oscillating between two sizes
+// (resizing a chain is not free)
+// the scale only drops when the smoothed frame time
+// is well over budget,
+// and only rises after it has been well under budget
+// for a sustained period.
+//
+// This class is NOT thread-safe.
+// It must only be used from the thread
+// that does the rendering.
+
+class RenderScaleController {
+public:
+    RenderScaleController();
+
+    // Target GPU time per frame, in milliseconds
+    void setTargetFrameTime(qreal ms);
+
+    // Bounds on the render scale (fraction of the output size)
+    void setScaleRange(qreal minScale, qreal maxScale);
+
+    // Call these around the render to be timed.
+    // They require a current OpenGL context.
+    // If the context changes, all measurements are discarded.
+    void beginFrame();
+    void endFrame();
+
+    // Returns the chosen render scale
+    qreal scale() const;
+
+    // Returns the smoothed GPU frame time in milliseconds,
+    // or 0 if nothing has been measured yet
+    qreal frameTime() const;
+
+    // Returns false if the OpenGL implementation
+    // does not support timer queries
+    bool supported() const;
+
+    // Discard all measurements and return to the maximum scale
+    void reset();
+
+    // Granularity of the chosen scale
+    static constexpr qreal SCALE_STEP = 0.05;
+
+protected:
+    void addSample(qreal ms);
+    void setScale(qreal scale);
+
+    static constexpr int QUERY_COUNT = 4;
+    static constexpr int COOLDOWN_FRAMES = 30;
+    static constexpr int UPSCALE_FRAMES = 90;
+    static constexpr qreal SMOOTHING = 0.1;
+    static constexpr qreal HIGH_WATER = 1.1;
+    static constexpr qreal LOW_WATER = 0.7;
+
+    QOpenGLContext *m_context{};
+    QVector<QSharedPointer<QOpenGLTimerQuery>> m_queries;
+    QQueue<int> m_pending;
+    int m_current{-1};
+    bool m_supported{true};
+
+    qreal m_targetFrameTime{14};
+    qreal m_minScale{0.5};
+    qreal m_maxScale{1};
+    qreal m_scale{1};
+    qreal m_frameTime{};
+    int m_cooldown{};
+    int m_underBudgetCount{};
+};
@@ -0,0 +1,457 @@
+#include "RenderScheduler.h"
+#include "SubgraphNode.h"
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QOpenGLContext>
+#include <QOpenGLExtraFunctions>
+#include <algorithm>
+
+constexpr int RenderScheduler::WORKER_TIMEOUT_MS;
+constexpr int RenderScheduler::BACKOFF_MS;
+constexpr int RenderScheduler::MAX_BACKOFF_MS;
+constexpr qreal RenderScheduler::SMOOTHING;
+
+// Everything the contexts share while rendering one frame
+class RenderSchedulerFrame {
+public:
+    QSharedPointer<Chain> chain;
+    QVector<QSharedPointer<VideoNode>> vertices;
+    QVector<QVector<int>> inputs;
+    QVector<int> contextOf;
+    // Whether a vertex is read from another context
+    QVector<bool> shared;
+    // Vertices to render on each context, in order
+    QVector<QVector<int>> work;
+    GLsync start{};
+
+    QMutex lock;
+    QWaitCondition published;
+    QVector<GLuint> results;
+    QVector<GLsync> fences;
+    QVector<bool> done;
+    QVector<GLsync> endFences;
+    QVector<qint64> busy;
+    QSemaphore finished;
+    // Contexts stop waiting for each other
+    // WORKER_TIMEOUT_MS after the frame started
+    QElapsedTimer sinceStart;
+    // Set when a context gave up on another.
+    // Everybody then stops as soon as they can.
+    bool aborted{};
+    // Contexts that haven't left the frame yet.
+    // The last one to leave an aborted frame deletes its fences,
+    // since nobody can be waiting on them any more.
+    int active{};
+
+    // Renders the vertices assigned to the given context,
+    // which must be current.
+    // Returns false if the frame was aborted.
+    bool run(int context);
+
+    // Milliseconds left until the timeout
+    int remainingTime() const;
+
+protected:
+    // Waits for the vertex to be published. lock must be held.
+    // Returns false if the frame was aborted.
+    bool waitFor(int vertex);
+    // Leaves the frame, cleaning up if it was aborted
+    // and this is the last context in it
+    void leave(QOpenGLExtraFunctions *gl);
+};
+
+int RenderSchedulerFrame::remainingTime() const {
+    return qMax((qint64)0, RenderScheduler::WORKER_TIMEOUT_MS - sinceStart.elapsed());
+}
+
+bool RenderSchedulerFrame::waitFor(int vertex) {
+    while (!done.at(vertex) && !aborted) {
+        if (!published.wait(&lock, remainingTime())) {
+            aborted = true;
+            published.wakeAll();
+        }
+    }
+    return !aborted;
+}
+
+void RenderSchedulerFrame::leave(QOpenGLExtraFunctions *gl) {
+    QMutexLocker locker(&lock);
+    active--;
+    if (!aborted || active > 0) return;
+    // Sync objects are shared along with everything else
+    for (auto &fence : fences) {
+        if (fence != 0) gl->glDeleteSync(fence);
+        fence = 0;
+    }
+    for (auto &fence : endFences) {
+        if (fence != 0) gl->glDeleteSync(fence);
+        fence = 0;
+    }
+    if (start != 0) gl->glDeleteSync(start);
+    start = 0;
+}
+
+bool RenderSchedulerFrame::run(int context) {
+    auto gl = QOpenGLContext::currentContext()->extraFunctions();
+    QElapsedTimer timer;
+    qint64 busyTime = 0;
+
+    // Don't start until the chain's context
+    // has finished the previous frame and set up this one
+    if (context != 0) {
+        QMutexLocker locker(&lock);
+        if (aborted) {
+            locker.unlock();
+            leave(gl);
+            finished.release();
+            return false;
+        }
+        gl->glWaitSync(start, 0, GL_TIMEOUT_IGNORED);
+    }
+
+    auto vao = chain->vao();
+    for (auto i : work.at(context)) {
+        auto inputCount = inputs.at(i).count();
+        QVector<GLuint> inputTextures(inputCount, chain->blankTexture());
+        for (int j = 0; j < inputCount; j++) {
+            auto from = inputs.at(i).at(j);
+            if (from < 0) continue;
+            GLuint texture;
+            GLsync fence = 0;
+            {
+                QMutexLocker locker(&lock);
+                if (!waitFor(from)) {
+                    locker.unlock();
+                    vao->release();
+                    leave(gl);
+                    if (context != 0) finished.release();
+                    return false;
+                }
+                texture = results.at(from);
+                if (contextOf.at(from) != context) {
+                    fence = fences.at(from);
+                }
+                // Fences are only deleted once every context has left,
+                // so it is still there
+                if (fence != 0) {
+                    gl->glWaitSync(fence, 0, GL_TIMEOUT_IGNORED);
+                }
+            }
+            if (texture != 0) {
+                inputTextures[j] = texture;
+            }
+        }
+
+        timer.start();
+        vao->bind();
+        auto texture = vertices.at(i)->paint(chain, inputTextures);
+        GLsync fence = 0;
+        if (shared.at(i)) {
+            fence = gl->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            // Other contexts can only see the fence once it is flushed
+            gl->glFlush();
+        }
+        busyTime += timer.nsecsElapsed();
+
+        {
+            QMutexLocker locker(&lock);
+            results[i] = texture;
+            fences[i] = fence;
+            done[i] = true;
+        }
+        published.wakeAll();
+    }
+    vao->release();
+
+    GLsync end = 0;
+    if (context != 0) {
+        end = gl->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        gl->glFlush();
+    }
+    bool ok;
+    {
+        QMutexLocker locker(&lock);
+        endFences[context] = end;
+        busy[context] = busyTime;
+        ok = !aborted;
+    }
+    leave(gl);
+    if (context != 0) {
+        finished.release();
+    }
+    return ok;
+}
+
+RenderSchedulerWorker::RenderSchedulerWorker(QSharedPointer<OpenGLWorkerContext> context)
+    : m_context(context)
+{
+    moveToThread(context->context()->thread());
+}
+
+void RenderSchedulerWorker::post(std::function<void()> job) {
+    {
+        QMutexLocker locker(&m_lock);
+        m_jobs.append(job);
+    }
+    QMetaObject::invokeMethod(this, "run", Qt::QueuedConnection);
+}
+
+void RenderSchedulerWorker::run() {
+    QList<std::function<void()>> jobs;
+    {
+        QMutexLocker locker(&m_lock);
+        jobs.swap(m_jobs);
+    }
+    m_context->makeCurrent();
+    for (auto &job : jobs) {
+        job();
+    }
+}
+
+RenderScheduler::RenderScheduler() {
+}
+
+RenderScheduler::~RenderScheduler() {
+    releaseChain();
+}
+
+void RenderScheduler::setWorkerContexts(QList<QSharedPointer<OpenGLWorkerContext>> contexts) {
+    if (contexts == m_contexts) return;
+    releaseChain();
+    m_chain.clear();
+    m_assignments.clear();
+    m_contexts = contexts;
+    m_workers.clear();
+    for (auto context : contexts) {
+        m_workers.append(QSharedPointer<RenderSchedulerWorker>(new RenderSchedulerWorker(context), &QObject::deleteLater));
+    }
+    m_serial = false;
+    m_retire = false;
+    m_timeouts = 0;
+    m_submissionOverlap = 1;
+    m_branchCount = 0;
+}
+
+QList<QSharedPointer<OpenGLWorkerContext>> RenderScheduler::workerContexts() const {
+    return m_contexts;
+}
+
+qreal RenderScheduler::submissionOverlap() const {
+    return m_submissionOverlap;
+}
+
+int RenderScheduler::branchCount() const {
+    return m_branchCount;
+}
+
+QSharedPointer<Chain> RenderScheduler::retiredChain() const {
+    return m_retire ? m_chain : QSharedPointer<Chain>();
+}
+
+qint64 RenderScheduler::backoff() const {
+    return qMin((qint64)MAX_BACKOFF_MS, (qint64)BACKOFF_MS << qMin(m_timeouts - 1, 8));
+}
+
+void RenderScheduler::releaseChain() {
+    if (m_chain.isNull()) return;
+    auto chain = m_chain;
+    for (auto worker : m_workers) {
+        worker->post([chain]() {
+            chain->releaseContextResources();
+        });
+    }
+}
+
+QVector<int> RenderScheduler::assign(const ModelCopyForRendering &model, const QVector<QVector<int>> &inputs) {
+    auto count = model.vertices.count();
+    auto contextCount = m_workers.count() + 1;
+
+    // Forget nodes that were deleted
+    for (auto it = m_assignments.begin(); it != m_assignments.end();) {
+        if (it->node.isNull()) {
+            it = m_assignments.erase(it);
+        } else {
+            it++;
+        }
+    }
+
+    QVector<int> consumers(count, 0);
+    for (auto &vertexInputs : inputs) {
+        for (auto from : vertexInputs) {
+            if (from >= 0) consumers[from]++;
+        }
+    }
+
+    // A node continues the branch of its input
+    // if it has exactly one and is that input's only consumer.
+    // Anything else starts a new branch.
+    QVector<int> branchOf(count, -1);
+    QVector<int> branchContext;
+    QVector<int> load(contextCount, 0);
+    QVector<int> contextOf(count, 0);
+    for (int i = 0; i < count; i++) {
+        auto vertex = model.vertices.at(i);
+        QVector<int> from;
+        for (auto f : inputs.at(i)) {
+            if (f >= 0 && !from.contains(f)) from.append(f);
+        }
+        if (from.count() == 1 && consumers.at(from.at(0)) == 1) {
+            branchOf[i] = branchOf.at(from.at(0));
+        } else {
+            branchOf[i] = branchContext.count();
+            branchContext.append(-1);
+        }
+        auto branch = branchOf.at(i);
+
+        auto assignment = m_assignments.value(vertex.data());
+        int context;
+        if (assignment.node.toStrongRef() == vertex) {
+            context = assignment.context;
+        } else {
+            if (qobject_cast<SubgraphNode *>(vertex.data()) != nullptr) {
+                // Subgraphs are shared between nodes,
+                // so they have to render on the chain's own context
+                context = 0;
+            } else if (branchContext.at(branch) >= 0) {
+                context = branchContext.at(branch);
+            } else {
+                context = std::min_element(load.begin(), load.end()) - load.begin();
+            }
+            m_assignments.insert(vertex.data(), Assignment{vertex, context});
+        }
+        if (branchContext.at(branch) < 0) {
+            branchContext[branch] = context;
+        }
+        load[context]++;
+        contextOf[i] = context;
+    }
+
+    m_branchCount = branchContext.count();
+    return contextOf;
+}
+
+QMap<QSharedPointer<VideoNode>, GLuint> RenderScheduler::render(ModelCopyForRendering &model, QSharedPointer<Chain> chain) {
+    if (m_workers.isEmpty()) {
+        return model.render(chain);
+    }
+
+    if (chain != m_chain) {
+        releaseChain();
+        m_assignments.clear();
+        m_chain = chain;
+        m_retire = false;
+        m_serial = m_timeouts > 0 && m_sinceTimeout.elapsed() < backoff();
+    }
+    if (m_serial) {
+        if (!m_retire && m_sinceTimeout.elapsed() >= backoff()) {
+            // Every node is on this context now,
+            // so only a fresh chain can spread them out again
+            m_retire = true;
+        }
+        return model.render(chain);
+    }
+    if (m_retire) {
+        // Nodes keep state for this chain on contexts that were abandoned
+        // mid-frame, so it can't be rendered until it is replaced
+        return QMap<QSharedPointer<VideoNode>, GLuint>();
+    }
+
+    QElapsedTimer frameTimer;
+    frameTimer.start();
+
+    auto gl = QOpenGLContext::currentContext()->extraFunctions();
+    auto contextCount = m_workers.count() + 1;
+    auto count = model.vertices.count();
+
+    auto frame = QSharedPointer<RenderSchedulerFrame>::create();
+    frame->chain = chain;
+    frame->vertices = model.vertices;
+    frame->inputs = model.inputIndices();
+    frame->contextOf = assign(model, frame->inputs);
+    frame->shared = QVector<bool>(count, false);
+    frame->work = QVector<QVector<int>>(contextCount);
+    for (int i = 0; i < count; i++) {
+        frame->work[frame->contextOf.at(i)].append(i);
+        for (auto from : frame->inputs.at(i)) {
+            if (from >= 0 && frame->contextOf.at(from) != frame->contextOf.at(i)) {
+                frame->shared[from] = true;
+            }
+        }
+    }
+    frame->results = QVector<GLuint>(count, 0);
+    frame->fences = QVector<GLsync>(count, 0);
+    frame->done = QVector<bool>(count, false);
+    frame->endFences = QVector<GLsync>(contextCount, 0);
+    frame->busy = QVector<qint64>(contextCount, 0);
+
+    // Shared textures are created here
+    // so that the workers never race to create them
+    chain->beginFrame();
+    chain->blankTexture();
+    chain->noiseTexture();
+    frame->start = gl->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    gl->glFlush();
+
+    auto helpers = 0;
+    for (int c = 1; c < contextCount; c++) {
+        if (!frame->work.at(c).isEmpty()) helpers++;
+    }
+    frame->active = helpers + 1;
+    frame->sinceStart.start();
+    for (int c = 1; c < contextCount; c++) {
+        if (frame->work.at(c).isEmpty()) continue;
+        m_workers.at(c - 1)->post([frame, c]() {
+            frame->run(c);
+        });
+    }
+    auto ok = frame->run(0);
+    if (ok && !frame->finished.tryAcquire(helpers, frame->remainingTime())) {
+        QMutexLocker locker(&frame->lock);
+        // The workers clean up when they get here.
+        // If they finished in the meantime, the frame is fine after all.
+        ok = frame->active == 0;
+        if (!ok) {
+            frame->aborted = true;
+            frame->published.wakeAll();
+        }
+    }
+    if (!ok) {
+        // Whoever leaves the frame last deletes its fences
+        m_timeouts++;
+        m_sinceTimeout.start();
+        m_retire = true;
+        qWarning() << "A render context took more than" << WORKER_TIMEOUT_MS << "ms,"
+                   << "rendering on one context for the next" << backoff() << "ms";
+        return QMap<QSharedPointer<VideoNode>, GLuint>();
+    }
+    m_timeouts = 0;
+
+    // Everything the workers did must be done
+    // before this context uses their results
+    // or starts the next frame
+    for (int c = 1; c < contextCount; c++) {
+        if (frame->endFences.at(c) != 0) {
+            gl->glWaitSync(frame->endFences.at(c), 0, GL_TIMEOUT_IGNORED);
+            gl->glDeleteSync(frame->endFences.at(c));
+        }
+    }
+    for (auto fence : frame->fences) {
+        if (fence != 0) gl->glDeleteSync(fence);
+    }
+    gl->glDeleteSync(frame->start);
+
+    qint64 busy = 0;
+    for (auto b : frame->busy) busy += b;
+    auto elapsed = frameTimer.nsecsElapsed();
+    if (elapsed > 0) {
+        m_submissionOverlap += ((qreal)busy / elapsed - m_submissionOverlap) * SMOOTHING;
+    }
+
+    QMap<QSharedPointer<VideoNode>, GLuint> result;
+    for (int i = 0; i < count; i++) {
+        if (frame->results.at(i) != 0) {
+            result.insert(frame->vertices.at(i), frame->results.at(i));
+        }
+    }
+    return result;
+}
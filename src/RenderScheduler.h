@@ -0,0 +1,137 @@
+#pragma once
+
+#include "Model.h"
+#include "OpenGLWorkerContext.h"
+#include <QObject>
+#include <QSharedPointer>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QElapsedTimer>
+#include <QSemaphore>
+#include <QWaitCondition>
+#include <functional>
+
+// This class renders a model on several OpenGL contexts at once.
+//
+// The render plan is split into branches,
+// i.e. runs of nodes that each feed only the next one.
+// Independent branches
+// (e.g. two movie + effect stacks feeding a compositor)
+// are given to different contexts and rendered at the same time.
+// Where a node reads the output of a node
+// that was rendered on a different context,
+// the reader waits on a fence set after the writer
+// (glFenceSync / glWaitSync.)
+//
+// Nodes keep per-chain objects (e.g. framebuffers)
+// that can't be shared between contexts,
+// so once a node has been rendered on a context
+// it stays on that context for as long as the chain lives.
+// Changing the worker contexts forgets those assignments,
+// so the chain must be replaced when that happens.
+//
+// If a worker context takes longer than WORKER_TIMEOUT_MS,
+// the frame is abandoned (render() returns nothing for it)
+// and the chain is retired (see retiredChain()),
+// since its nodes have state on contexts that are now out of step.
+// The chain that replaces it renders on the first context alone
+// until a backoff has passed, and then it is retired in turn
+// so that the next one tries all of the contexts again.
+// The backoff doubles with every timeout in a row.
+//
+// The first context is the one that is current
+// when render() is called.
+// The others come from OpenGLWorkerContexts,
+// which must share with it.
+//
+// This class is NOT thread-safe.
+// It must only be used from the thread
+// that does the rendering.
+
+class RenderSchedulerFrame;
+
+// Runs jobs on the thread of an OpenGLWorkerContext
+class RenderSchedulerWorker : public QObject {
+    Q_OBJECT
+
+public:
+    RenderSchedulerWorker(QSharedPointer<OpenGLWorkerContext> context);
+    void post(std::function<void()> job);
+
+protected slots:
+    void run();
+
+protected:
+    QSharedPointer<OpenGLWorkerContext> m_context;
+    QMutex m_lock;
+    QList<std::function<void()>> m_jobs;
+};
+
+class RenderScheduler {
+public:
+    RenderScheduler();
+   ~RenderScheduler();
+
+    // The extra contexts to render on.
+    // With none, render() is the same as ModelCopyForRendering::render.
+    void setWorkerContexts(QList<QSharedPointer<OpenGLWorkerContext>> contexts);
+    QList<QSharedPointer<OpenGLWorkerContext>> workerContexts() const;
+
+    // Renders the model on the given chain,
+    // returning the same thing as ModelCopyForRendering::render
+    QMap<QSharedPointer<VideoNode>, GLuint> render(ModelCopyForRendering &model, QSharedPointer<Chain> chain);
+
+    // CPU time spent issuing paint() calls on all contexts
+    // divided by the length of the frame, smoothed.
+    // 1 means that no two contexts were submitting commands at once.
+    // This says nothing about how much the GPU ran concurrently,
+    // since it may well execute the contexts' commands one after another.
+    qreal submissionOverlap() const;
+
+    // The number of branches in the last plan
+    int branchCount() const;
+
+    // The chain given to render() if it should be replaced
+    // with a fresh one, so that nodes can move between contexts, or null
+    QSharedPointer<Chain> retiredChain() const;
+
+    // How long a frame may wait for a worker before giving up on it
+    static constexpr int WORKER_TIMEOUT_MS = 1000;
+    // How long to render on one context after a timeout
+    // before trying the others again,
+    // doubling for every further timeout up to MAX_BACKOFF_MS
+    static constexpr int BACKOFF_MS = 2000;
+    static constexpr int MAX_BACKOFF_MS = 60000;
+    static constexpr qreal SMOOTHING = 0.1;
+
+protected:
+    // Returns which context each vertex should be rendered on
+    QVector<int> assign(const ModelCopyForRendering &model, const QVector<QVector<int>> &inputs);
+
+    // Frees the objects that the worker contexts made for the chain
+    void releaseChain();
+
+    // How long to stay on one context after the last timeout
+    qint64 backoff() const;
+
+    // Which context each node was first rendered on
+    struct Assignment {
+        QWeakPointer<VideoNode> node;
+        int context;
+    };
+    QHash<VideoNode *, Assignment> m_assignments;
+
+    QList<QSharedPointer<OpenGLWorkerContext>> m_contexts;
+    QList<QSharedPointer<RenderSchedulerWorker>> m_workers;
+    QSharedPointer<Chain> m_chain;
+    // Whether m_chain renders on the first context only
+    bool m_serial{};
+    // Whether m_chain should be replaced
+    bool m_retire{};
+    // Timeouts since the last frame that rendered on every context
+    int m_timeouts{};
+    QElapsedTimer m_sinceTimeout;
+    qreal m_submissionOverlap{1};
+    int m_branchCount{};
+};
@@ -2,10 +2,23 @@
 #include <QDebug>
 #include <QJsonObject>
 #include <QGuiApplication>
+#include <QJsonArray>
+#include <QPointF>
 
 ScreenOutputNode::ScreenOutputNode(Context *context, QSize chainSize)
     : OutputNode(context, chainSize)
 {
+    // Projectors get the extra precision by default;
+    // nothing has rendered with the chain yet
+    // so it can be changed in place
+    m_chain->setRenderFormat(GL_RGBA16F);
+}
+
+ScreenOutputNode::~ScreenOutputNode() {
+    if (!m_canvas.isNull()) {
+        disconnect(m_canvas.data(), &MasterCanvas::chainChanged, this, &ScreenOutputNode::onCanvasChainChanged);
+        m_canvas->removeMember(this);
+    }
 }
 
 void ScreenOutputNode::init()
@@ -20,6 +33,7 @@ void ScreenOutputNode::init()
     QSize native = m_outputWindow->screenSize();
     resize(native);
     onScreenSizeChanged(native);
+    updateWindow();
 
     reload();
     connect(&m_reloader, &QTimer::timeout, this, &ScreenOutputNode::reload);
@@ -68,12 +82,13 @@ void ScreenOutputNode::setScreenName(QString screenName) {
 }
 
 QSize ScreenOutputNode::resolution() {
-    return chain()->size();
+    return outputSize();
 }
 
 void ScreenOutputNode::setResolution(QSize resolution) {
-    if (resolution != chain()->size()) {
+    if (resolution != outputSize()) {
         resize(resolution);
+        updateCanvasMember();
         emit resolutionChanged(resolution);
     }
 }
@@ -104,6 +119,180 @@ void ScreenOutputNode::onScreenSizeChanged(QSize size) {
     }
 }
 
+QJsonObject ScreenOutputNode::serialize() {
+    QJsonObject o = OutputNode::serialize();
+    o.insert("canvas", canvas());
+    auto r = region();
+    o.insert("region", QJsonArray({r.x(), r.y(), r.width(), r.height()}));
+    auto e = edgeBlend();
+    o.insert("edgeBlend", QJsonArray({e.x(), e.y(), e.z(), e.w()}));
+    o.insert("edgeBlendGamma", edgeBlendGamma());
+    QJsonArray corners;
+    for (auto corner : keystone()) {
+        auto p = corner.toPointF();
+        corners.append(QJsonArray({p.x(), p.y()}));
+    }
+    o.insert("keystone", corners);
+    return o;
+}
+
+QString ScreenOutputNode::canvas() {
+    QMutexLocker locker(&m_stateLock);
+    return m_canvasName;
+}
+
+void ScreenOutputNode::setCanvas(QString canvas) {
+    {
+        QMutexLocker locker(&m_stateLock);
+        if (canvas == m_canvasName) return;
+    }
+
+    // Creating a canvas creates an OpenGL context,
+    // so it can't be done with the lock held
+    auto newCanvas = canvas.isEmpty() ? QSharedPointer<MasterCanvas>() : MasterCanvas::get(canvas);
+    QSharedPointer<MasterCanvas> oldCanvas;
+    {
+        QMutexLocker locker(&m_stateLock);
+        m_canvasName = canvas;
+        oldCanvas = m_canvas;
+        m_canvas = newCanvas;
+    }
+    if (!oldCanvas.isNull()) {
+        disconnect(oldCanvas.data(), &MasterCanvas::chainChanged, this, &ScreenOutputNode::onCanvasChainChanged);
+        oldCanvas->removeMember(this);
+    }
+    if (!newCanvas.isNull()) {
+        connect(newCanvas.data(), &MasterCanvas::chainChanged, this, &ScreenOutputNode::onCanvasChainChanged);
+    }
+    updateCanvasMember();
+    updateRequestedChains();
+    updateWindow();
+    emit canvasChanged(canvas);
+}
+
+void ScreenOutputNode::onCanvasChainChanged() {
+    updateRequestedChains();
+}
+
+bool ScreenOutputNode::drawsTiles() {
+    return true;
+}
+
+QList<QSharedPointer<Chain>> ScreenOutputNode::currentChains() {
+    if (m_canvas.isNull()) return OutputNode::currentChains();
+    return {m_canvas->chain()};
+}
+
+void ScreenOutputNode::updateCanvasMember() {
+    QSharedPointer<MasterCanvas> canvas;
+    QRectF region;
+    {
+        QMutexLocker locker(&m_stateLock);
+        canvas = m_canvas;
+        region = m_region;
+    }
+    if (canvas.isNull()) return;
+    canvas->setMember(this, outputSize(), region);
+}
+
+void ScreenOutputNode::updateWindow() {
+    if (m_outputWindow.isNull()) return;
+    QSharedPointer<MasterCanvas> canvas;
+    QRectF region;
+    QVector4D edgeBlend;
+    qreal edgeBlendGamma;
+    QPolygonF keystone;
+    {
+        QMutexLocker locker(&m_stateLock);
+        canvas = m_canvas;
+        region = m_region;
+        edgeBlend = m_edgeBlend;
+        edgeBlendGamma = m_edgeBlendGamma;
+        for (auto corner : m_keystone) {
+            keystone.append(corner.toPointF());
+        }
+    }
+    if (keystone.count() != 4) {
+        keystone = QPolygonF({QPointF(0, 0), QPointF(1, 0), QPointF(1, 1), QPointF(0, 1)});
+    }
+    m_outputWindow->setView(canvas, region, edgeBlend, edgeBlendGamma, keystone);
+}
+
+QRectF ScreenOutputNode::region() {
+    QMutexLocker locker(&m_stateLock);
+    return m_region;
+}
+
+void ScreenOutputNode::setRegion(QRectF region) {
+    region = region.normalized() & QRectF(0, 0, 1, 1);
+    if (region.isEmpty()) return;
+    {
+        QMutexLocker locker(&m_stateLock);
+        if (region == m_region) return;
+        m_region = region;
+    }
+    updateCanvasMember();
+    updateWindow();
+    emit regionChanged(region);
+}
+
+QVector4D ScreenOutputNode::edgeBlend() {
+    QMutexLocker locker(&m_stateLock);
+    return m_edgeBlend;
+}
+
+void ScreenOutputNode::setEdgeBlend(QVector4D edgeBlend) {
+    edgeBlend = QVector4D(qBound(0.f, edgeBlend.x(), 1.f),
+                          qBound(0.f, edgeBlend.y(), 1.f),
+                          qBound(0.f, edgeBlend.z(), 1.f),
+                          qBound(0.f, edgeBlend.w(), 1.f));
+    {
+        QMutexLocker locker(&m_stateLock);
+        if (edgeBlend == m_edgeBlend) return;
+        m_edgeBlend = edgeBlend;
+    }
+    updateWindow();
+    emit edgeBlendChanged(edgeBlend);
+}
+
+qreal ScreenOutputNode::edgeBlendGamma() {
+    QMutexLocker locker(&m_stateLock);
+    return m_edgeBlendGamma;
+}
+
+void ScreenOutputNode::setEdgeBlendGamma(qreal edgeBlendGamma) {
+    edgeBlendGamma = qBound((qreal)0.1, edgeBlendGamma, (qreal)10);
+    {
+        QMutexLocker locker(&m_stateLock);
+        if (edgeBlendGamma == m_edgeBlendGamma) return;
+        m_edgeBlendGamma = edgeBlendGamma;
+    }
+    updateWindow();
+    emit edgeBlendGammaChanged(edgeBlendGamma);
+}
+
+QVariantList ScreenOutputNode::keystone() {
+    QMutexLocker locker(&m_stateLock);
+    if (m_keystone.isEmpty()) {
+        return QVariantList({QPointF(0, 0), QPointF(1, 0), QPointF(1, 1), QPointF(0, 1)});
+    }
+    return m_keystone;
+}
+
+void ScreenOutputNode::setKeystone(QVariantList keystone) {
+    if (!keystone.isEmpty() && keystone.count() != 4) {
+        qWarning() << "A keystone needs exactly 4 corners";
+        return;
+    }
+    {
+        QMutexLocker locker(&m_stateLock);
+        if (keystone == m_keystone) return;
+        m_keystone = keystone;
+    }
+    updateWindow();
+    emit keystoneChanged(this->keystone());
+}
+
 QString ScreenOutputNode::typeName() {
     return "ScreenOutputNode";
 }
@@ -111,6 +300,30 @@ QString ScreenOutputNode::typeName() {
 VideoNodeSP *ScreenOutputNode::deserialize(Context *context, QJsonObject obj) {
     auto node = new ScreenOutputNodeSP(new ScreenOutputNode(context, QSize(640,480)));
     (*node)->init();
+
+    auto region = obj.value("region").toArray();
+    if (region.count() == 4) {
+        (*node)->setRegion(QRectF(region.at(0).toDouble(), region.at(1).toDouble(),
+                                  region.at(2).toDouble(), region.at(3).toDouble()));
+    }
+    auto edgeBlend = obj.value("edgeBlend").toArray();
+    if (edgeBlend.count() == 4) {
+        (*node)->setEdgeBlend(QVector4D(edgeBlend.at(0).toDouble(), edgeBlend.at(1).toDouble(),
+                                        edgeBlend.at(2).toDouble(), edgeBlend.at(3).toDouble()));
+    }
+    if (obj.contains("edgeBlendGamma")) {
+        (*node)->setEdgeBlendGamma(obj.value("edgeBlendGamma").toDouble());
+    }
+    QVariantList keystone;
+    for (auto corner : obj.value("keystone").toArray()) {
+        auto point = corner.toArray();
+        keystone.append(QPointF(point.at(0).toDouble(), point.at(1).toDouble()));
+    }
+    if (keystone.count() == 4) {
+        (*node)->setKeystone(keystone);
+    }
+    (*node)->setCanvas(obj.value("canvas").toString());
+    (*node)->deserializeSettings(obj);
     return node;
 }
 
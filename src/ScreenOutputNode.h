@@ -2,9 +2,23 @@
 
 #include "OutputNode.h"
 #include "OutputWindow.h"
+#include "MasterCanvas.h"
 #include <QList>
 #include <QSize>
 #include <QScreen>
+#include <QRectF>
+#include <QVector4D>
+#include <QJsonObject>
+
+// This class extends OutputNode to show the output in a window
+// on one screen.
+//
+// For multi-projector setups, several screen outputs
+// can share a named canvas (see MasterCanvas)
+// and each show only a region of it,
+// so that the model is rendered once for all of them.
+// Each output can also fade out its edges where it overlaps a neighbor
+// and warp its picture to make up for a keystoned projector.
 
 class ScreenOutputNode
     : public OutputNode {
@@ -15,11 +29,19 @@ class ScreenOutputNode
     Q_PROPERTY(QString screenName READ screenName WRITE setScreenName NOTIFY screenNameChanged);
     Q_PROPERTY(QVariantList suggestedResolutions READ suggestedResolutions NOTIFY suggestedResolutionsChanged);
     Q_PROPERTY(QSize resolution READ resolution WRITE setResolution NOTIFY resolutionChanged);
+    Q_PROPERTY(QString canvas READ canvas WRITE setCanvas NOTIFY canvasChanged);
+    Q_PROPERTY(QRectF region READ region WRITE setRegion NOTIFY regionChanged);
+    Q_PROPERTY(QVector4D edgeBlend READ edgeBlend WRITE setEdgeBlend NOTIFY edgeBlendChanged);
+    Q_PROPERTY(qreal edgeBlendGamma READ edgeBlendGamma WRITE setEdgeBlendGamma NOTIFY edgeBlendGammaChanged);
+    Q_PROPERTY(QVariantList keystone READ keystone WRITE setKeystone NOTIFY keystoneChanged);
 
 public:
     ScreenOutputNode(Context *context, QSize chainSize);
+   ~ScreenOutputNode() override;
     void init();
 
+    QJsonObject serialize() override;
+
     // These static methods are required for VideoNode creation
     // through the registry
 
@@ -56,6 +78,34 @@ public slots:
     void setResolution(QSize resolution);
     QVariantList suggestedResolutions();
 
+    // The name of the canvas to show a region of,
+    // or empty to render a chain of this output's own
+    QString canvas();
+    void setCanvas(QString canvas);
+
+    // The part of the picture to show, as a fraction of it
+    // from the bottom left.
+    // Defaults to all of it.
+    QRectF region();
+    void setRegion(QRectF region);
+
+    // The width of the ramp that fades out each edge
+    // (left, bottom, right, top)
+    // as a fraction of the output.
+    // The ramp is linear in light, assuming a display
+    // with the given gamma.
+    QVector4D edgeBlend();
+    void setEdgeBlend(QVector4D edgeBlend);
+    qreal edgeBlendGamma();
+    void setEdgeBlendGamma(qreal edgeBlendGamma);
+
+    // Where the corners of the picture go on the screen,
+    // as points from the bottom left that are fractions of the screen.
+    // The order is bottom left, bottom right, top right, top left.
+    // Defaults to the corners of the screen.
+    QVariantList keystone();
+    void setKeystone(QVariantList keystone);
+
 signals:
     void shownChanged(bool shown);
     void foundChanged(bool found);
@@ -63,16 +113,37 @@ signals:
     void screenNameChanged(QString screenName);
     void resolutionChanged(QSize resolution);
     void suggestedResolutionsChanged(QVariantList resolutions);
+    void canvasChanged(QString canvas);
+    void regionChanged(QRectF region);
+    void edgeBlendChanged(QVector4D edgeBlend);
+    void edgeBlendGammaChanged(qreal edgeBlendGamma);
+    void keystoneChanged(QVariantList keystone);
 
 protected slots:
     void reload();
     void onScreenSizeChanged(QSize screenSize);
+    void onCanvasChainChanged();
 
 protected:
+    bool drawsTiles() override;
+    QList<QSharedPointer<Chain>> currentChains() override;
+
+    // Tells the canvas how much of it this output needs
+    void updateCanvasMember();
+
+    // Passes the settings on to the window
+    void updateWindow();
+
     QList<QScreen *> m_screens;
     QStringList m_screenNameStrings;
     QTimer m_reloader;
     QList<QSize> m_suggestedResolutions;
+    QString m_canvasName;
+    QSharedPointer<MasterCanvas> m_canvas;
+    QRectF m_region{0, 0, 1, 1};
+    QVector4D m_edgeBlend;
+    qreal m_edgeBlendGamma{2.2};
+    QVariantList m_keystone;
 
     // Not actually shared, just convenient for deletion
     QSharedPointer<OutputWindow> m_outputWindow;
@@ -1,5 +1,7 @@
 #include "SelfTimedReadBackOutputNode.h"
 #include "Context.h"
+#include <QVector4D>
+#include <cstring>
 
 SelfTimedReadBackOutputNode::SelfTimedReadBackOutputNode(Context *context, QSize chainSize)
     : OutputNode(context, chainSize) {
@@ -15,6 +17,7 @@ void SelfTimedReadBackOutputNode::init(long msec)
 
     connect(m_worker.data(), &STRBONOpenGLWorker::initialized, this, &SelfTimedReadBackOutputNode::initialize, Qt::DirectConnection);
     connect(m_worker.data(), &STRBONOpenGLWorker::frame, this, &SelfTimedReadBackOutputNode::frame, Qt::DirectConnection);
+    connect(m_worker.data(), &STRBONOpenGLWorker::tile, this, &SelfTimedReadBackOutputNode::tile, Qt::DirectConnection);
 
     {
         auto result = QMetaObject::invokeMethod(m_worker.data(), "initialize", Q_ARG(QSize, chain()->size()));
@@ -25,6 +28,10 @@ void SelfTimedReadBackOutputNode::init(long msec)
     }
 }
 
+bool SelfTimedReadBackOutputNode::drawsTiles() {
+    return true;
+}
+
 void SelfTimedReadBackOutputNode::start() {
     auto result = QMetaObject::invokeMethod(m_worker.data(), "start");
     Q_ASSERT(result);
@@ -66,10 +73,12 @@ QSharedPointer<QOpenGLShaderProgram> STRBONOpenGLWorker::loadBlitShader() {
     auto fragmentString = QString{
         "#version 150\n"
         "uniform sampler2D iFrame;\n"
+        "// The part of iFrame to draw, (x, y, width, height)\n"
+        "uniform vec4 iSourceRect;\n"
         "in vec2 uv;\n"
         "out vec4 fragColor;\n"
         "void main() {\n"
-        "    fragColor = texture(iFrame, uv);\n"
+        "    fragColor = texture(iFrame, iSourceRect.xy + uv * iSourceRect.zw);\n"
         "}\n"};
 
     auto shader = QSharedPointer<QOpenGLShaderProgram>(new QOpenGLShaderProgram());
@@ -145,39 +154,78 @@ void STRBONOpenGLWorker::onTimeout() {
     if (p.isNull()) return; // SelfTimedReadBackOutputNode was deleted
 
     makeCurrent();
-    GLuint texture = p->render();
-
-    if (texture == 0) {
+    auto chain = p->chain();
+    auto canvas = QSizeF(chain->size());
+    auto scale = QSizeF(m_size.width() / canvas.width(), m_size.height() / canvas.height());
+    auto tiled = p->tileCount() > 0;
+    auto vao = chain->vao();
+    int drawn = 0;
+
+    // Each tile is drawn into its part of the frame
+    // and read back while its textures are still around
+    p->renderTiles([&](GLuint texture, QRect tileRect, QRect interior) {
+        if (texture == 0) return;
+
+        // Where the interior lands in the frame.
+        // Rounding the edges (not the sizes) keeps neighbors from overlapping.
+        auto left = qRound(interior.x() * scale.width());
+        auto bottom = qRound(interior.y() * scale.height());
+        auto right = qRound((interior.x() + interior.width()) * scale.width());
+        auto top = qRound((interior.y() + interior.height()) * scale.height());
+        auto rect = QRect(left, bottom, right - left, top - bottom);
+        if (rect.isEmpty()) return;
+
+        glDisable(GL_DEPTH_TEST);
+        glDisable(GL_BLEND);
+
+        m_fbo->bind();
+        glViewport(rect.x(), rect.y(), rect.width(), rect.height());
+
+        m_shader->bind();
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_LINEAR);
+
+        m_shader->setUniformValue("iFrame", 0);
+        m_shader->setUniformValue("iSourceRect", QVector4D(
+                    (float)(interior.x() - tileRect.x()) / tileRect.width(),
+                    (float)(interior.y() - tileRect.y()) / tileRect.height(),
+                    (float)interior.width() / tileRect.width(),
+                    (float)interior.height() / tileRect.height()));
+
+        vao->bind();
+        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+        vao->release();
+
+        // Straight into the tile's place in the frame
+        glPixelStorei(GL_PACK_ROW_LENGTH, m_size.width());
+        glPixelStorei(GL_PACK_SKIP_PIXELS, rect.x());
+        glPixelStorei(GL_PACK_SKIP_ROWS, rect.y());
+        glReadPixels(rect.x(), rect.y(), rect.width(), rect.height(), GL_RGBA, GL_UNSIGNED_BYTE, m_pixelBuffer.data());
+        glPixelStorei(GL_PACK_ROW_LENGTH, 0);
+        glPixelStorei(GL_PACK_SKIP_PIXELS, 0);
+        glPixelStorei(GL_PACK_SKIP_ROWS, 0);
+
+        m_fbo->release();
+        m_shader->release();
+        drawn++;
+
+        if (tiled) {
+            QByteArray pixels(4 * rect.width() * rect.height(), Qt::Uninitialized);
+            for (int row = 0; row < rect.height(); row++) {
+                memcpy(pixels.data() + 4 * row * rect.width(),
+                       m_pixelBuffer.constData() + 4 * ((rect.y() + row) * m_size.width() + rect.x()),
+                       4 * rect.width());
+            }
+            emit tile(m_size, rect, pixels);
+        }
+    });
+
+    if (drawn == 0) {
         qWarning() << "No frame available";
         return;
     }
 
-    auto vao = p->chain()->vao();
-
-    glClearColor(0, 0, 0, 0);
-    glDisable(GL_DEPTH_TEST);
-    glDisable(GL_BLEND);
-
-    m_fbo->bind();
-    // VAO??
-    glViewport(0, 0, m_size.width(), m_size.height());
-
-    m_shader->bind();
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, texture);
-    glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_LINEAR);
-
-    m_shader->setUniformValue("iFrame", 0);
-
-    vao->bind();
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-    vao->release();
-
-    glReadPixels(0, 0, m_size.width(), m_size.height(), GL_RGBA, GL_UNSIGNED_BYTE, m_pixelBuffer.data());
-
-    m_fbo->release();
-    m_shader->release();
-
     emit frame(m_size, m_pixelBuffer);
 }
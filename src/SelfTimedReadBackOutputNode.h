@@ -26,6 +26,10 @@
 
 // A new thread will be created,
 // and frame() will be emitted in the context of this new thread.
+// When the output is tiled (see OutputNode::maxTileSize),
+// each tile is read back as soon as it is rendered
+// and emitted through tile(), in the frame's pixels,
+// before the assembled frame is emitted.
 // initialize() is also emitted in the context of the new thread,
 // but just once at startup.
 
@@ -53,8 +57,13 @@ public slots:
 signals:
     void initialize();
     void frame(QSize size, QByteArray frame);
+    // rect is the part of the frame (of the given size)
+    // that the pixels cover, from the bottom left
+    void tile(QSize size, QRect rect, QByteArray pixels);
 
 protected:
+    bool drawsTiles() override;
+
     OpenGLWorkerContext *m_workerContext{};
     QSharedPointer<STRBONOpenGLWorker> m_worker;
 };
@@ -83,6 +92,7 @@ signals:
     void fatal(QString str);
     void initialized();
     void frame(QSize size, QByteArray pixelBuffer);
+    void tile(QSize size, QRect rect, QByteArray pixels);
 
 protected:
     QSharedPointer<QOpenGLShaderProgram> loadBlitShader();
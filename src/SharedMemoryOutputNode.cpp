@@ -0,0 +1,219 @@
+#include "SharedMemoryOutputNode.h"
+#include "radiance_shm.h"
+#include <QDebug>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+
+#ifdef Q_OS_UNIX
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+constexpr int SharedMemoryOutputNode::SLOT_COUNT;
+
+SharedMemoryOutputNode::SharedMemoryOutputNode(Context *context, QSize chainSize)
+    : SelfTimedReadBackOutputNode(context, chainSize)
+    , m_name("/radiance") {
+}
+
+SharedMemoryOutputNode::~SharedMemoryOutputNode() {
+    closeRing();
+}
+
+void SharedMemoryOutputNode::init(long msec) {
+    m_interval = msec;
+    SelfTimedReadBackOutputNode::init(msec);
+    connect(this, &SelfTimedReadBackOutputNode::frame, this, &SharedMemoryOutputNode::onFrame, Qt::DirectConnection);
+    start();
+}
+
+QString SharedMemoryOutputNode::name() {
+    QMutexLocker locker(&m_stateLock);
+    return m_name;
+}
+
+void SharedMemoryOutputNode::setName(QString value) {
+    if (!value.startsWith("/")) value.prepend("/");
+    {
+        QMutexLocker locker(&m_stateLock);
+        if (value == m_name) return;
+        m_name = value;
+    }
+    emit nameChanged(value);
+}
+
+QJsonObject SharedMemoryOutputNode::serialize() {
+    QJsonObject o = OutputNode::serialize();
+    o.insert("name", name());
+    auto size = chain()->size();
+    o.insert("size", QJsonArray({size.width(), size.height()}));
+    o.insert("interval", (int)m_interval);
+    return o;
+}
+
+void SharedMemoryOutputNode::onFrame(QSize size, QByteArray frame) {
+#ifdef Q_OS_UNIX
+    auto name = this->name();
+    if (name != m_ringName || size != m_ringSize) {
+        closeRing();
+        if (name == m_failedName) return;
+        if (!openRing(name, size)) {
+            m_failedName = name;
+            setNodeState(VideoNode::Broken);
+            return;
+        }
+        m_failedName.clear();
+        setNodeState(VideoNode::Ready);
+    }
+
+    auto header = (radiance_shm_header *)m_ring;
+    auto sequence = ++m_sequence;
+    auto slot = radiance_shm_slot(header, sequence);
+
+    // Readers check the slot's sequence before and after reading,
+    // so they notice if it changes underneath them
+    __atomic_store_n(&slot->sequence, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    slot->timestamp_ns = (quint64)now.tv_sec * 1000000000 + now.tv_nsec;
+    slot->width = size.width();
+    slot->height = size.height();
+    slot->format = RADIANCE_SHM_FORMAT_RGBA8;
+    slot->size = frame.size();
+    memcpy((char *)(slot + 1), frame.constData(), frame.size());
+
+    __atomic_store_n(&slot->sequence, sequence, __ATOMIC_RELEASE);
+    __atomic_store_n(&header->latest, sequence, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&header->notify, 1, __ATOMIC_RELEASE);
+#ifdef __linux__
+    syscall(SYS_futex, &header->notify, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+#endif
+#else
+    Q_UNUSED(size);
+    Q_UNUSED(frame);
+    if (nodeState() != VideoNode::Broken) {
+        qWarning() << "Shared memory output is not supported on this platform";
+        setNodeState(VideoNode::Broken);
+    }
+#endif
+}
+
+bool SharedMemoryOutputNode::openRing(QString name, QSize size) {
+#ifdef Q_OS_UNIX
+    auto frameBytes = (size_t)4 * size.width() * size.height();
+    // Pixels start and slots end on a cache line
+    auto slotSize = (sizeof(radiance_shm_slot) + frameBytes + 63) / 64 * 64;
+    auto slotsOffset = (sizeof(radiance_shm_header) + 63) / 64 * 64;
+    auto bytes = slotsOffset + SLOT_COUNT * slotSize;
+
+    // Start from a fresh object, so that readers of an old one
+    // (possibly of a different size) are never cut short.
+    // They keep the old one until they reopen.
+    auto nameBytes = name.toLocal8Bit();
+    shm_unlink(nameBytes.constData());
+    auto fd = shm_open(nameBytes.constData(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+        qWarning() << "Could not create shared memory" << name << ":" << strerror(errno);
+        return false;
+    }
+    if (ftruncate(fd, bytes) != 0) {
+        qWarning() << "Could not size shared memory" << name << ":" << strerror(errno);
+        ::close(fd);
+        shm_unlink(nameBytes.constData());
+        return false;
+    }
+    auto ring = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ring == MAP_FAILED) {
+        qWarning() << "Could not map shared memory" << name << ":" << strerror(errno);
+        ::close(fd);
+        shm_unlink(nameBytes.constData());
+        return false;
+    }
+
+    // ftruncate zeroed everything,
+    // so every slot's sequence and latest start out at 0
+    auto header = (radiance_shm_header *)ring;
+    header->version = RADIANCE_SHM_VERSION;
+    header->slots_offset = slotsOffset;
+    header->slot_size = slotSize;
+    header->slot_count = SLOT_COUNT;
+    __atomic_store_n(&header->magic, RADIANCE_SHM_MAGIC, __ATOMIC_RELEASE);
+
+    m_fd = fd;
+    m_ring = (char *)ring;
+    m_ringBytes = bytes;
+    m_ringName = name;
+    m_ringSize = size;
+    m_sequence = 0;
+    return true;
+#else
+    Q_UNUSED(name);
+    Q_UNUSED(size);
+    return false;
+#endif
+}
+
+void SharedMemoryOutputNode::closeRing() {
+#ifdef Q_OS_UNIX
+    if (m_ring == nullptr) return;
+    // Tell readers to reopen by name
+    auto header = (radiance_shm_header *)m_ring;
+    __atomic_store_n(&header->magic, 0, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&header->notify, 1, __ATOMIC_RELEASE);
+#ifdef __linux__
+    syscall(SYS_futex, &header->notify, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+#endif
+    munmap(m_ring, m_ringBytes);
+    ::close(m_fd);
+    shm_unlink(m_ringName.toLocal8Bit().constData());
+    m_ring = nullptr;
+    m_fd = -1;
+    m_ringName.clear();
+    m_ringSize = QSize();
+#endif
+}
+
+QString SharedMemoryOutputNode::typeName() {
+    return "SharedMemoryOutputNode";
+}
+
+VideoNodeSP *SharedMemoryOutputNode::deserialize(Context *context, QJsonObject obj) {
+    auto size = QSize(256, 256);
+    auto sizeArray = obj.value("size").toArray();
+    if (sizeArray.count() == 2 && sizeArray.at(0).toInt() > 0 && sizeArray.at(1).toInt() > 0) {
+        size = QSize(sizeArray.at(0).toInt(), sizeArray.at(1).toInt());
+    }
+    auto interval = obj.value("interval").toInt(16);
+    if (interval <= 0) interval = 16;
+
+    auto node = new SharedMemoryOutputNodeSP(new SharedMemoryOutputNode(context, size));
+    auto name = obj.value("name").toString();
+    if (!name.isEmpty()) {
+        (*node)->setName(name);
+    }
+    (*node)->init(interval);
+    (*node)->deserializeSettings(obj);
+    return node;
+}
+
+bool SharedMemoryOutputNode::canCreateFromFile(QString filename) {
+    return false;
+}
+
+VideoNodeSP *SharedMemoryOutputNode::fromFile(Context *context, QString filename) {
+    return nullptr;
+}
+
+QMap<QString, QString> SharedMemoryOutputNode::customInstantiators() {
+    auto m = QMap<QString, QString>();
+    m.insert("SharedMemoryOutput", "SharedMemoryOutputInstantiator.qml");
+    return m;
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "SelfTimedReadBackOutputNode.h"
+
+// Publishes frames to POSIX shared memory,
+// for other programs on the same machine
+// (a DMX bridge, an LED driver, a recorder)
+// to read without going through a socket.
+//
+// Frames go into a ring of a few slots,
+// so a reader can take its time with one frame
+// while the next is written.
+// The layout is in radiance_shm.h,
+// and python/radiance/shared_memory.py reads it.
+
+class SharedMemoryOutputNode
+    : public SelfTimedReadBackOutputNode {
+    Q_OBJECT
+    Q_PROPERTY(QString name READ name WRITE setName NOTIFY nameChanged);
+
+public:
+    SharedMemoryOutputNode(Context *context, QSize chainSize);
+   ~SharedMemoryOutputNode() override;
+    void init(long msec);
+
+    QJsonObject serialize() override;
+
+    // These static methods are required for VideoNode creation
+    // through the registry
+
+    // A string representation of this VideoNode type
+    static QString typeName();
+
+    // Create a VideoNode from a JSON description of one
+    // Returns nullptr if the description is invalid
+    static VideoNodeSP *deserialize(Context *context, QJsonObject obj);
+
+    // Return true if a VideoNode could be created from
+    // the given filename
+    // This check should be very quick.
+    static bool canCreateFromFile(QString filename);
+
+    // Create a VideoNode from a filename
+    // Returns nullptr if a VideoNode cannot be create from the given filename
+    static VideoNodeSP *fromFile(Context *context, QString filename);
+
+    // Returns QML filenames that can be loaded
+    // to instantiate custom instances of this VideoNode
+    static QMap<QString, QString> customInstantiators();
+
+    // Slots in the ring
+    static constexpr int SLOT_COUNT = 3;
+
+public slots:
+    // The name of the shared memory object, e.g. "/radiance".
+    // A leading slash is added if it is missing.
+    QString name();
+    void setName(QString value);
+
+signals:
+    void nameChanged(QString value);
+
+protected:
+    void onFrame(QSize size, QByteArray frame);
+
+    // Creates and maps the shared memory for frames of the given size.
+    // Only called from the frame thread.
+    bool openRing(QString name, QSize size);
+    void closeRing();
+
+    QString m_name;
+    long m_interval{};
+
+    // Only touched from the frame thread
+    QString m_ringName;
+    QSize m_ringSize;
+    int m_fd{-1};
+    char *m_ring{};
+    size_t m_ringBytes{};
+    quint64 m_sequence{};
+    // Don't retry a name that failed every frame
+    QString m_failedName;
+};
+
+typedef QmlSharedPointer<SharedMemoryOutputNode, SelfTimedReadBackOutputNodeSP> SharedMemoryOutputNodeSP;
+Q_DECLARE_METATYPE(SharedMemoryOutputNodeSP*)
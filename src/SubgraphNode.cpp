@@ -0,0 +1,235 @@
+#include "SubgraphNode.h"
+#include "Paths.h"
+#include "Context.h"
+#include <QDebug>
+#include <QFileInfo>
+#include <QJsonObject>
+#include <algorithm>
+
+QMutex Subgraph::s_lock;
+QMap<QString, QWeakPointer<Subgraph>> Subgraph::s_subgraphs;
+QStringList Subgraph::s_loading;
+
+Subgraph::Subgraph(QString filename)
+    : m_filename(filename)
+{
+}
+
+Subgraph::~Subgraph() {
+    QMutexLocker locker(&s_lock);
+    // Don't remove a newer Subgraph for the same file
+    if (s_subgraphs.value(m_filename).isNull()) {
+        s_subgraphs.remove(m_filename);
+    }
+}
+
+QSharedPointer<Subgraph> Subgraph::get(Context *context, QString filename, QString *error) {
+    auto path = QFileInfo(Paths::expandLibraryPath(filename)).absoluteFilePath();
+    {
+        QMutexLocker locker(&s_lock);
+        auto existing = s_subgraphs.value(path).toStrongRef();
+        if (!existing.isNull()) return existing;
+        if (s_loading.contains(path)) {
+            *error = QString("\"%1\" contains itself").arg(filename);
+            return QSharedPointer<Subgraph>();
+        }
+        if (!QFileInfo(path).isFile()) {
+            *error = QString("Could not find \"%1\"").arg(filename);
+            return QSharedPointer<Subgraph>();
+        }
+        s_loading.append(path);
+    }
+
+    // The lock is not held while loading
+    // since the file may contain other subgraphs
+    auto subgraph = QSharedPointer<Subgraph>(new Subgraph(path));
+    subgraph->m_model = QSharedPointer<Model>(new Model(), &QObject::deleteLater);
+    subgraph->m_model->load(context, context->registry(), path);
+
+    auto vertices = subgraph->m_model->vertices();
+    auto edges = subgraph->m_model->edges();
+    for (int i = vertices.count() - 1; i >= 0; i--) {
+        auto vertex = vertices.at(i);
+        auto isSink = std::none_of(edges.begin(), edges.end(), [vertex](const Edge &e) {
+            return e.fromVertex == vertex;
+        });
+        if (isSink) {
+            subgraph->m_output = qSharedPointerCast<VideoNode>(*vertex);
+            break;
+        }
+    }
+
+    QMutexLocker locker(&s_lock);
+    s_loading.removeAll(path);
+    if (subgraph->m_output.isNull()) {
+        *error = QString("\"%1\" does not contain any nodes").arg(filename);
+        return QSharedPointer<Subgraph>();
+    }
+    s_subgraphs.insert(path, subgraph);
+    return subgraph;
+}
+
+void Subgraph::addChain(QSharedPointer<Chain> chain) {
+    bool first;
+    {
+        QMutexLocker locker(&m_lock);
+        first = m_chainCounts[chain]++ == 0;
+    }
+    if (first) m_model->addChain(chain);
+}
+
+void Subgraph::removeChain(QSharedPointer<Chain> chain) {
+    {
+        QMutexLocker locker(&m_lock);
+        auto count = m_chainCounts.find(chain);
+        if (count == m_chainCounts.end()) return;
+        if (--*count > 0) return;
+        m_chainCounts.erase(count);
+        m_rendered.remove(chain);
+    }
+    m_model->removeChain(chain);
+}
+
+GLuint Subgraph::render(QSharedPointer<Chain> chain) {
+    {
+        QMutexLocker locker(&m_lock);
+        if (!m_chainCounts.contains(chain)) return 0;
+        auto rendered = m_rendered.value(chain);
+        if (rendered.frame == chain->frame()) return rendered.texture;
+    }
+
+    // A chain is only rendered by one thread at a time,
+    // so no one else can be rendering it right now
+    auto textures = m_model->createCopyForRendering().renderInFrame(chain);
+    auto texture = textures.value(m_output, chain->blankTexture());
+
+    QMutexLocker locker(&m_lock);
+    if (m_chainCounts.contains(chain)) {
+        m_rendered.insert(chain, Rendered{chain->frame(), texture});
+    }
+    return texture;
+}
+
+SubgraphNode::SubgraphNode(Context *context)
+    : VideoNode(context)
+{
+    setInputCount(1);
+}
+
+SubgraphNode::~SubgraphNode() {
+    if (m_subgraph.isNull()) return;
+    for (auto chain : m_chains) {
+        m_subgraph->removeChain(chain);
+    }
+}
+
+QJsonObject SubgraphNode::serialize() {
+    QJsonObject o = VideoNode::serialize();
+    o.insert("file", file());
+    return o;
+}
+
+QString SubgraphNode::file() {
+    QMutexLocker locker(&m_stateLock);
+    return m_file;
+}
+
+QString SubgraphNode::name() {
+    return QFileInfo(file()).baseName();
+}
+
+void SubgraphNode::setFile(QString file) {
+    file = Paths::contractLibraryPath(file);
+    {
+        QMutexLocker locker(&m_stateLock);
+        if (file == m_file) return;
+        m_file = file;
+    }
+
+    QString errorString;
+    auto subgraph = Subgraph::get(context(), file, &errorString);
+    auto chains = this->chains();
+    if (!subgraph.isNull()) {
+        for (auto chain : chains) {
+            subgraph->addChain(chain);
+        }
+    }
+
+    QSharedPointer<Subgraph> oldSubgraph;
+    {
+        QMutexLocker locker(&m_stateLock);
+        oldSubgraph = m_subgraph;
+        m_subgraph = subgraph;
+    }
+    if (!oldSubgraph.isNull()) {
+        for (auto chain : chains) {
+            oldSubgraph->removeChain(chain);
+        }
+    }
+
+    if (subgraph.isNull()) {
+        emit error(errorString);
+        setNodeState(VideoNode::Broken);
+    } else {
+        setNodeState(VideoNode::Ready);
+    }
+    emit fileChanged(file);
+    emit nameChanged(name());
+}
+
+void SubgraphNode::chainsEdited(QList<QSharedPointer<Chain>> added, QList<QSharedPointer<Chain>> removed) {
+    QSharedPointer<Subgraph> subgraph;
+    {
+        QMutexLocker locker(&m_stateLock);
+        subgraph = m_subgraph;
+    }
+    if (subgraph.isNull()) return;
+    for (auto chain : added) {
+        subgraph->addChain(chain);
+    }
+    for (auto chain : removed) {
+        subgraph->removeChain(chain);
+    }
+}
+
+GLuint SubgraphNode::paint(QSharedPointer<Chain> chain, QVector<GLuint> inputTextures) {
+    QSharedPointer<Subgraph> subgraph;
+    {
+        TimedMutexLocker locker(&m_stateLock, &m_renderLockStatistics);
+        if (!m_chains.contains(chain)) return 0;
+        subgraph = m_subgraph;
+    }
+
+    if (subgraph.isNull()) return inputTextures.at(0);
+    return subgraph->render(chain);
+}
+
+QString SubgraphNode::typeName() {
+    return "SubgraphNode";
+}
+
+VideoNodeSP *SubgraphNode::deserialize(Context *context, QJsonObject obj) {
+    QString file = obj.value("file").toString();
+    if (file.isEmpty()) {
+        return nullptr;
+    }
+    auto node = new SubgraphNodeSP(new SubgraphNode(context));
+    (*node)->setFile(file);
+    return node;
+}
+
+bool SubgraphNode::canCreateFromFile(QString filename) {
+    // Saved models meant to be used as subgraphs.
+    // Not every .json file is a model.
+    return filename.endsWith(".subgraph.json", Qt::CaseInsensitive);
+}
+
+VideoNodeSP *SubgraphNode::fromFile(Context *context, QString filename) {
+    auto node = new SubgraphNodeSP(new SubgraphNode(context));
+    (*node)->setFile(filename);
+    return node;
+}
+
+QMap<QString, QString> SubgraphNode::customInstantiators() {
+    return QMap<QString, QString>();
+}
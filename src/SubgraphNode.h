@@ -0,0 +1,128 @@
+#pragma once
+
+#include "VideoNode.h"
+#include <QMutex>
+
+// A model loaded from a saved model file
+// for use inside of another model.
+//
+// Every SubgraphNode that references the same file
+// shares one Subgraph,
+// and the Subgraph renders at most once per chain per frame,
+// so a source stack that is used in several places
+// only costs as much as one copy of it.
+//
+// The output of a subgraph is the last sink in its file,
+// i.e. the most recently added node without any outgoing edges.
+
+class Subgraph {
+public:
+   ~Subgraph();
+
+    // Returns the Subgraph for the given file,
+    // loading it if no SubgraphNode is using it yet.
+    // Returns null and sets `error` if the file could not be loaded,
+    // or if it contains itself.
+    // This must be called from the GUI thread.
+    static QSharedPointer<Subgraph> get(Context *context, QString filename, QString *error);
+
+    // Chains are reference counted,
+    // since each SubgraphNode using this Subgraph
+    // adds all of its chains
+    void addChain(QSharedPointer<Chain> chain);
+    void removeChain(QSharedPointer<Chain> chain);
+
+    // Returns the output texture of the subgraph,
+    // rendering it if this is the first request
+    // for the current frame of the chain.
+    // This function is thread-safe.
+    GLuint render(QSharedPointer<Chain> chain);
+
+protected:
+    Subgraph(QString filename);
+
+    // The last render of each chain
+    struct Rendered {
+        qint64 frame{-1};
+        GLuint texture{};
+    };
+
+    QString m_filename;
+    QSharedPointer<Model> m_model;
+    QSharedPointer<VideoNode> m_output;
+    QMutex m_lock;
+    QMap<QSharedPointer<Chain>, int> m_chainCounts;
+    QMap<QSharedPointer<Chain>, Rendered> m_rendered;
+
+    // Subgraphs by absolute filename
+    static QMutex s_lock;
+    static QMap<QString, QWeakPointer<Subgraph>> s_subgraphs;
+    // Files that are currently being loaded,
+    // to catch files that contain themselves
+    static QStringList s_loading;
+};
+
+// This class extends VideoNode to render a Subgraph.
+// The input is passed through
+// if the subgraph can't be loaded.
+// Saved models named *.subgraph.json
+// can be created straight from the library.
+
+class SubgraphNode
+    : public VideoNode {
+    Q_OBJECT
+    Q_PROPERTY(QString file READ file WRITE setFile NOTIFY fileChanged)
+    Q_PROPERTY(QString name READ name NOTIFY nameChanged)
+
+public:
+    SubgraphNode(Context *context);
+   ~SubgraphNode() override;
+
+    QJsonObject serialize() override;
+
+    GLuint paint(QSharedPointer<Chain> chain, QVector<GLuint> inputTextures) override;
+
+    // These static methods are required for VideoNode creation
+    // through the registry
+
+    // A string representation of this VideoNode type
+    static QString typeName();
+
+    // Create a VideoNode from a JSON description of one
+    // Returns nullptr if the description is invalid
+    static VideoNodeSP *deserialize(Context *context, QJsonObject obj);
+
+    // Return true if a VideoNode could be created from
+    // the given filename
+    // This check should be very quick.
+    static bool canCreateFromFile(QString filename);
+
+    // Create a VideoNode from a filename
+    // Returns nullptr if a VideoNode cannot be create from the given filename
+    static VideoNodeSP *fromFile(Context *context, QString filename);
+
+    // Returns QML filenames that can be loaded
+    // to instantiate custom instances of this VideoNode
+    static QMap<QString, QString> customInstantiators();
+
+public slots:
+    // The saved model file to render
+    QString file();
+    void setFile(QString file);
+
+    QString name();
+
+protected slots:
+    void chainsEdited(QList<QSharedPointer<Chain>> added, QList<QSharedPointer<Chain>> removed) override;
+
+signals:
+    void fileChanged(QString file);
+    void nameChanged(QString name);
+
+protected:
+    QString m_file;
+    QSharedPointer<Subgraph> m_subgraph;
+};
+
+typedef QmlSharedPointer<SubgraphNode, VideoNodeSP> SubgraphNodeSP;
+Q_DECLARE_METATYPE(SubgraphNodeSP*)
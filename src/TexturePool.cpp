@@ -0,0 +1,90 @@
+#include "TexturePool.h"
+
+constexpr int TexturePool::MAX_IDLE_FRAMES;
+
+TexturePool::~TexturePool() {
+    // Only textures released after clear() should be left
+    for (auto entry : m_free) {
+        delete entry.texture;
+    }
+}
+
+QSharedPointer<QOpenGLTexture> TexturePool::acquire(QOpenGLTexture::Target target,
+                                                    QSize size,
+                                                    int layers,
+                                                    QOpenGLTexture::TextureFormat format,
+                                                    int mipLevels) {
+    if (target != QOpenGLTexture::Target2DArray) layers = 1;
+
+    QOpenGLTexture *texture = nullptr;
+    {
+        QMutexLocker locker(&m_lock);
+        for (int i = 0; i < m_free.count(); i++) {
+            auto t = m_free.at(i).texture;
+            if (t->target() == target
+             && t->width() == size.width()
+             && t->height() == size.height()
+             && t->layers() == layers
+             && t->format() == format
+             && t->mipLevels() == mipLevels) {
+                texture = t;
+                m_free.removeAt(i);
+                break;
+            }
+        }
+    }
+
+    if (texture == nullptr) {
+        texture = new QOpenGLTexture(target);
+        texture->setSize(size.width(), size.height());
+        if (target == QOpenGLTexture::Target2DArray) {
+            texture->setLayers(layers);
+        }
+        texture->setFormat(format);
+        texture->setMipLevels(mipLevels);
+        texture->allocateStorage();
+        texture->setMinMagFilters(mipLevels > 1 ? QOpenGLTexture::LinearMipMapLinear : QOpenGLTexture::Linear,
+                                  QOpenGLTexture::Linear);
+        texture->setWrapMode(QOpenGLTexture::ClampToEdge);
+    }
+
+    QWeakPointer<TexturePool> weakPool = sharedFromThis();
+    return QSharedPointer<QOpenGLTexture>(texture, [weakPool](QOpenGLTexture *t) {
+        auto pool = weakPool.toStrongRef();
+        if (pool) {
+            pool->release(t);
+        } else {
+            delete t;
+        }
+    });
+}
+
+void TexturePool::release(QOpenGLTexture *texture) {
+    QMutexLocker locker(&m_lock);
+    m_free.append({texture, 0});
+}
+
+void TexturePool::clear() {
+    QList<Entry> toDelete;
+    {
+        QMutexLocker locker(&m_lock);
+        toDelete.swap(m_free);
+    }
+    for (auto entry : toDelete) {
+        delete entry.texture;
+    }
+}
+
+void TexturePool::collect() {
+    QList<QOpenGLTexture *> toDelete;
+    {
+        QMutexLocker locker(&m_lock);
+        for (int i = m_free.count() - 1; i >= 0; i--) {
+            if (++m_free[i].idleFrames > MAX_IDLE_FRAMES) {
+                toDelete.append(m_free.at(i).texture);
+                m_free.removeAt(i);
+            }
+        }
+    }
+    qDeleteAll(toDelete);
+}
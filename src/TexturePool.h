@@ -0,0 +1,58 @@
+#pragma once
+
+#include <QOpenGLTexture>
+#include <QSharedPointer>
+#include <QEnableSharedFromThis>
+#include <QMutex>
+#include <QList>
+#include <QSize>
+
+// A TexturePool hands out textures
+// that nodes need for a while
+// (e.g. frame history or blur pyramids)
+// and takes them back when they are no longer referenced,
+// so that a node that is reloaded or re-created
+// can reuse a texture of the same shape
+// instead of allocating a new one.
+//
+// Released textures that are not reused within
+// MAX_IDLE_FRAMES calls to collect() are freed.
+//
+// acquire(), collect() and clear() must be called
+// with an OpenGL context current.
+// Textures may be released from any thread.
+
+class TexturePool : public QEnableSharedFromThis<TexturePool> {
+public:
+    ~TexturePool();
+
+    // Returns a texture with exactly the given shape.
+    // layers only applies to Target2DArray.
+    QSharedPointer<QOpenGLTexture> acquire(QOpenGLTexture::Target target,
+                                           QSize size,
+                                           int layers,
+                                           QOpenGLTexture::TextureFormat format,
+                                           int mipLevels=1);
+
+    // Frees textures that have been idle for too long.
+    // Call this once per frame.
+    void collect();
+
+    // Frees every texture that isn't in use.
+    // Call this before letting go of the pool,
+    // with a context current that can see the textures.
+    void clear();
+
+    static constexpr int MAX_IDLE_FRAMES = 60;
+
+protected:
+    void release(QOpenGLTexture *texture);
+
+    struct Entry {
+        QOpenGLTexture *texture;
+        int idleFrames;
+    };
+
+    QMutex m_lock;
+    QList<Entry> m_free;
+};
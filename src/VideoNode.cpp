@@ -8,20 +8,12 @@ VideoNode::VideoNode(Context *context)
 }
 
 int VideoNode::inputCount() {
-    QMutexLocker locker(&m_stateLock);
-    return m_inputCount;
+    return m_inputCount.load();
 }
 
 void VideoNode::setInputCount(int value) {
-    bool changed = false;
-    {
-        QMutexLocker locker(&m_stateLock);
-        if (value != m_inputCount) { 
-            m_inputCount = value;
-            changed = true;
-        }
-    }
-    if (changed) emit inputCountChanged(value);
+    auto oldValue = m_inputCount.fetchAndStoreOrdered(value);
+    if (oldValue != value) emit inputCountChanged(value);
 }
 
 VideoNode::NodeState VideoNode::nodeState() {
@@ -124,6 +116,14 @@ void VideoNode::setFrozenParameters(bool value) {
     if (changed) emit frozenParametersChanged(value);
 }
 
+QVariantMap VideoNode::renderLockStatistics() {
+    return m_renderLockStatistics.toVariantMap();
+}
+
+void VideoNode::resetRenderLockStatistics() {
+    m_renderLockStatistics.reset();
+}
+
 Context *VideoNode::context() {
     // Not mutable, so no need to lock
     return m_context;
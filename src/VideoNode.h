@@ -2,11 +2,13 @@
 
 #include "Chain.h"
 #include "Model.h"
+#include "LockStatistics.h"
 #include <QObject>
 #include <QOpenGLTexture>
 #include <QSharedPointer>
 #include <QOpenGLFunctions>
 #include <QMutex>
+#include <QAtomicInt>
 
 // This is an abstract base class
 // for nodes in the DAG.
@@ -115,6 +117,11 @@ public slots:
     bool frozenParameters();
     void setFrozenParameters(bool value);
 
+    // How long the render path has spent waiting for and holding
+    // m_stateLock. Nodes record this around the locks they take in paint().
+    QVariantMap renderLockStatistics();
+    void resetRenderLockStatistics();
+
 protected slots:
     // If your node does anything at all, you will need to override this method
     virtual void chainsEdited(QList<QSharedPointer<Chain>> added, QList<QSharedPointer<Chain>> removed);
@@ -147,7 +154,7 @@ signals:
 protected:
     VideoNode(Context *context);
 
-    int m_inputCount{};
+    QAtomicInt m_inputCount{}; // Read on the render path without locking
     QMutex m_stateLock; // TODO this is no longer a meaningful concept, should use separate locks for separate fields
     QList<QSharedPointer<Chain>> m_chains;
     Context *m_context{};
@@ -156,6 +163,7 @@ protected:
     bool m_frozenInput{false};
     bool m_frozenOutput{false};
     bool m_frozenParameters{false};
+    LockStatistics m_renderLockStatistics;
 };
 
 QDebug operator<<(QDebug debug, const VideoNode &vn);
@@ -229,6 +229,8 @@ runRadianceCli(QGuiApplication *app, QString modelName, QString nodeFilename, QS
 
         QString gifFilename = QString("%1" IMG_FORMAT).arg(name);
         (*ffmpegNode)->setFFmpegArguments({outputDir.filePath(gifFilename)});
+        // Every frame is wanted, however long ffmpeg takes
+        (*ffmpegNode)->setDropFrames(false);
         (*ffmpegNode)->setRecording(true);
 
         // Render 101 frames
@@ -255,6 +257,7 @@ runRadianceCli(QGuiApplication *app, QString modelName, QString nodeFilename, QS
 
         // Reset state
         (*ffmpegNode)->setRecording(false);
+        (*ffmpegNode)->waitForStopped();
     }
 
     return 0;
@@ -0,0 +1,122 @@
+#pragma once
+
+// The layout of the POSIX shared memory
+// that a SharedMemoryOutputNode publishes frames to.
+//
+// This header has no dependencies,
+// so programs that read the frames can copy it as it is.
+//
+// The shared memory object (see shm_open) starts with a radiance_shm_header,
+// followed by slot_count slots of slot_size bytes each, starting at slots_offset.
+// Each slot is a radiance_shm_slot followed by the pixels.
+// Frame number n (counting from 1) goes in slot n % slot_count.
+//
+// To read the newest frame:
+// 1. Load latest (acquire). 0 means there is no frame yet.
+// 2. Check that the slot's sequence (acquire) is latest.
+// 3. Read the pixels.
+// 4. Check that the slot's sequence is still latest (after an acquire fence).
+//    If not, Radiance overwrote the slot while you were reading it; start over.
+// radiance_shm_begin_read() and radiance_shm_end_read() do the checking.
+//
+// When Radiance stops publishing to the object (e.g. its name changed),
+// it sets magic to 0 and bumps notify. Reopen it by name then.
+//
+// To wait for the next frame, remember notify and wait for it to change.
+// On Linux, that wait can be a FUTEX_WAIT on notify (see radiance_shm_wait()),
+// since Radiance does a FUTEX_WAKE after every frame.
+// Elsewhere, poll it.
+//
+// Pixels are RGBA, 1 byte per channel,
+// a row at a time from the bottom row up (as OpenGL reads them.)
+//
+// Everything is in the machine's own byte order.
+
+#include <stdint.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RADIANCE_SHM_MAGIC 0x6d687352u // "Rshm"
+#define RADIANCE_SHM_VERSION 1
+
+#define RADIANCE_SHM_FORMAT_RGBA8 0
+
+struct radiance_shm_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slots_offset;
+    uint32_t slot_size;
+    uint32_t slot_count;
+    uint32_t reserved0;
+    // The number of the newest complete frame, or 0
+    uint64_t latest;
+    // Goes up by 1 after every frame
+    uint32_t notify;
+    uint32_t reserved1[3];
+};
+
+struct radiance_shm_slot {
+    // The number of the frame in the slot,
+    // or 0 while it is being written
+    uint64_t sequence;
+    // When the frame was rendered: CLOCK_MONOTONIC, in nanoseconds
+    uint64_t timestamp_ns;
+    uint32_t width;
+    uint32_t height;
+    uint32_t format;
+    // Bytes of pixels after this header
+    uint32_t size;
+    uint32_t reserved[8];
+};
+
+static inline struct radiance_shm_slot *radiance_shm_slot(struct radiance_shm_header *header, uint64_t sequence) {
+    return (struct radiance_shm_slot *)((char *)header + header->slots_offset
+                                        + (sequence % header->slot_count) * header->slot_size);
+}
+
+static inline const uint8_t *radiance_shm_pixels(const struct radiance_shm_slot *slot) {
+    return (const uint8_t *)(slot + 1);
+}
+
+// Returns the slot with the newest frame and stores its number in sequence,
+// or returns 0 if there is none
+static inline struct radiance_shm_slot *radiance_shm_begin_read(struct radiance_shm_header *header, uint64_t *sequence) {
+    uint64_t latest = __atomic_load_n(&header->latest, __ATOMIC_ACQUIRE);
+    if (latest == 0) return 0;
+    struct radiance_shm_slot *slot = radiance_shm_slot(header, latest);
+    if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != latest) return 0;
+    *sequence = latest;
+    return slot;
+}
+
+// Returns nonzero if the frame wasn't overwritten while it was read
+static inline int radiance_shm_end_read(struct radiance_shm_slot *slot, uint64_t sequence) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&slot->sequence, __ATOMIC_RELAXED) == sequence;
+}
+
+#ifdef __linux__
+// Waits until notify is no longer last_notify,
+// or for timeout_ns nanoseconds (if it isn't negative).
+// Returns the new notify.
+static inline uint32_t radiance_shm_wait(struct radiance_shm_header *header, uint32_t last_notify, int64_t timeout_ns) {
+    struct timespec timeout = {(time_t)(timeout_ns / 1000000000), (long)(timeout_ns % 1000000000)};
+    if (__atomic_load_n(&header->notify, __ATOMIC_ACQUIRE) == last_notify) {
+        syscall(SYS_futex, &header->notify, FUTEX_WAIT, last_notify, timeout_ns < 0 ? 0 : &timeout, 0, 0);
+    }
+    return __atomic_load_n(&header->notify, __ATOMIC_ACQUIRE);
+}
+#endif
+
+#ifdef __cplusplus
+}
+#endif